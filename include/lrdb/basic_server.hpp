@@ -1,7 +1,10 @@
 #pragma once
 
 #if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -12,6 +15,32 @@ namespace lrdb {
 
 #define LRDB_SERVER_PROTOCOL_VERSION "2"
 
+/// @brief StreamType has void set_binary_framing(bool)
+template <typename StreamType>
+class has_binary_framing {
+  template <typename T>
+  static auto check(T* stream)
+      -> decltype(stream->set_binary_framing(true), std::true_type());
+  template <typename T>
+  static std::false_type check(...);
+
+ public:
+  static const bool value = decltype(check<StreamType>(0))::value;
+};
+
+/// @brief StreamType has void set_receive_binary_framing(bool)
+template <typename StreamType>
+class has_receive_binary_framing {
+  template <typename T>
+  static auto check(T* stream)
+      -> decltype(stream->set_receive_binary_framing(true), std::true_type());
+  template <typename T>
+  static std::false_type check(...);
+
+ public:
+  static const bool value = decltype(check<StreamType>(0))::value;
+};
+
 /// @brief Debug Server Class
 /// template type is messaging communication customization point
 /// require members
@@ -29,6 +58,10 @@ namespace lrdb {
 ///  std::function<void()> on_connection;
 ///  std::function<void()> on_close;
 ///  std::function<void(const std::string&)> on_error;
+/// optional member
+///  void set_binary_framing(bool); /// length prefixed framing for MessagePack
+///  void set_receive_binary_framing(bool); /// switch receiving only. Required
+///  if data is received on other thread
 template <typename StreamType>
 class basic_server {
  public:
@@ -37,6 +70,13 @@ class basic_server {
   template <typename... StreamArgs>
   basic_server(StreamArgs&&... arg)
       : wait_for_connect_(true),
+        attach_on_connect_(false),
+        poll_tick_count_(1000),
+        poll_interval_(1000),
+        ticks_since_poll_(0),
+        result_begin_(0),
+        batching_(false),
+        msgpack_(false),
         command_stream_(std::forward<StreamArgs>(arg)...) {
     init();
   }
@@ -46,12 +86,43 @@ class basic_server {
   /// @brief attach (or detach) for debug target
   /// @param lua_State*  debug target
   void reset(lua_State* L = 0) {
-    debugger_.reset(L);
+    {
+      std::lock_guard<std::mutex> lk(target_mutex_);
+      attach_on_connect_ = false;
+      debugger_.reset(L);
+    }
     if (!L) {
       exit();
     }
   }
 
+  /// @brief attach for debug target, but install hook when client connected.
+  /// Debug target runs without hook while no client is connected. Hook is
+  /// installed from background thread at connection and removed at
+  /// disconnection. Does not wait for connection nor pause at entry.
+  /// Coroutines created before connection are hooked at first hook event
+  /// after connection. (see debugger::resume_hook)
+  /// StreamType require additional member
+  ///  void set_on_connection_async(std::function<void()>); /// callback
+  ///  called on background thread at connection.
+  /// @param lua_State*  debug target
+  void reset_on_connect(lua_State* L) {
+    {
+      std::lock_guard<std::mutex> lk(target_mutex_);
+      wait_for_connect_ = false;
+      attach_on_connect_ = true;
+      debugger_.reset(L);
+      debugger_.suspend_hook();
+      debugger_.unpause();
+    }
+    command_stream_.set_on_connection_async([this]() {
+      std::lock_guard<std::mutex> lk(target_mutex_);
+      if (attach_on_connect_) {
+        debugger_.resume_hook();
+      }
+    });
+  }
+
   /// @brief Exit debug server
   void exit() {
     send_notify(notify_message("exit"));
@@ -60,13 +131,26 @@ class basic_server {
 
   StreamType& command_stream() { return command_stream_; };
 
+  /// @brief set command polling frequency while running.
+  /// command stream is polled when tick_count ticks passed or interval
+  /// elapsed since last poll, whichever comes first.
+  /// @param tick_count tick count. 1 is polling every tick. default 1000
+  /// @param interval elapsed time. zero is disable. default 1ms
+  void set_poll_interval(unsigned int tick_count,
+                         std::chrono::microseconds interval) {
+    poll_tick_count_ = tick_count > 0 ? tick_count : 1;
+    poll_interval_ = interval;
+  }
+
  private:
   void init() {
     debugger_.set_pause_handler([&](debugger&) {
+      result_cache_.clear();
       send_pause_status();
       while (debugger_.paused() && command_stream_.is_open()) {
         command_stream_.run_one();
       }
+      result_cache_.clear();
       send_notify(notify_message("running"));
     });
 
@@ -74,14 +158,40 @@ class basic_server {
       if (wait_for_connect_) {
         command_stream_.wait_for_connection();
       }
-      command_stream_.poll();
+      if (poll_required()) {
+        command_stream_.poll();
+      }
     });
 
-    command_stream_.on_connection = [=]() { connected_done(); };
+    command_stream_.on_connection = [=]() {
+      if (attach_on_connect_) {
+        debugger_.resume_hook();
+      }
+      connected_done();
+    };
     command_stream_.on_data = [=](const std::string& data) {
       execute_message(data);
     };
-    command_stream_.on_close = [=]() { debugger_.unpause(); };
+    command_stream_.on_close = [=]() {
+      set_msgpack(false);
+      debugger_.unpause();
+      if (attach_on_connect_) {
+        debugger_.suspend_hook();
+      }
+    };
+  }
+  bool poll_required() {
+    bool required = ++ticks_since_poll_ >= poll_tick_count_;
+    std::chrono::steady_clock::time_point now;
+    if (poll_interval_.count() > 0) {
+      now = std::chrono::steady_clock::now();
+      required = required || now - last_poll_time_ >= poll_interval_;
+    }
+    if (required) {
+      ticks_since_poll_ = 0;
+      last_poll_time_ = now;
+    }
+    return required;
   }
   void send_pause_status() {
     json::object pauseparam;
@@ -99,6 +209,12 @@ class basic_server {
     lua["copyright"] = json::value(LUA_COPYRIGHT);
 
     param["lua"] = json::value(lua);
+    if (has_binary_framing<StreamType>::value) {
+      json::array formats;
+      formats.push_back(json::value("json"));
+      formats.push_back(json::value("msgpack"));
+      param["formats"] = json::value(formats);
+    }
     send_notify(notify_message("connected", json::value(param)));
   }
 
@@ -107,21 +223,149 @@ class basic_server {
   }
   void execute_message(const std::string& message) {
     json::value msg;
-    std::string err = json::parse(msg, message);
+    std::string err = msgpack_ ? message::msgpack::decode(message, msg)
+                               : json::parse(msg, message);
     if (err.empty()) {
+      if (message::is_batch(msg)) {
+        execute_batch(msg.get<json::array>());
+      } else if (message::is_request(msg)) {
+        request_message request;
+        message::parse(msg, request);
+        execute_request(request);
+      }
+    }
+  }
+  /// @brief execute requests in order, and send responses as one array.
+  /// notifications while executing are sent immediately
+  void execute_batch(const json::array& batch) {
+    if (batch.empty()) {
+      response_message response;
+      response.error =
+          response_error(response_error::InvalidRequest, "empty batch");
+      send_response(response);
+      return;
+    }
+    batch_writer_.clear();
+    batch_writer_.begin_array();
+    batching_ = true;
+    for (const auto& msg : batch) {
       if (message::is_request(msg)) {
         request_message request;
         message::parse(msg, request);
         execute_request(request);
+      } else {
+        response_message response;
+        response.error =
+            response_error(response_error::InvalidRequest, "invalid request");
+        send_response(response);
       }
     }
+    batching_ = false;
+    batch_writer_.end_array();
+    send_message(batch_writer_.str());
+  }
+  /// @brief send response, or append it to batch while executing batch
+  bool send_response_message(const std::string& message) {
+    if (batching_) {
+      batch_writer_.raw_value(message);
+      return true;
+    }
+    return send_message(message);
   }
 
   bool send_notify(const notify_message& message) {
+    if (msgpack_) {
+      return send_message(message::msgpack::encode(message::to_value(message)));
+    }
     return send_message(message::serialize(message));
   }
   bool send_response(response_message& message) {
-    return send_message(message::serialize(message));
+    if (!cache_key_.empty() && !message.error) {
+      result_cache_[cache_key_] = msgpack_
+                                      ? message::msgpack::encode(message.result)
+                                      : message.result.serialize();
+    }
+    if (msgpack_) {
+      return send_response_message(
+          message::msgpack::encode(message::to_value(message)));
+    }
+    return send_response_message(message::serialize(message));
+  }
+  /// @brief switch wire format of following messages
+  void set_msgpack(bool enable) {
+    if (msgpack_ == enable) {
+      return;
+    }
+    msgpack_ = enable;
+    json_writer::format_type format =
+        enable ? json_writer::MSGPACK : json_writer::JSON;
+    result_writer_.set_format(format);
+    batch_writer_.set_format(format);
+    result_cache_.clear();
+    typedef std::integral_constant<bool, has_binary_framing<StreamType>::value>
+        supported;
+    set_binary_framing(enable, supported());
+  }
+  void set_binary_framing(bool enable, std::true_type) {
+    command_stream_.set_binary_framing(enable);
+  }
+  void set_binary_framing(bool, std::false_type) {}
+  void set_receive_binary_framing(bool enable, std::true_type) {
+    command_stream_.set_receive_binary_framing(enable);
+  }
+  void set_receive_binary_framing(bool, std::false_type) {}
+  /// @brief begin response with result written to returned writer.
+  /// result value must be written, and then call end_result.
+  /// Large results are written from Lua stack without json::value tree.
+  json_writer& begin_result() {
+    result_writer_.clear();
+    result_writer_.begin_object();
+    result_writer_.key("jsonrpc");
+    result_writer_.value("2.0");
+    result_writer_.key("result");
+    result_begin_ = result_writer_.str().size();
+    return result_writer_;
+  }
+  bool end_result(const response_message& message) {
+    if (!cache_key_.empty()) {
+      result_cache_[cache_key_] = result_writer_.str().substr(result_begin_);
+    }
+    result_writer_.key("id");
+    result_writer_.value(message.id);
+    result_writer_.end_object();
+    return send_response_message(result_writer_.str());
+  }
+  /// @brief param "lazy" is true. tables and userdata are written as handle
+  /// for get_children instead of expanding to depth
+  static bool is_lazy(const json::value& param) {
+    return param.get("lazy").is<bool>() && param.get("lazy").get<bool>();
+  }
+  /// param "format" is "json" or "msgpack". response is sent in current
+  /// format, and then following messages are switched. MessagePack messages
+  /// are framed by 4 bytes big endian length. Client must not send next
+  /// message until this response.
+  bool set_format_request(response_message& response,
+                          const json::value& param) {
+    const json::value& format = param.get("format");
+    bool supported = has_binary_framing<StreamType>::value &&
+                     format.is<std::string>() &&
+                     (format.get<std::string>() == "json" ||
+                      format.get<std::string>() == "msgpack");
+    if (!supported || batching_) {
+      response.error =
+          response_error(response_error::InvalidParams, "invalid params");
+      return send_response(response);
+    }
+    bool msgpack = format.get<std::string>() == "msgpack";
+    // receiving is switched before response, because client may send next
+    // message as soon as response is written
+    typedef std::integral_constant<
+        bool, has_receive_binary_framing<StreamType>::value>
+        receive_supported;
+    set_receive_binary_framing(msgpack, receive_supported());
+    bool ret = send_response(response);
+    set_msgpack(msgpack);
+    return ret;
   }
   bool step_request(response_message& response, const json::value&) {
     debugger_.step();
@@ -267,13 +511,13 @@ class basic_server {
       int stack_no = static_cast<int>(param.get("stack_no").get<double>());
       auto callstack = debugger_.get_call_stack();
       if (int(callstack.size()) > stack_no) {
-        auto localvar = callstack[stack_no].get_local_vars(depth);
-        json::object obj;
-        for (auto& var : localvar) {
-          obj[var.first] = var.second;
+        if (is_lazy(param)) {
+          callstack[stack_no].get_local_vars(begin_result(),
+                                             debugger_.references());
+        } else {
+          callstack[stack_no].get_local_vars(begin_result(), depth);
         }
-        response.result = json::value(obj);
-        return send_response(response);
+        return end_result(response);
       }
     }
     response.error =
@@ -299,6 +543,11 @@ class basic_server {
           param.get<json::object>().at("stack_no").get<double>());
       auto callstack = debugger_.get_call_stack();
       if (int(callstack.size()) > stack_no) {
+        if (is_lazy(param)) {
+          callstack[stack_no].get_upvalues(begin_result(),
+                                           debugger_.references());
+          return end_result(response);
+        }
         auto localvar = callstack[stack_no].get_upvalues(depth);
         json::object obj;
         for (auto& var : localvar) {
@@ -338,13 +587,17 @@ class basic_server {
       auto callstack = debugger_.get_call_stack();
       if (int(callstack.size()) > stack_no) {
         std::string error;
-        json::value ret = json::value(
-            callstack[stack_no].eval(chunk.c_str(), error, use_global,
-                                     use_upvalue, use_local, depth + 1));
-        if (error.empty()) {
-          response.result = ret;
-
-          return send_response(response);
+        bool success =
+            is_lazy(param)
+                ? callstack[stack_no].eval(begin_result(),
+                                           debugger_.references(),
+                                           chunk.c_str(), error, use_global,
+                                           use_upvalue, use_local)
+                : callstack[stack_no].eval(begin_result(), chunk.c_str(),
+                                           error, use_global, use_upvalue,
+                                           use_local, depth + 1);
+        if (success) {
+          return end_result(response);
         } else {
           response.error = response_error(response_error::InvalidParams, error);
 
@@ -362,11 +615,290 @@ class basic_server {
     int depth = param.get("depth").is<double>()
                     ? static_cast<int>(param.get("depth").get<double>())
                     : 1;
-    response.result =
-        debugger_.get_global_table(depth + 1);  //+ 1 is global table self
+    if (is_lazy(param)) {
+      debugger_.get_global_table(begin_result(), debugger_.references());
+    } else {
+      debugger_.get_global_table(begin_result(),
+                                 depth + 1);  //+ 1 is global table self
+    }
+    return end_result(response);
+  }
+  /// response children of handle written by "lazy" requests, as array of
+  /// {"key","value"}. param "start" is number of children to skip, "count"
+  /// is max number of children. handles are valid until resume
+  bool get_children_request(response_message& response,
+                            const json::value& param) {
+    if (!param.get("reference").is<double>()) {
+      response.error =
+          response_error(response_error::InvalidParams, "invalid params");
+      return send_response(response);
+    }
+    int reference = static_cast<int>(param.get("reference").get<double>());
+    size_t start = param.get("start").is<double>()
+                       ? static_cast<size_t>(param.get("start").get<double>())
+                       : 0;
+    size_t count = param.get("count").is<double>()
+                       ? static_cast<size_t>(param.get("count").get<double>())
+                       : size_t(-1);
+    if (debugger_.get_children(begin_result(), reference, start, count)) {
+      return end_result(response);
+    }
+    response.error = response_error(response_error::InvalidParams,
+                                    "invalid reference");
+    return send_response(response);
+  }
+
+  bool profile_start_request(response_message& response,
+                             const json::value& param) {
+    std::chrono::microseconds interval(1000);
+    if (param.get("interval").is<double>()) {
+      interval = std::chrono::microseconds(
+          static_cast<long long>(param.get("interval").get<double>()));
+    }
+    debugger_.profiler().start(interval);
+    return send_response(response);
+  }
+  bool profile_stop_request(response_message& response, const json::value&) {
+    sampling_profiler& profiler = debugger_.profiler();
+    profiler.stop();
+    json::object res;
+    res["samples"] = json::value(double(profiler.sample_count()));
+    res["collapsed"] = json::value(profiler.collapsed_stacks());
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  bool function_profile_start_request(response_message& response,
+                                      const json::value&) {
+    debugger_.start_function_profile();
+    return send_response(response);
+  }
+  bool function_profile_stop_request(response_message& response,
+                                     const json::value&) {
+    typedef std::chrono::duration<double, std::micro> microseconds;
+    debugger_.stop_function_profile();
+    const function_profiler& profiler = debugger_.function_profile();
+    const auto& functions = profiler.functions();
+    const auto& stats = profiler.stats();
+    json::array res;
+    for (size_t i = 0; i < stats.size(); ++i) {
+      if (stats[i].calls == 0) {
+        continue;
+      }
+      json::object data;
+      data["func"] = json::value(functions[i].name);
+      data["file"] = json::value(functions[i].source);
+      data["line"] = json::value(double(functions[i].linedefined));
+      data["calls"] = json::value(double(stats[i].calls));
+      data["inclusive"] =
+          json::value(microseconds(stats[i].inclusive).count());
+      data["exclusive"] =
+          json::value(microseconds(stats[i].exclusive).count());
+      res.push_back(json::value(data));
+    }
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  bool coverage_start_request(response_message& response,
+                              const json::value& param) {
+    if (param.get("clear").is<bool>() && param.get("clear").get<bool>()) {
+      debugger_.coverage().clear();
+    }
+    debugger_.start_coverage();
+    return send_response(response);
+  }
+  bool coverage_stop_request(response_message& response, const json::value&) {
+    debugger_.stop_coverage();
+    return send_response(response);
+  }
+  bool get_coverage_request(response_message& response,
+                            const json::value& param) {
+    const line_coverage& coverage = debugger_.coverage();
+    if (param.get("format").is<std::string>() &&
+        param.get("format").get<std::string>() == "lcov") {
+      response.result = json::value(coverage.lcov());
+      return send_response(response);
+    }
+    json::array res;
+    for (const auto& chunk : coverage.chunks()) {
+      json::array executed;
+      json::array unexecuted;
+      for (int line = 0; line < chunk.line_end(); ++line) {
+        if (chunk.is_executed(line)) {
+          executed.push_back(json::value(double(line)));
+        } else if (chunk.is_valid(line)) {
+          unexecuted.push_back(json::value(double(line)));
+        }
+      }
+      json::object data;
+      data["file"] = json::value(chunk.source);
+      data["executed"] = json::value(executed);
+      data["unexecuted"] = json::value(unexecuted);
+      res.push_back(json::value(data));
+    }
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  bool start_line_counts_request(response_message& response,
+                                 const json::value& param) {
+    if (!param.get("file").is<std::string>()) {
+      response.error =
+          response_error(response_error::InvalidParams, "invalid params");
+      return send_response(response);
+    }
+    debugger_.start_line_counts(param.get("file").get<std::string>());
+    return send_response(response);
+  }
+  bool stop_line_counts_request(response_message& response,
+                                const json::value& param) {
+    if (param.get("file").is<std::string>()) {
+      debugger_.stop_line_counts(param.get("file").get<std::string>());
+    } else {
+      debugger_.clear_line_counts();
+    }
+    return send_response(response);
+  }
+  bool get_line_counts_request(response_message& response,
+                               const json::value& param) {
+    if (!param.get("file").is<std::string>()) {
+      response.error =
+          response_error(response_error::InvalidParams, "invalid params");
+      return send_response(response);
+    }
+    const std::vector<size_t>& counts =
+        debugger_.line_counts(param.get("file").get<std::string>());
+    json::array res;
+    for (size_t line = 0; line < counts.size(); ++line) {
+      if (counts[line] == 0) {
+        continue;
+      }
+      json::object data;
+      data["line"] = json::value(double(line));
+      data["count"] = json::value(double(counts[line]));
+      res.push_back(json::value(data));
+    }
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  bool alloc_profile_start_request(response_message& response,
+                                   const json::value&) {
+    debugger_.start_alloc_profile();
+    return send_response(response);
+  }
+  /// stop and response top allocation sites. param "count" is max number
+  /// of sites (default 20)
+  bool alloc_profile_stop_request(response_message& response,
+                                  const json::value& param) {
+    size_t count = param.get("count").is<double>()
+                       ? static_cast<size_t>(param.get("count").get<double>())
+                       : 20;
+    debugger_.stop_alloc_profile();
+    const allocation_profiler& profiler = debugger_.alloc_profile();
+    json::array sites;
+    for (const auto& site : profiler.top(count)) {
+      json::object data;
+      if (!site.source.empty()) {
+        data["file"] = json::value(site.source);
+        data["func"] = json::value(site.name);
+        data["line"] = json::value(double(site.line));
+      }
+      data["count"] = json::value(double(site.count));
+      data["bytes"] = json::value(double(site.bytes));
+      sites.push_back(json::value(data));
+    }
+    json::object res;
+    res["total_count"] = json::value(double(profiler.total_count()));
+    res["total_bytes"] = json::value(double(profiler.total_bytes()));
+    res["sites"] = json::value(sites);
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  /// snapshot text is sent by "heap_snapshot_chunk" notify with request id.
+  /// param "chunk_size" is max text size of a notify (default 64KiB)
+  /// Text is streamed by chunks, but retained sizes need whole graph on
+  /// debuggee side. about 40 bytes per object and 8 bytes per edge.
+  bool heap_snapshot_request(response_message& response,
+                             const json::value& param) {
+    size_t chunk_size =
+        param.get("chunk_size").is<double>()
+            ? static_cast<size_t>(param.get("chunk_size").get<double>())
+            : 64 * 1024;
+    heap_snapshot snapshot(chunk_size);
+    debugger_.take_heap_snapshot(snapshot, [&](const std::string& chunk) {
+      json::object data;
+      data["id"] = response.id;
+      data["data"] = json::value(chunk);
+      send_notify(notify_message("heap_snapshot_chunk", json::value(data)));
+    });
+    json::object res;
+    res["nodes"] = json::value(double(snapshot.node_count()));
+    res["edges"] = json::value(double(snapshot.edge_count()));
+    res["total_size"] = json::value(double(snapshot.total_size()));
+    response.result = json::value(res);
+    return send_response(response);
+  }
 
+  /// keep fingerprints of current objects for heap_diff
+  bool heap_baseline_request(response_message& response, const json::value&) {
+    debugger_.take_heap_baseline(heap_diff_);
+    json::object res;
+    res["objects"] = json::value(double(heap_diff_.baseline_count()));
+    response.result = json::value(res);
     return send_response(response);
   }
+  /// response objects added since heap_baseline, grouped by owner path.
+  /// param "count" is max number of groups (default 20)
+  bool heap_diff_request(response_message& response,
+                         const json::value& param) {
+    if (heap_diff_.baseline_count() == 0) {
+      response.error = response_error(response_error::InvalidRequest,
+                                      "heap_baseline is not taken");
+      return send_response(response);
+    }
+    size_t count = param.get("count").is<double>()
+                       ? static_cast<size_t>(param.get("count").get<double>())
+                       : 20;
+    json::array groups;
+    for (const auto& growth : debugger_.heap_growth(heap_diff_, count)) {
+      json::object data;
+      data["path"] = json::value(growth.path);
+      data["type"] = json::value(std::string(growth.type));
+      data["count"] = json::value(double(growth.count));
+      data["size"] = json::value(double(growth.size));
+      groups.push_back(json::value(data));
+    }
+    json::object res;
+    res["added_count"] = json::value(double(heap_diff_.added_count()));
+    res["added_size"] = json::value(double(heap_diff_.added_size()));
+    res["removed_count"] = json::value(double(heap_diff_.removed_count()));
+    res["groups"] = json::value(groups);
+    response.result = json::value(res);
+    return send_response(response);
+  }
+
+  /// @brief results of inspection requests are kept until resume. Clients
+  /// request same frames and variables repeatedly in a pause.
+  /// eval may change values, so that it discards cached results.
+  static bool is_cacheable(const std::string& method) {
+    return method == "get_stacktrace" || method == "get_local_variable" ||
+           method == "get_upvalues" || method == "get_global";
+  }
+  /// @brief send cached result of same request in current pause
+  /// @return false if not cached
+  bool send_cached_result(const response_message& response,
+                          const std::string& key) {
+    auto cached = result_cache_.find(key);
+    if (cached == result_cache_.end()) {
+      return false;
+    }
+    begin_result().raw_value(cached->second);
+    end_result(response);
+    return true;
+  }
 
   void execute_request(const request_message& req) {
     typedef bool (basic_server::*exec_cmd_fn)(response_message & response,
@@ -374,6 +906,7 @@ class basic_server {
 
     static const std::map<std::string, exec_cmd_fn> cmd_map = {
 #define LRDB_DEBUG_COMMAND_TABLE(NAME) {#NAME, &basic_server::NAME##_request}
+        LRDB_DEBUG_COMMAND_TABLE(set_format),
         LRDB_DEBUG_COMMAND_TABLE(step),
         LRDB_DEBUG_COMMAND_TABLE(step_in),
         LRDB_DEBUG_COMMAND_TABLE(step_out),
@@ -387,22 +920,77 @@ class basic_server {
         LRDB_DEBUG_COMMAND_TABLE(get_upvalues),
         LRDB_DEBUG_COMMAND_TABLE(eval),
         LRDB_DEBUG_COMMAND_TABLE(get_global),
+        LRDB_DEBUG_COMMAND_TABLE(get_children),
+        LRDB_DEBUG_COMMAND_TABLE(profile_start),
+        LRDB_DEBUG_COMMAND_TABLE(profile_stop),
+        LRDB_DEBUG_COMMAND_TABLE(function_profile_start),
+        LRDB_DEBUG_COMMAND_TABLE(function_profile_stop),
+        LRDB_DEBUG_COMMAND_TABLE(coverage_start),
+        LRDB_DEBUG_COMMAND_TABLE(coverage_stop),
+        LRDB_DEBUG_COMMAND_TABLE(get_coverage),
+        LRDB_DEBUG_COMMAND_TABLE(start_line_counts),
+        LRDB_DEBUG_COMMAND_TABLE(stop_line_counts),
+        LRDB_DEBUG_COMMAND_TABLE(get_line_counts),
+        LRDB_DEBUG_COMMAND_TABLE(alloc_profile_start),
+        LRDB_DEBUG_COMMAND_TABLE(alloc_profile_stop),
+        LRDB_DEBUG_COMMAND_TABLE(heap_snapshot),
+        LRDB_DEBUG_COMMAND_TABLE(heap_baseline),
+        LRDB_DEBUG_COMMAND_TABLE(heap_diff),
 #undef LRDB_DEBUG_COMMAND_TABLE
     };
 
     response_message response;
     response.id = req.id;
     auto match = cmd_map.find(req.method);
-    if (match != cmd_map.end()) {
-      (this->*(match->second))(response, req.params);
-    } else {
+    if (match == cmd_map.end()) {
       response.error = response_error(response_error::MethodNotFound,
                                       "method not found : " + req.method);
       send_response(response);
+      return;
     }
+    // handlers read members of params object. omitted params is same as
+    // empty object
+    static const json::value empty_params = json::value(json::object());
+    const json::value& params =
+        req.params.is<json::null>() ? empty_params : req.params;
+    if (!params.is<json::object>()) {
+      response.error =
+          response_error(response_error::InvalidParams, "invalid params");
+      send_response(response);
+      return;
+    }
+    if (req.method == "eval") {
+      result_cache_.clear();
+    }
+    if (debugger_.paused() && is_cacheable(req.method)) {
+      // request and params identify frame, depth and lazy
+      std::string key = req.method + params.serialize();
+      if (send_cached_result(response, key)) {
+        return;
+      }
+      cache_key_ = key;
+    }
+    (this->*(match->second))(response, params);
+    cache_key_.clear();
   }
+
   bool wait_for_connect_;
+  bool attach_on_connect_;
+  std::mutex target_mutex_;
+  unsigned int poll_tick_count_;
+  std::chrono::microseconds poll_interval_;
+  unsigned int ticks_since_poll_;
+  std::chrono::steady_clock::time_point last_poll_time_;
   debugger debugger_;
+  heap_diff heap_diff_;
+  json_writer result_writer_;
+  size_t result_begin_;
+  /// request and params to serialized result in current pause
+  std::map<std::string, std::string> result_cache_;
+  std::string cache_key_;  /// cache key of executing request
+  bool batching_;           /// executing batch request
+  json_writer batch_writer_;
+  bool msgpack_;  /// MessagePack wire format is negotiated
   StreamType command_stream_;
 };
 }  // namespace lrdb
@@ -1,5 +1,457 @@
 #pragma once
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#include <functional>
 #include <map>
-#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "command_stream/client_socket.hpp"
+#include "command_stream/shared_memory.hpp"
+#include "message.hpp"
+
+namespace lrdb {
+
+/// @brief Debug Client Class
+/// template type is messaging communication to server. Stream is connected
+/// by user through command_stream(). on_data and on_close of stream are used
+/// by client.
+/// require members
+///  bool is_open() const; /// connection is opened
+///  void poll();          /// polling received data. Require non blocking
+///  void run_one();       /// blocking until receive one message
+///  bool send_message(const std::string& message);
+///  void set_binary_framing(bool enable);
+///  std::function<void(const std::string& data)> on_data;
+///  std::function<void()> on_close;
+///
+/// Requests are pipelined. Any number of requests can be sent without
+/// waiting, and each response is dispatched to handler of the request by id.
+template <typename StreamType>
+class basic_client {
+ public:
+  /// @brief called with response message. on connection close, called with
+  /// error response
+  typedef std::function<void(const json::value& response)> response_handler;
+  /// @brief called with notify message
+  typedef std::function<void(const json::value& notify)> notify_handler;
+
+  /// @brief constructor
+  /// @param arg Forward to StreamType constructor
+  template <typename... StreamArgs>
+  basic_client(StreamArgs&&... arg)
+      : next_id_(0),
+        msgpack_(false),
+        format_request_id_(-1),
+        command_stream_(std::forward<StreamArgs>(arg)...) {
+    command_stream_.on_data = [this](const std::string& data) {
+      receive_message(data);
+    };
+    command_stream_.on_close = [this]() { connection_closed(); };
+  }
+  ~basic_client() {
+    // pending handlers are not called at destruction
+    command_stream_.on_close = std::function<void()>();
+  }
+
+  StreamType& command_stream() { return command_stream_; }
+
+  /// @brief callback for all notifies from server. e.g. "paused"
+  notify_handler on_notify;
+
+  /// @brief set callback for notify of method. called before on_notify
+  void set_notify_handler(const std::string& method, notify_handler handler) {
+    if (handler) {
+      notify_handlers_[method] = std::move(handler);
+    } else {
+      notify_handlers_.erase(method);
+    }
+  }
+
+  /// @brief send request without waiting for response
+  /// @param handler called with response. If empty, response is kept until
+  /// wait_response
+  /// @return request id. -1 if failed
+  int send_request(const std::string& method,
+                   const json::value& params = json::value(),
+                   response_handler handler = response_handler()) {
+    if (!command_stream_.is_open()) {
+      return -1;
+    }
+    int id = next_id_++;
+    json::value request =
+        message::to_value(message::request_message(id, method, params));
+    if (format_request_id_ >= 0) {
+      // following requests are sent after format is switched
+      held_requests_.push_back(std::move(request));
+    } else if (!send(request)) {
+      return -1;
+    }
+    pending_[id] = std::move(handler);
+    return id;
+  }
+  /// @brief number of requests waiting for response
+  size_t pending_count() const { return pending_.size(); }
+
+  /// @brief dispatch received messages. non blocking
+  void poll() { command_stream_.poll(); }
+
+  /// @brief wait for response of request id. notifies are handled meanwhile
+  /// @return false if request id is not waiting, or is sent with handler
+  bool wait_response(int id, json::value& response) {
+    while (true) {
+      auto received = responses_.find(id);
+      if (received != responses_.end()) {
+        response = std::move(received->second);
+        responses_.erase(received);
+        return true;
+      }
+      if (!pending_.count(id)) {
+        return false;
+      }
+      command_stream_.run_one();
+    }
+  }
+  /// @brief wait for responses of all requests
+  /// @return false if connection is closed
+  bool wait_all() {
+    while (!pending_.empty()) {
+      command_stream_.run_one();
+    }
+    return command_stream_.is_open();
+  }
+  /// @brief send request and wait for response
+  /// @return response message. null if send failed
+  json::value request(const std::string& method,
+                      const json::value& params = json::value()) {
+    json::value response;
+    int id = send_request(method, params);
+    if (id >= 0) {
+      wait_response(id, response);
+    }
+    return response;
+  }
+
+  /// @brief switch message format. "json" or "msgpack".
+  /// requests after this are held until response
+  int set_format(const std::string& format,
+                 response_handler handler = response_handler()) {
+    json::object params;
+    params["format"] = json::value(format);
+    bool held = format_request_id_ >= 0;
+    int id =
+        send_request("set_format", json::value(params), std::move(handler));
+    if (id >= 0 && !held) {
+      format_request_id_ = id;
+      requested_format_ = format;
+    }
+    return id;
+  }
+  int step(response_handler handler = response_handler()) {
+    return send_request("step", json::value(), std::move(handler));
+  }
+  int step_in(response_handler handler = response_handler()) {
+    return send_request("step_in", json::value(), std::move(handler));
+  }
+  int step_out(response_handler handler = response_handler()) {
+    return send_request("step_out", json::value(), std::move(handler));
+  }
+  /// @brief "continue" request
+  int unpause(response_handler handler = response_handler()) {
+    return send_request("continue", json::value(), std::move(handler));
+  }
+  int pause(response_handler handler = response_handler()) {
+    return send_request("pause", json::value(), std::move(handler));
+  }
+  /// @param condition,hit_condition ignored if empty
+  int add_breakpoint(const std::string& file, int line,
+                     const std::string& condition = "",
+                     const std::string& hit_condition = "",
+                     response_handler handler = response_handler()) {
+    json::object params;
+    params["file"] = json::value(file);
+    params["line"] = json::value(double(line));
+    if (!condition.empty()) {
+      params["condition"] = json::value(condition);
+    }
+    if (!hit_condition.empty()) {
+      params["hit_condition"] = json::value(hit_condition);
+    }
+    return send_request("add_breakpoint", json::value(params),
+                        std::move(handler));
+  }
+  int get_breakpoints(response_handler handler = response_handler()) {
+    return send_request("get_breakpoints", json::value(), std::move(handler));
+  }
+  /// @param file clear all breakpoints if empty
+  /// @param line clear all breakpoints in file if 0
+  int clear_breakpoints(const std::string& file = "", int line = 0,
+                        response_handler handler = response_handler()) {
+    json::object params;
+    if (!file.empty()) {
+      params["file"] = json::value(file);
+      if (line > 0) {
+        params["line"] = json::value(double(line));
+      }
+    }
+    return send_request("clear_breakpoints", json::value(params),
+                        std::move(handler));
+  }
+  int get_stacktrace(response_handler handler = response_handler()) {
+    return send_request("get_stacktrace", json::value(), std::move(handler));
+  }
+  int get_local_variable(int stack_no, int depth = 1, bool lazy = false,
+                         response_handler handler = response_handler()) {
+    return send_request("get_local_variable",
+                        frame_params(stack_no, depth, lazy),
+                        std::move(handler));
+  }
+  int get_upvalues(int stack_no, int depth = 1, bool lazy = false,
+                   response_handler handler = response_handler()) {
+    return send_request("get_upvalues", frame_params(stack_no, depth, lazy),
+                        std::move(handler));
+  }
+  int eval(const std::string& chunk, int stack_no, int depth = 1,
+           bool lazy = false, response_handler handler = response_handler()) {
+    json::value params = frame_params(stack_no, depth, lazy);
+    params.get<json::object>()["chunk"] = json::value(chunk);
+    return send_request("eval", params, std::move(handler));
+  }
+  int get_global(int depth = 1, bool lazy = false,
+                 response_handler handler = response_handler()) {
+    json::object params;
+    params["depth"] = json::value(double(depth));
+    params["lazy"] = json::value(lazy);
+    return send_request("get_global", json::value(params), std::move(handler));
+  }
+  /// @param reference handle of lazy result
+  /// @param count all children if 0
+  int get_children(int reference, size_t start = 0, size_t count = 0,
+                   response_handler handler = response_handler()) {
+    json::object params;
+    params["reference"] = json::value(double(reference));
+    params["start"] = json::value(double(start));
+    if (count > 0) {
+      params["count"] = json::value(double(count));
+    }
+    return send_request("get_children", json::value(params),
+                        std::move(handler));
+  }
+  /// @param interval sampling interval in microseconds. server default if 0
+  int profile_start(long long interval = 0,
+                    response_handler handler = response_handler()) {
+    json::object params;
+    if (interval > 0) {
+      params["interval"] = json::value(double(interval));
+    }
+    return send_request("profile_start", json::value(params),
+                        std::move(handler));
+  }
+  int profile_stop(response_handler handler = response_handler()) {
+    return send_request("profile_stop", json::value(), std::move(handler));
+  }
+  int function_profile_start(response_handler handler = response_handler()) {
+    return send_request("function_profile_start", json::value(),
+                        std::move(handler));
+  }
+  int function_profile_stop(response_handler handler = response_handler()) {
+    return send_request("function_profile_stop", json::value(),
+                        std::move(handler));
+  }
+  int coverage_start(bool clear = false,
+                     response_handler handler = response_handler()) {
+    json::object params;
+    params["clear"] = json::value(clear);
+    return send_request("coverage_start", json::value(params),
+                        std::move(handler));
+  }
+  int coverage_stop(response_handler handler = response_handler()) {
+    return send_request("coverage_stop", json::value(), std::move(handler));
+  }
+  int get_coverage(bool lcov = false,
+                   response_handler handler = response_handler()) {
+    json::object params;
+    if (lcov) {
+      params["format"] = json::value("lcov");
+    }
+    return send_request("get_coverage", json::value(params),
+                        std::move(handler));
+  }
+  int start_line_counts(const std::string& file,
+                        response_handler handler = response_handler()) {
+    return send_request("start_line_counts", file_params(file),
+                        std::move(handler));
+  }
+  /// @param file stop all files if empty
+  int stop_line_counts(const std::string& file = "",
+                       response_handler handler = response_handler()) {
+    return send_request("stop_line_counts",
+                        file.empty() ? json::value() : file_params(file),
+                        std::move(handler));
+  }
+  int get_line_counts(const std::string& file,
+                      response_handler handler = response_handler()) {
+    return send_request("get_line_counts", file_params(file),
+                        std::move(handler));
+  }
+  int alloc_profile_start(response_handler handler = response_handler()) {
+    return send_request("alloc_profile_start", json::value(),
+                        std::move(handler));
+  }
+  /// @param count max number of sites
+  int alloc_profile_stop(size_t count = 20,
+                         response_handler handler = response_handler()) {
+    return send_request("alloc_profile_stop", count_params(count),
+                        std::move(handler));
+  }
+  /// @brief snapshot text is received by "heap_snapshot_chunk" notify
+  int heap_snapshot(size_t chunk_size = 64 * 1024,
+                    response_handler handler = response_handler()) {
+    json::object params;
+    params["chunk_size"] = json::value(double(chunk_size));
+    return send_request("heap_snapshot", json::value(params),
+                        std::move(handler));
+  }
+  int heap_baseline(response_handler handler = response_handler()) {
+    return send_request("heap_baseline", json::value(), std::move(handler));
+  }
+  /// @param count max number of groups
+  int heap_diff(size_t count = 20,
+                response_handler handler = response_handler()) {
+    return send_request("heap_diff", count_params(count), std::move(handler));
+  }
+
+ private:
+  static json::value frame_params(int stack_no, int depth, bool lazy) {
+    json::object params;
+    params["stack_no"] = json::value(double(stack_no));
+    params["depth"] = json::value(double(depth));
+    params["lazy"] = json::value(lazy);
+    return json::value(params);
+  }
+  static json::value file_params(const std::string& file) {
+    json::object params;
+    params["file"] = json::value(file);
+    return json::value(params);
+  }
+  static json::value count_params(size_t count) {
+    json::object params;
+    params["count"] = json::value(double(count));
+    return json::value(params);
+  }
+
+  bool send(const json::value& msg) {
+    if (msgpack_) {
+      return command_stream_.send_message(message::msgpack::encode(msg));
+    }
+    return command_stream_.send_message(msg.serialize());
+  }
+  void receive_message(const std::string& data) {
+    json::value msg;
+    std::string err = msgpack_ ? message::msgpack::decode(data, msg)
+                               : json::parse(msg, data);
+    if (!err.empty()) {
+      return;
+    }
+    if (message::is_batch(msg)) {
+      for (const json::value& m : msg.get<json::array>()) {
+        dispatch(m);
+      }
+    } else {
+      dispatch(msg);
+    }
+  }
+  void dispatch(const json::value& msg) {
+    if (message::is_notify(msg)) {
+      auto handler = notify_handlers_.find(message::get_method(msg));
+      if (handler != notify_handlers_.end()) {
+        handler->second(msg);
+      }
+      if (on_notify) {
+        on_notify(msg);
+      }
+    } else if (message::get_id(msg).is<double>()) {
+      int id = int(message::get_id(msg).get<double>());
+      if (id == format_request_id_) {
+        format_changed(msg);
+      }
+      complete(id, msg);
+    }
+  }
+  void complete(int id, const json::value& response) {
+    auto pending = pending_.find(id);
+    if (pending == pending_.end()) {
+      return;
+    }
+    response_handler handler = std::move(pending->second);
+    pending_.erase(pending);
+    if (handler) {
+      handler(response);
+    } else {
+      responses_[id] = response;
+    }
+  }
+  /// @brief server switches format after set_format response
+  void format_changed(const json::value& response) {
+    format_request_id_ = -1;
+    if (!response.contains("error")) {
+      msgpack_ = requested_format_ == "msgpack";
+      command_stream_.set_binary_framing(msgpack_);
+    }
+    std::vector<json::value> held;
+    held.swap(held_requests_);
+    for (json::value& request : held) {
+      if (format_request_id_ >= 0) {
+        held_requests_.push_back(std::move(request));
+        continue;
+      }
+      send(request);
+      if (message::get_method(request) == "set_format") {
+        format_request_id_ = int(message::get_id(request).get<double>());
+        requested_format_ =
+            message::get_param(request).get("format").to_str();
+      }
+    }
+  }
+  void connection_closed() {
+    msgpack_ = false;
+    format_request_id_ = -1;
+    held_requests_.clear();
+    std::map<int, response_handler> pending;
+    pending.swap(pending_);
+    for (auto& request : pending) {
+      message::response_message response(request.first);
+      response.error = message::response_error(
+          message::response_error::InternalError, "connection closed");
+      if (request.second) {
+        request.second(message::to_value(response));
+      } else {
+        responses_[request.first] = message::to_value(response);
+      }
+    }
+  }
+
+  int next_id_;
+  bool msgpack_;
+  int format_request_id_;  /// set_format waiting for response. -1 if none
+  std::string requested_format_;
+  std::vector<json::value> held_requests_;  /// sent after format switched
+  std::map<int, response_handler> pending_;  /// waiting for response
+  std::map<int, json::value> responses_;  /// received but not waited
+  std::map<std::string, notify_handler> notify_handlers_;
+  StreamType command_stream_;
+};
+
+typedef basic_client<command_stream_client_socket> client;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+typedef basic_client<command_stream_local_client_socket> local_client;
+#endif
+#ifdef LRDB_HAS_SHARED_MEMORY_STREAM
+typedef basic_client<command_stream_shared_memory_client> shared_memory_client;
+#endif
+}  // namespace lrdb
 
-// Not implemented now
+#else
+#error Needs at least a C++11 compiler
+#endif
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "socket.hpp"
+
+namespace lrdb {
+
+// client side socket of command_stream_socket.
+// messages sent while writing are coalesced into next write, so that many
+// requests can be pipelined without blocking.
+template <typename Protocol>
+class basic_command_stream_client_socket {
+ public:
+  basic_command_stream_client_socket()
+      : socket_(io_service_), binary_framing_(false), writing_(false) {}
+  ~basic_command_stream_client_socket() { close(); }
+
+  std::function<void(const std::string& data)> on_data;
+  std::function<void()> on_connection;
+  std::function<void()> on_close;
+  std::function<void(const std::string&)> on_error;
+
+  /// @brief connect to server. blocking
+  bool connect(const typename Protocol::endpoint& endpoint) {
+    close();
+    asio::error_code ec;
+    socket_.connect(endpoint, ec);
+    return connected_done(ec);
+  }
+  /// @brief connect to TCP server. blocking
+  bool connect(const std::string& host, const std::string& port) {
+    close();
+    asio::error_code ec;
+    typename Protocol::resolver resolver(io_service_);
+    auto endpoints =
+        resolver.resolve(typename Protocol::resolver::query(host, port), ec);
+    if (!ec) {
+      asio::connect(socket_, endpoints, ec);
+    }
+    return connected_done(ec);
+  }
+
+  /// @brief close connection. messages not written yet are discarded
+  void close() {
+    if (!socket_.is_open()) {
+      return;
+    }
+    asio::error_code ec;
+    socket_.close(ec);
+    read_data_.clear();
+    send_buffer_.clear();
+    binary_framing_ = false;
+    if (on_close) {
+      on_close();
+    }
+  }
+
+  bool is_open() const { return socket_.is_open(); }
+  void poll() { io_service_.poll(); }
+  void run_one() { io_service_.run_one(); }
+
+  /// @brief switch to length prefixed frames for both directions, from next
+  /// message
+  void set_binary_framing(bool enable) { binary_framing_ = enable; }
+
+  // async. message is written while poll or run_one
+  bool send_message(const std::string& message) {
+    if (!is_open()) {
+      return false;
+    }
+    framing::append(send_buffer_, message, binary_framing_);
+    if (!writing_) {
+      start_write();
+    }
+    return true;
+  }
+
+ private:
+  bool connected_done(const asio::error_code& ec) {
+    if (ec) {
+      if (on_error) {
+        on_error(ec.message());
+      }
+      asio::error_code ignored;
+      socket_.close(ignored);
+      return false;
+    }
+    io_service_.reset();
+    if (on_connection) {
+      on_connection();
+    }
+    start_receive();
+    return true;
+  }
+  void start_write() {
+    writing_buffer_.swap(send_buffer_);
+    send_buffer_.clear();
+    writing_ = true;
+    asio::async_write(
+        socket_, asio::buffer(writing_buffer_),
+        [&](const asio::error_code& ec, std::size_t) {
+          writing_ = false;
+          if (ec) {
+            if (ec != asio::error::operation_aborted) {
+              socket_error(ec);
+            }
+            return;
+          }
+          if (!send_buffer_.empty()) {
+            start_write();
+          }
+        });
+  }
+  void start_receive() {
+    socket_.async_read_some(
+        asio::buffer(read_chunk_),
+        [&](const asio::error_code& ec, std::size_t size) {
+          if (!ec) {
+            read_data_.append(read_chunk_, size);
+            // framing may be switched by on_data
+            std::string message;
+            while (is_open() &&
+                   framing::extract(read_data_, binary_framing_, message)) {
+              if (on_data) {
+                on_data(message);
+              }
+            }
+            if (is_open()) {
+              start_receive();
+            }
+          } else if (ec != asio::error::operation_aborted) {
+            socket_error(ec);
+          }
+        });
+  }
+  void socket_error(const asio::error_code& ec) {
+    if (ec != asio::error::eof && on_error) {
+      on_error(ec.message());
+    }
+    close();
+  }
+
+  asio::io_service io_service_;
+  typename Protocol::socket socket_;
+  char read_chunk_[4096];
+  std::string read_data_;       /// received data not yet extracted
+  std::string send_buffer_;     /// framed messages not written yet
+  std::string writing_buffer_;  /// framed messages in writing
+  bool binary_framing_;
+  bool writing_;
+};
+
+typedef basic_command_stream_client_socket<asio::ip::tcp>
+    command_stream_client_socket;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+typedef basic_command_stream_client_socket<asio::local::stream_protocol>
+    command_stream_local_client_socket;
+#endif
+}  // namespace lrdb
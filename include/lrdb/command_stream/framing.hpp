@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace lrdb {
+namespace framing {
+/// max size of received message. larger frame is framing error
+static const uint32_t max_frame_size = 64 * 1024 * 1024;
+
+/// @brief append message to out with "\r\n" delimiter, or 4 bytes big
+/// endian length prefix for binary framing
+inline void append(std::string& out, const std::string& message,
+                   bool binary) {
+  if (binary) {
+    uint32_t size = uint32_t(message.size());
+    for (int i = 3; i >= 0; --i) {
+      out += char((size >> (i * 8)) & 0xff);
+    }
+    out += message;
+  } else {
+    out += message;
+    out += "\r\n";
+  }
+}
+/// @brief extract message at offset of received data, and advance offset
+/// to next message. data is not modified
+/// @return false if data is incomplete
+inline bool extract(const std::string& data, std::string::size_type& offset,
+                    bool binary, std::string& message) {
+  if (binary) {
+    if (data.size() - offset < 4) {
+      return false;
+    }
+    uint32_t size = 0;
+    for (int i = 0; i < 4; ++i) {
+      size = (size << 8) | uint8_t(data[offset + i]);
+    }
+    if (data.size() - offset - 4 < size) {
+      return false;
+    }
+    message.assign(data, offset + 4, size);
+    offset += 4 + size;
+    return true;
+  }
+  std::string::size_type end = data.find('\n', offset);
+  if (end == std::string::npos) {
+    return false;
+  }
+  message.assign(data, offset, end - offset);
+  offset = end + 1;
+  return true;
+}
+/// @brief message at offset of received data is over max_frame_size. Check
+/// after extract returned false, and then connection should be closed
+inline bool oversized(const std::string& data, std::string::size_type offset,
+                      bool binary) {
+  if (!binary) {
+    return data.size() - offset > max_frame_size;
+  }
+  if (data.size() - offset < 4) {
+    return false;
+  }
+  uint32_t size = 0;
+  for (int i = 0; i < 4; ++i) {
+    size = (size << 8) | uint8_t(data[offset + i]);
+  }
+  return size > max_frame_size;
+}
+/// @brief extract first message from received data
+/// @return false if data is incomplete
+inline bool extract(std::string& data, bool binary, std::string& message) {
+  std::string::size_type offset = 0;
+  if (!extract(data, offset, binary, message)) {
+    return false;
+  }
+  data.erase(0, offset);
+  return true;
+}
+}  // namespace framing
+}  // namespace lrdb
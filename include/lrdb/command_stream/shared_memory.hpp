@@ -0,0 +1,620 @@
+#pragma once
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "framing.hpp"
+
+#define LRDB_HAS_SHARED_MEMORY_STREAM
+
+namespace lrdb {
+namespace shared_memory {
+
+/// @brief block while *word == expected, until woken or timeout
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected,
+                       std::chrono::milliseconds timeout) {
+  timespec ts;
+  ts.tv_sec = time_t(timeout.count() / 1000);
+  ts.tv_nsec = long(timeout.count() % 1000) * 1000000;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected,
+          &ts, nullptr, 0);
+}
+inline void futex_wake(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+/// @brief process exists. processes of other user are also alive
+inline bool process_alive(int32_t pid) {
+  return pid > 0 && (kill(pid_t(pid), 0) == 0 || errno == EPERM);
+}
+
+/// @brief byte ring in shared memory for one writer and one reader process.
+/// Data follows this header. Futex is called only when other side is
+/// sleeping, so that no syscall is required while both sides are busy.
+struct ring {
+  alignas(64) std::atomic<uint32_t> head;  /// written bytes. reader waits
+  std::atomic<uint32_t> reader_waiting;
+  alignas(64) std::atomic<uint32_t> tail;  /// read bytes. writer waits
+  std::atomic<uint32_t> writer_waiting;
+  uint32_t capacity;  /// power of two
+
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+  void reset(uint32_t size) {
+    head.store(0);
+    tail.store(0);
+    reader_waiting.store(0);
+    writer_waiting.store(0);
+    capacity = size;
+  }
+
+  /// @brief write as much as free space
+  /// @return written size
+  size_t write_some(const char* src, size_t size) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+    size_t free = capacity - (h - t);
+    if (size > free) {
+      size = free;
+    }
+    if (size == 0) {
+      return 0;
+    }
+    size_t offset = h & (capacity - 1);
+    size_t first = std::min(size, capacity - offset);
+    memcpy(data() + offset, src, first);
+    memcpy(data(), src + first, size - first);
+    head.store(h + uint32_t(size));
+    if (reader_waiting.load()) {
+      reader_waiting.store(0);
+      futex_wake(&head);
+    }
+    return size;
+  }
+  /// @brief append all readable data to out
+  /// @return read size
+  size_t read_some(std::string& out) {
+    uint32_t h = head.load(std::memory_order_acquire);
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    size_t size = h - t;
+    if (size == 0) {
+      return 0;
+    }
+    size_t offset = t & (capacity - 1);
+    size_t first = std::min(size, capacity - offset);
+    out.append(data() + offset, first);
+    out.append(data(), size - first);
+    tail.store(t + uint32_t(size));
+    if (writer_waiting.load()) {
+      writer_waiting.store(0);
+      futex_wake(&tail);
+    }
+    return size;
+  }
+  void wait_readable(std::chrono::milliseconds timeout) {
+    reader_waiting.store(1);
+    uint32_t h = head.load();
+    if (h == tail.load(std::memory_order_relaxed)) {
+      futex_wait(&head, h, timeout);
+    }
+  }
+  void wait_writable(std::chrono::milliseconds timeout) {
+    writer_waiting.store(1);
+    uint32_t t = tail.load();
+    if (head.load(std::memory_order_relaxed) - t == capacity) {
+      futex_wait(&tail, t, timeout);
+    }
+  }
+};
+
+/// @brief connection state of shared memory. futex word
+enum state_type {
+  IDLE,       /// waiting for client
+  ATTACHING,  /// client is resetting rings
+  REQUESTED,  /// client is waiting for server
+  CONNECTED,
+  CLOSING,  /// closed by client
+};
+
+struct layout {
+  uint32_t magic;
+  uint32_t ring_capacity;
+  std::atomic<uint32_t> state;
+  std::atomic<uint32_t> generation;  /// closed connection count
+  std::atomic<int32_t> server_pid;
+  std::atomic<int32_t> client_pid;  /// 0 while IDLE
+};
+static_assert(sizeof(layout) <= 64, "layout is followed by ring at 64");
+static const uint32_t layout_magic = 0x4244524c;  // "LRDB"
+
+/// @brief mapped shared memory object, that has layout and a ring of each
+/// direction
+class mapping {
+ public:
+  mapping() : data_(0), size_(0) {}
+  ~mapping() { unmap(); }
+
+  /// @brief create object for server. object left by crashed server is
+  /// recreated, but object of running server is not
+  /// @param ring_capacity power of two, and 64 or more
+  bool create(const std::string& name, uint32_t ring_capacity) {
+    if (ring_capacity < 64 || (ring_capacity & (ring_capacity - 1)) != 0) {
+      return false;
+    }
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST && remove_stale(name)) {
+      fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+    if (fd < 0) {
+      return false;
+    }
+    size_t size = mapped_size(ring_capacity);
+    bool ret = ftruncate(fd, off_t(size)) == 0 && map(fd, size);
+    ::close(fd);
+    if (ret) {
+      memset(data_, 0, size_);
+      get()->ring_capacity = ring_capacity;
+      to_server()->reset(ring_capacity);
+      to_client()->reset(ring_capacity);
+      get()->state.store(IDLE);
+      get()->generation.store(0);
+      get()->server_pid.store(int32_t(getpid()));
+      get()->client_pid.store(0);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      get()->magic = layout_magic;
+    }
+    return ret;
+  }
+  /// @brief open object created by server
+  bool open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    bool ret = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(layout) &&
+               map(fd, size_t(st.st_size));
+    ::close(fd);
+    if (ret && (get()->magic != layout_magic ||
+                mapped_size(get()->ring_capacity) > size_)) {
+      unmap();
+      return false;
+    }
+    return ret;
+  }
+  void unmap() {
+    if (data_) {
+      munmap(data_, size_);
+      data_ = 0;
+      size_ = 0;
+    }
+  }
+  bool is_mapped() const { return data_ != 0; }
+
+  layout* get() const { return static_cast<layout*>(data_); }
+  ring* to_server() const {
+    return reinterpret_cast<ring*>(static_cast<char*>(data_) + 64);
+  }
+  ring* to_client() const {
+    return reinterpret_cast<ring*>(reinterpret_cast<char*>(to_server()) +
+                                   ring_size(get()->ring_capacity));
+  }
+
+ private:
+  /// @return false if server of the object is running
+  static bool remove_stale(const std::string& name) {
+    mapping existing;
+    if (existing.open(name) &&
+        process_alive(existing.get()->server_pid.load())) {
+      return false;
+    }
+    existing.unmap();
+    return shm_unlink(name.c_str()) == 0 || errno == ENOENT;
+  }
+  static size_t ring_size(uint32_t capacity) {
+    return sizeof(ring) + capacity;
+  }
+  static size_t mapped_size(uint32_t capacity) {
+    return 64 + ring_size(capacity) * 2;
+  }
+  bool map(int fd, size_t size) {
+    void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    data_ = p;
+    size_ = size;
+    return true;
+  }
+  mapping(const mapping&);             //=delete;
+  mapping& operator=(const mapping&);  //=delete;
+
+  void* data_;
+  size_t size_;
+};
+
+/// @brief one side of connection. messages are length prefixed frames
+class endpoint {
+ public:
+  endpoint(ring* in, ring* out) : in_(in), out_(out), read_offset_(0) {}
+
+  /// @brief write a frame. blocking while ring is full
+  /// @param connected called while waiting. stop writing if false
+  bool write(const std::string& message,
+             const std::function<bool()>& connected) {
+    char header[4];
+    uint32_t size = uint32_t(message.size());
+    for (int i = 0; i < 4; ++i) {
+      header[i] = char((size >> ((3 - i) * 8)) & 0xff);
+    }
+    return write(header, 4, connected) &&
+           write(message.data(), message.size(), connected);
+  }
+  /// @brief extract a received frame
+  /// @return false if no frame is received
+  bool read(std::string& message) {
+    if (framing::extract(read_data_, read_offset_, true, message)) {
+      return true;
+    }
+    // extracted frames are removed at once before appending
+    read_data_.erase(0, read_offset_);
+    read_offset_ = 0;
+    in_->read_some(read_data_);
+    return framing::extract(read_data_, read_offset_, true, message);
+  }
+  /// @brief wait for data after read returned false. then buffered data is
+  /// at most an incomplete frame
+  void wait_readable(std::chrono::milliseconds timeout) {
+    in_->wait_readable(timeout);
+  }
+  void clear() {
+    read_data_.clear();
+    read_offset_ = 0;
+  }
+  /// @brief received frame is over framing::max_frame_size
+  bool oversized() const {
+    return framing::oversized(read_data_, read_offset_, true);
+  }
+
+ private:
+  bool write(const char* data, size_t size,
+             const std::function<bool()>& connected) {
+    while (size > 0) {
+      size_t written = out_->write_some(data, size);
+      data += written;
+      size -= written;
+      if (written == 0) {
+        if (!connected()) {
+          return false;
+        }
+        out_->wait_writable(std::chrono::milliseconds(10));
+      }
+    }
+    return true;
+  }
+  ring* in_;
+  ring* out_;
+  std::string read_data_;  /// received data
+  std::string::size_type read_offset_;  /// extracted size of read_data_
+};
+}  // namespace shared_memory
+
+/// @brief one to one server stream over shared memory rings, for clients on
+/// same host. Linux only.
+/// messages are always framed by 4 bytes big endian length, and
+/// set_binary_framing is no-op.
+class command_stream_shared_memory {
+ public:
+  /// @param name shared memory object name. e.g. "/lrdb"
+  /// @param ring_capacity buffer size of each direction. power of two
+  command_stream_shared_memory(const std::string& name,
+                               uint32_t ring_capacity = 1024 * 1024)
+      : name_(name),
+        endpoint_(0, 0),
+        open_(false),
+        next_liveness_check_(std::chrono::steady_clock::now()) {
+    if (!mapping_.create(name, ring_capacity)) {
+      throw std::runtime_error("can not create shared memory: " + name);
+    }
+    endpoint_ = shared_memory::endpoint(mapping_.to_server(),
+                                        mapping_.to_client());
+  }
+  ~command_stream_shared_memory() {
+    close();
+    mapping_.unmap();
+    shm_unlink(name_.c_str());
+  }
+
+  std::function<void(const std::string& data)> on_data;
+  std::function<void()> on_connection;
+  std::function<void()> on_close;
+  std::function<void(const std::string&)> on_error;
+
+  void close() {
+    if (!open_) {
+      return;
+    }
+    open_ = false;
+    endpoint_.clear();
+    shared_memory::layout* layout = mapping_.get();
+    layout->generation.fetch_add(1);
+    layout->client_pid.store(0);
+    layout->state.store(shared_memory::IDLE);
+    shared_memory::futex_wake(&layout->state);
+    if (on_close) {
+      on_close();
+    }
+  }
+  bool is_open() const { return open_; }
+  void poll() {
+    check_connection();
+    std::string message;
+    while (open_ && endpoint_.read(message)) {
+      if (on_data) {
+        on_data(message);
+      }
+    }
+    if (open_ && endpoint_.oversized()) {
+      frame_error();
+    }
+  }
+  void run_one() {
+    while (true) {
+      check_connection();
+      if (!open_) {
+        return;
+      }
+      std::string message;
+      if (endpoint_.read(message)) {
+        if (on_data) {
+          on_data(message);
+        }
+        return;
+      }
+      if (endpoint_.oversized()) {
+        frame_error();
+        return;
+      }
+      // wake up periodically for state of client
+      endpoint_.wait_readable(std::chrono::milliseconds(10));
+    }
+  }
+  void wait_for_connection() {
+    shared_memory::layout* layout = mapping_.get();
+    while (!open_) {
+      uint32_t state = layout->state.load();
+      check_connection();
+      if (!open_) {
+        shared_memory::futex_wait(&layout->state, state,
+                                  std::chrono::milliseconds(100));
+      }
+    }
+  }
+  /// @brief frames are always length prefixed
+  void set_binary_framing(bool) {}
+
+  /// @brief copy message to ring. blocking only while ring is full
+  bool send_message(const std::string& message) {
+    if (!open_) {
+      return false;
+    }
+    shared_memory::layout* layout = mapping_.get();
+    if (!endpoint_.write(message, [this, layout] {
+          return layout->state.load() == shared_memory::CONNECTED &&
+                 !client_lost();
+        })) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  void frame_error() {
+    if (on_error) {
+      on_error("received frame is too large");
+    }
+    close();
+  }
+  void check_connection() {
+    shared_memory::layout* layout = mapping_.get();
+    uint32_t state = layout->state.load();
+    if (!open_ && state == shared_memory::REQUESTED) {
+      open_ = true;
+      endpoint_.clear();
+      layout->state.store(shared_memory::CONNECTED);
+      shared_memory::futex_wake(&layout->state);
+      if (on_connection) {
+        on_connection();
+      }
+    } else if (open_ && state != shared_memory::CONNECTED) {
+      close();
+    } else if (state != shared_memory::IDLE && client_lost()) {
+      if (open_) {
+        close();
+      } else {
+        // crashed while attaching. other client can not attach until IDLE
+        layout->client_pid.store(0);
+        if (layout->state.compare_exchange_strong(state,
+                                                  shared_memory::IDLE)) {
+          layout->generation.fetch_add(1);
+          shared_memory::futex_wake(&layout->state);
+        }
+      }
+    }
+  }
+  /// @brief client process exited without close. checked at intervals
+  bool client_lost() {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (now < next_liveness_check_) {
+      return false;
+    }
+    next_liveness_check_ = now + std::chrono::milliseconds(100);
+    int32_t pid = mapping_.get()->client_pid.load();
+    return pid != 0 && !shared_memory::process_alive(pid);
+  }
+
+  std::string name_;
+  shared_memory::mapping mapping_;
+  shared_memory::endpoint endpoint_;
+  bool open_;
+  std::chrono::steady_clock::time_point next_liveness_check_;
+};
+
+/// @brief client side of command_stream_shared_memory. same members as
+/// server stream, and connect.
+class command_stream_shared_memory_client {
+ public:
+  command_stream_shared_memory_client()
+      : endpoint_(0, 0), open_(false), generation_(0) {}
+  ~command_stream_shared_memory_client() { close(); }
+
+  std::function<void(const std::string& data)> on_data;
+  std::function<void()> on_connection;
+  std::function<void()> on_close;
+  std::function<void(const std::string&)> on_error;
+
+  /// @brief connect to server stream of name
+  /// @return false if server does not exist, or is connected by other client
+  bool connect(const std::string& name,
+               std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+    close();
+    if (!mapping_.open(name)) {
+      return false;
+    }
+    shared_memory::layout* layout = mapping_.get();
+    uint32_t state = shared_memory::IDLE;
+    if (!layout->state.compare_exchange_strong(state,
+                                               shared_memory::ATTACHING)) {
+      mapping_.unmap();
+      return false;
+    }
+    layout->client_pid.store(int32_t(getpid()));
+    // server does not touch rings until connected
+    mapping_.to_server()->reset(layout->ring_capacity);
+    mapping_.to_client()->reset(layout->ring_capacity);
+    generation_ = layout->generation.load();
+    layout->state.store(shared_memory::REQUESTED);
+    shared_memory::futex_wake(&layout->state);
+
+    std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now() + timeout;
+    while ((state = layout->state.load()) == shared_memory::REQUESTED) {
+      if (std::chrono::steady_clock::now() >= end) {
+        // cancel if server have not accepted yet
+        if (layout->state.compare_exchange_strong(state,
+                                                  shared_memory::IDLE)) {
+          // pid of next client may be already stored
+          int32_t pid = int32_t(getpid());
+          layout->client_pid.compare_exchange_strong(pid, 0);
+          mapping_.unmap();
+          return false;
+        }
+        break;
+      }
+      shared_memory::futex_wait(&layout->state, state,
+                                std::chrono::milliseconds(10));
+    }
+    endpoint_ = shared_memory::endpoint(mapping_.to_client(),
+                                        mapping_.to_server());
+    open_ = true;
+    if (on_connection) {
+      on_connection();
+    }
+    return is_open();
+  }
+
+  void close() {
+    if (!open_) {
+      return;
+    }
+    open_ = false;
+    shared_memory::layout* layout = mapping_.get();
+    uint32_t state = shared_memory::CONNECTED;
+    if (layout->generation.load() == generation_ &&
+        layout->state.compare_exchange_strong(state,
+                                              shared_memory::CLOSING)) {
+      // wake server waiting for request
+      shared_memory::futex_wake(&mapping_.to_server()->head);
+    }
+    endpoint_.clear();
+    mapping_.unmap();
+    if (on_close) {
+      on_close();
+    }
+  }
+  /// @brief connected, and not closed by server
+  bool is_open() const {
+    if (!open_) {
+      return false;
+    }
+    shared_memory::layout* layout = mapping_.get();
+    return layout->state.load() == shared_memory::CONNECTED &&
+           layout->generation.load() == generation_;
+  }
+  void poll() {
+    std::string message;
+    while (open_ && endpoint_.read(message)) {
+      if (on_data) {
+        on_data(message);
+      }
+    }
+    if (open_ && !is_open()) {
+      close();
+    }
+  }
+  void run_one() {
+    while (open_) {
+      std::string message;
+      if (endpoint_.read(message)) {
+        if (on_data) {
+          on_data(message);
+        }
+        return;
+      }
+      if (!is_open()) {
+        close();
+        return;
+      }
+      endpoint_.wait_readable(std::chrono::milliseconds(10));
+    }
+  }
+  /// @brief frames are always length prefixed
+  void set_binary_framing(bool) {}
+  bool send_message(const std::string& message) {
+    if (!open_) {
+      return false;
+    }
+    if (!endpoint_.write(message, [this] { return is_open(); })) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  shared_memory::mapping mapping_;
+  shared_memory::endpoint endpoint_;
+  bool open_;
+  uint32_t generation_;
+};
+}  // namespace lrdb
+#endif
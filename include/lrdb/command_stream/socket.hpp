@@ -1,9 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <iostream>
+
+#include "framing.hpp"
+
 #if __cplusplus >= 201103L || defined(_MSC_VER) && _MSC_VER >= 1800
 #else
 #define ASIO_HAS_BOOST_DATE_TIME
@@ -17,6 +25,18 @@
 #include <asio.hpp>
 #endif
 
+#ifdef _WIN32
+#define LRDB_POLL WSAPoll
+#else
+#include <poll.h>
+#define LRDB_POLL ::poll
+#endif
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS) || defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define LRDB_HAS_LOCAL_SOCKETS
+#include <sys/stat.h>
+#endif
+
 namespace lrdb {
 #ifdef LRDB_USE_BOOST_ASIO
 namespace asio {
@@ -26,23 +46,106 @@ using namespace boost::asio;
 #else
 #endif
 
-// one to one server socket
-class command_stream_socket {
+/// @brief listening endpoint of stream protocol for server sockets
+template <typename Protocol>
+struct socket_endpoint;
+
+/// TCP port on IPv4
+template <>
+struct socket_endpoint<asio::ip::tcp> {
+  typedef uint16_t address_type;
+  static address_type default_address() { return 21110; }
+  static asio::ip::tcp::endpoint make(address_type port) {
+    return asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port);
+  }
+  static void release(const asio::ip::tcp::endpoint&) {}
+};
+
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+/// Unix domain socket path. socket file is removed at close
+template <>
+struct socket_endpoint<asio::local::stream_protocol> {
+  typedef std::string address_type;
+  /// socket file left by crashed process is removed. socket file of running
+  /// server is kept, so that bind fails. The liveness is checked by connect,
+  /// which is seen by the running server as short connection.
+  static asio::local::stream_protocol::endpoint make(
+      const address_type& path) {
+    asio::local::stream_protocol::endpoint endpoint(path);
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      asio::io_service io_service;
+      asio::local::stream_protocol::socket socket(io_service);
+      asio::error_code ec;
+      socket.connect(endpoint, ec);
+      if (ec == asio::error::connection_refused) {
+        std::remove(path.c_str());
+      }
+    }
+    return endpoint;
+  }
+  static void release(const asio::local::stream_protocol::endpoint& endpoint) {
+    release(endpoint.path());
+  }
+  static void release(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      std::remove(path.c_str());
+    }
+  }
+};
+#endif
+
+// one to one server socket.
+// messages are queued and written without blocking by gathered write, while
+// polling.
+template <typename Protocol>
+class basic_command_stream_socket {
  public:
-  command_stream_socket(uint16_t port = 21110)
-      : endpoint_(asio::ip::tcp::v4(), port),
+  /// @brief policy for queued data over limit
+  enum overflow_policy {
+    BLOCK,       /// wait until queued data is written. blocks Lua thread
+    DISCONNECT,  /// close connection of slow client
+  };
+
+  typedef typename socket_endpoint<Protocol>::address_type address_type;
+
+  /// @param address TCP port or Unix domain socket path
+  basic_command_stream_socket(
+      const address_type& address =
+          socket_endpoint<Protocol>::default_address())
+      : endpoint_(socket_endpoint<Protocol>::make(address)),
         acceptor_(io_service_, endpoint_),
-        socket_(io_service_) {
+        socket_(io_service_),
+        binary_framing_(false),
+        queued_size_(0),
+        front_offset_(0),
+        write_waiting_(false),
+        send_queue_limit_(16 * 1024 * 1024),
+        overflow_policy_(DISCONNECT),
+        close_timeout_(0) {
     async_accept();
   }
 
-  ~command_stream_socket() {
+  ~basic_command_stream_socket() {
     close();
     acceptor_.close();
+    socket_endpoint<Protocol>::release(endpoint_);
   }
 
+  /// @brief close connection. queued messages are written as much as socket
+  /// accepts, or until close timeout elapsed. e.g. exit notify
   void close() {
+    if (socket_.is_open()) {
+      flush_for(close_timeout_);
+    }
     socket_.close();
+    read_data_.clear();
+    binary_framing_ = false;
+    send_queue_.clear();
+    queued_size_ = 0;
+    front_offset_ = 0;
+    write_waiting_ = false;
     if (on_close) {
       on_close();
     }
@@ -66,18 +169,49 @@ class command_stream_socket {
     }
   }
 
-  // sync
+  /// @brief switch to length prefixed frames for both directions, from next
+  /// message. framing is reset to "\r\n" delimiter at connection close.
+  void set_binary_framing(bool enable) { binary_framing_ = enable; }
+
+  /// @brief set limit of queued data that is not written yet
+  /// @param bytes limit size. default 16MiB
+  /// @param policy action at over limit. default DISCONNECT
+  void set_send_queue_limit(size_t bytes, overflow_policy policy) {
+    send_queue_limit_ = bytes;
+    overflow_policy_ = policy;
+  }
+  /// @brief size of queued data that is not written yet
+  size_t send_queue_size() const { return queued_size_; }
+  /// @brief set max time to write queued data at close
+  /// @param timeout zero is never waiting for writable. default zero
+  void set_close_timeout(std::chrono::milliseconds timeout) {
+    close_timeout_ = timeout;
+  }
+
+  // async. message is written now if socket is writable, otherwise written
+  // with following messages at poll
   bool send_message(const std::string& message) {
-    asio::error_code ec;
-    std::string data = message + "\r\n";
-    asio::write(socket_, asio::buffer(data), ec);
-    if (ec) {
-      if (on_error) {
-        on_error(ec.message());
-      }
-      reconnect();
+    if (!is_open()) {
       return false;
     }
+    send_queue_.emplace_back();
+    framing::append(send_queue_.back(), message, binary_framing_);
+    queued_size_ += send_queue_.back().size();
+    if (!write_waiting_ && !write_queued()) {
+      return false;
+    }
+    if (queued_size_ > send_queue_limit_) {
+      if (overflow_policy_ == DISCONNECT) {
+        if (on_error) {
+          on_error("send queue overflow");
+        }
+        // slow client is not waited at close
+        send_queue_.clear();
+        reconnect();
+        return false;
+      }
+      return flush();
+    }
     return true;
   }
 
@@ -95,35 +229,176 @@ class command_stream_socket {
     });
   }
   void connected_done() {
+    asio::error_code ec;
+    socket_.non_blocking(true, ec);
     if (on_connection) {
       on_connection();
     }
     start_receive_commands();
   }
   void start_receive_commands() {
-    asio::async_read_until(socket_, read_buffer_, "\n",
-                           [&](const asio::error_code& ec, std::size_t) {
-                             if (!ec) {
-                               std::istream is(&read_buffer_);
-                               std::string command;
-                               std::getline(is, command);
-                               if (on_data) {
-                                 on_data(command);
-                               }
-                               start_receive_commands();
-                             } else {
-                               if (on_error) {
-                                 on_error(ec.message());
-                               }
-                               reconnect();
-                             }
-                           });
+    socket_.async_read_some(
+        asio::buffer(read_chunk_),
+        [&](const asio::error_code& ec, std::size_t size) {
+          if (!ec) {
+            read_data_.append(read_chunk_, size);
+            // framing may be switched by on_data
+            std::string command;
+            while (is_open() &&
+                   framing::extract(read_data_, binary_framing_, command)) {
+              if (on_data) {
+                on_data(command);
+              }
+            }
+            if (is_open() &&
+                framing::oversized(read_data_, 0, binary_framing_)) {
+              if (on_error) {
+                on_error("received frame is too large");
+              }
+              reconnect();
+            } else if (is_open()) {
+              start_receive_commands();
+            }
+          } else if (ec != asio::error::operation_aborted) {
+            if (on_error) {
+              on_error(ec.message());
+            }
+            reconnect();
+          }
+        });
   }
 
+  /// @brief write queued messages as much as socket accepts
+  /// @return false if all messages are not written
+  bool write_queued(asio::error_code& ec) {
+    while (!send_queue_.empty()) {
+      write_buffers_.clear();
+      size_t offset = front_offset_;
+      for (const std::string& data : send_queue_) {
+        write_buffers_.push_back(asio::const_buffer(data.data(), data.size()) +
+                                 offset);
+        offset = 0;
+        if (write_buffers_.size() == max_write_buffers) {
+          break;
+        }
+      }
+      size_t written = socket_.write_some(write_buffers_, ec);
+      if (ec) {
+        return false;
+      }
+      queued_size_ -= written;
+      written += front_offset_;
+      while (!send_queue_.empty() && written >= send_queue_.front().size()) {
+        written -= send_queue_.front().size();
+        send_queue_.pop_front();
+      }
+      front_offset_ = written;
+    }
+    return true;
+  }
+  /// @brief write queued messages, and wait for writable if remained
+  /// @return false if connection is closed by error
+  bool write_queued() {
+    asio::error_code ec;
+    if (write_queued(ec)) {
+      return true;
+    }
+    if (ec == asio::error::would_block || ec == asio::error::try_again) {
+      write_waiting_ = true;
+      socket_.async_write_some(
+          asio::null_buffers(),
+          [&](const asio::error_code& ec, std::size_t) {
+            if (ec == asio::error::operation_aborted) {
+              return;
+            }
+            write_waiting_ = false;
+            if (!ec) {
+              write_queued();
+            } else {
+              send_error(ec);
+            }
+          });
+      return true;
+    }
+    send_error(ec);
+    return false;
+  }
+  /// @brief write all queued messages. blocking
+  bool flush() {
+    while (!send_queue_.empty()) {
+      asio::error_code ec;
+      if (!write_queued(ec) && ec != asio::error::would_block &&
+          ec != asio::error::try_again) {
+        send_error(ec);
+        return false;
+      }
+      if (send_queue_.empty()) {
+        break;
+      }
+      // wait for writable
+      socket_.non_blocking(false, ec);
+      socket_.write_some(asio::null_buffers(), ec);
+      socket_.non_blocking(true, ec);
+    }
+    return true;
+  }
+  /// @brief write queued messages while waiting for writable until timeout
+  /// elapsed. error is ignored
+  void flush_for(std::chrono::milliseconds timeout) {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + timeout;
+    asio::error_code ec;
+    while (!write_queued(ec)) {
+      if (ec != asio::error::would_block && ec != asio::error::try_again) {
+        return;
+      }
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return;
+      }
+      pollfd fd;
+      fd.fd = socket_.native_handle();
+      fd.events = POLLOUT;
+      fd.revents = 0;
+      int wait = static_cast<int>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+              .count());
+      if (LRDB_POLL(&fd, 1, wait) <= 0) {
+        return;
+      }
+    }
+  }
+  void send_error(const asio::error_code& ec) {
+    if (on_error) {
+      on_error(ec.message());
+    }
+    reconnect();
+  }
+
+  static const size_t max_write_buffers = 64;
+
   asio::io_service io_service_;
-  asio::ip::tcp::endpoint endpoint_;
-  asio::ip::tcp::acceptor acceptor_;
-  asio::ip::tcp::socket socket_;
-  asio::streambuf read_buffer_;
+  typename Protocol::endpoint endpoint_;
+  typename Protocol::acceptor acceptor_;
+  typename Protocol::socket socket_;
+  char read_chunk_[4096];
+  std::string read_data_;  /// received data not yet extracted
+  bool binary_framing_;
+  std::deque<std::string> send_queue_;  /// framed messages not written yet
+  size_t queued_size_;
+  size_t front_offset_;  /// written size of send_queue_.front()
+  bool write_waiting_;   /// waiting for socket writable
+  std::vector<asio::const_buffer> write_buffers_;
+  size_t send_queue_limit_;
+  overflow_policy overflow_policy_;
+  std::chrono::milliseconds close_timeout_;
 };
+
+typedef basic_command_stream_socket<asio::ip::tcp> command_stream_socket;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+typedef basic_command_stream_socket<asio::local::stream_protocol>
+    command_stream_local_socket;
+#endif
+
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace lrdb {
+
+/// @brief unbounded lock-free single producer single consumer queue
+/// push must be called from one thread and pop from one other thread.
+template <typename T>
+class spsc_queue {
+ public:
+  spsc_queue() : head_(new node()), tail_(head_) {}
+  ~spsc_queue() {
+    T value;
+    while (pop(value)) {
+    }
+    delete head_;
+  }
+
+  /// @brief push value. producer thread only
+  void push(T value) {
+    node* n = new node(std::move(value));
+    tail_->next.store(n, std::memory_order_release);
+    tail_ = n;
+  }
+
+  /// @brief pop value. consumer thread only
+  /// @return If queue is empty return false. Otherwise return true.
+  bool pop(T& value) {
+    node* next = head_->next.load(std::memory_order_acquire);
+    if (!next) {
+      return false;
+    }
+    value = std::move(next->value);
+    delete head_;
+    head_ = next;
+    return true;
+  }
+
+ private:
+  spsc_queue(const spsc_queue&);             //=delete;
+  spsc_queue& operator=(const spsc_queue&);  //=delete;
+
+  struct node {
+    node() : next(nullptr) {}
+    explicit node(T v) : value(std::move(v)), next(nullptr) {}
+    T value;
+    std::atomic<node*> next;
+  };
+  node* head_;  /// dummy node. owned by consumer
+  node* tail_;  /// owned by producer
+};
+}  // namespace lrdb
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "socket.hpp"
+#include "spsc_queue.hpp"
+
+namespace lrdb {
+
+// one to one server socket.
+// networking is run on background thread, Lua thread only exchange
+// messages through lock-free queue.
+template <typename Protocol>
+class basic_command_stream_threaded_socket {
+ public:
+  typedef typename socket_endpoint<Protocol>::address_type address_type;
+
+  /// @param address TCP port or Unix domain socket path
+  basic_command_stream_threaded_socket(
+      const address_type& address =
+          socket_endpoint<Protocol>::default_address())
+      : endpoint_(socket_endpoint<Protocol>::make(address)),
+        acceptor_(io_service_, endpoint_),
+        socket_(io_service_),
+        work_(new asio::io_service::work(io_service_)),
+        stopping_(false),
+        connected_(false),
+        open_(false),
+        send_binary_framing_(false),
+        event_pending_(false),
+        write_scheduled_(false),
+        binary_framing_(false) {
+    async_accept();
+    thread_ = std::thread([&] { io_service_.run(); });
+  }
+
+  ~basic_command_stream_threaded_socket() {
+    io_service_.post([&] {
+      stopping_ = true;
+      flush_messages();
+      asio::error_code ec;
+      socket_.close(ec);
+      acceptor_.close(ec);
+    });
+    work_.reset();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    socket_endpoint<Protocol>::release(endpoint_);
+  }
+
+  void close() {
+    io_service_.post([&] {
+      flush_messages();
+      asio::error_code ec;
+      socket_.close(ec);
+    });
+    if (open_) {
+      open_ = false;
+      if (on_close) {
+        on_close();
+      }
+    }
+  }
+
+  std::function<void(const std::string& data)> on_data;
+  std::function<void()> on_connection;
+  std::function<void()> on_close;
+  std::function<void(const std::string&)> on_error;
+
+  /// @brief set callback for accepted connection.
+  /// callback is called on background thread, before on_connection.
+  /// If already connected, callback is called soon.
+  void set_on_connection_async(std::function<void()> callback) {
+    {
+      std::lock_guard<std::mutex> lk(async_callback_mutex_);
+      on_connection_async_ = callback;
+    }
+    io_service_.post([&] {
+      if (connected_) {
+        call_on_connection_async();
+      }
+    });
+  }
+
+  bool is_open() const { return open_; }
+  void poll() {
+    // cheap check for hook
+    if (!event_pending_.load(std::memory_order_acquire)) {
+      return;
+    }
+    event_pending_.store(false, std::memory_order_relaxed);
+    event e;
+    while (events_.pop(e)) {
+      dispatch(e);
+    }
+  }
+  void run_one() {
+    event e;
+    while (!events_.pop(e)) {
+      std::unique_lock<std::mutex> lk(wait_mutex_);
+      wait_cond_.wait(lk, [&] {
+        return event_pending_.exchange(false, std::memory_order_acquire);
+      });
+    }
+    dispatch(e);
+  }
+  void wait_for_connection() {
+    while (!is_open()) {
+      run_one();
+    }
+  }
+
+  /// @brief switch to length prefixed frames for both directions, from next
+  /// message. framing is reset to "\r\n" delimiter at connection close.
+  /// Data received before switch may already be split by old framing, so
+  /// that client must wait for response before sending frames.
+  void set_binary_framing(bool enable) {
+    send_binary_framing_ = enable;
+    set_receive_binary_framing(enable);
+  }
+  /// @brief switch framing of received data only. Messages are received on
+  /// background thread, so that this must be called before sending the
+  /// message which the client waits for.
+  void set_receive_binary_framing(bool enable) {
+    binary_framing_.store(enable, std::memory_order_release);
+  }
+
+  // async. message is written by background thread
+  bool send_message(const std::string& message) {
+    if (!open_) {
+      return false;
+    }
+    std::string data;
+    framing::append(data, message, send_binary_framing_);
+    send_queue_.push(std::move(data));
+    if (!write_scheduled_.exchange(true, std::memory_order_acq_rel)) {
+      io_service_.post([&] { flush_messages(); });
+    }
+    return true;
+  }
+
+ private:
+  struct event {
+    enum event_type { DATA, CONNECTION, CLOSE, ERROR_MESSAGE };
+    event() : type(DATA) {}
+    event(event_type type, std::string data = std::string())
+        : type(type), data(std::move(data)) {}
+    event_type type;
+    std::string data;
+  };
+
+  void dispatch(const event& e) {
+    switch (e.type) {
+      case event::DATA:
+        if (on_data) {
+          on_data(e.data);
+        }
+        break;
+      case event::CONNECTION:
+        open_ = true;
+        send_binary_framing_ = false;
+        if (on_connection) {
+          on_connection();
+        }
+        break;
+      case event::CLOSE:
+        if (open_) {
+          open_ = false;
+          if (on_close) {
+            on_close();
+          }
+        }
+        break;
+      case event::ERROR_MESSAGE:
+        if (on_error) {
+          on_error(e.data);
+        }
+        break;
+    }
+  }
+
+  // background thread functions
+  void push_event(event e) {
+    events_.push(std::move(e));
+    {
+      std::lock_guard<std::mutex> lk(wait_mutex_);
+      event_pending_.store(true, std::memory_order_release);
+    }
+    wait_cond_.notify_one();
+  }
+  void call_on_connection_async() {
+    std::lock_guard<std::mutex> lk(async_callback_mutex_);
+    if (on_connection_async_) {
+      on_connection_async_();
+    }
+  }
+  void flush_messages() {
+    std::string data;
+    std::string message;
+    // acquire pairs with exchange in send_message, so that messages pushed
+    // before the flag was set are popped here
+    write_scheduled_.exchange(false, std::memory_order_acq_rel);
+    while (send_queue_.pop(message)) {
+      data += message;
+    }
+    while (!data.empty() && connected_) {
+      asio::error_code ec;
+      asio::write(socket_, asio::buffer(data), ec);
+      if (ec) {
+        on_socket_error(ec);
+        return;
+      }
+      // messages pushed while writing may have seen write_scheduled_ is set
+      data.clear();
+      if (send_queue_.pop(message)) {
+        write_scheduled_.exchange(false, std::memory_order_acq_rel);
+        data = std::move(message);
+        while (send_queue_.pop(message)) {
+          data += message;
+        }
+      }
+    }
+  }
+  void on_socket_error(const asio::error_code& ec) {
+    if (!connected_) {
+      return;
+    }
+    connected_ = false;
+    read_data_.clear();
+    binary_framing_.store(false, std::memory_order_release);
+    if (!stopping_) {
+      push_event(event(event::ERROR_MESSAGE, ec.message()));
+    }
+    push_event(event(event::CLOSE));
+    asio::error_code close_ec;
+    socket_.close(close_ec);
+    async_accept();
+  }
+  void async_accept() {
+    if (stopping_) {
+      return;
+    }
+    acceptor_.async_accept(socket_, [&](const asio::error_code& ec) {
+      if (stopping_) {
+        return;
+      }
+      if (!ec) {
+        connected_ = true;
+        push_event(event(event::CONNECTION));
+        call_on_connection_async();
+        start_receive_commands();
+      } else {
+        push_event(event(event::ERROR_MESSAGE, ec.message()));
+        asio::error_code close_ec;
+        socket_.close(close_ec);
+        async_accept();
+      }
+    });
+  }
+  void start_receive_commands() {
+    socket_.async_read_some(
+        asio::buffer(read_chunk_),
+        [&](const asio::error_code& ec, std::size_t size) {
+          if (!ec) {
+            read_data_.append(read_chunk_, size);
+            // extracted commands are removed at once
+            std::string::size_type offset = 0;
+            std::string command;
+            while (framing::extract(
+                read_data_, offset,
+                binary_framing_.load(std::memory_order_acquire), command)) {
+              push_event(event(event::DATA, std::move(command)));
+            }
+            read_data_.erase(0, offset);
+            if (framing::oversized(
+                    read_data_, 0,
+                    binary_framing_.load(std::memory_order_acquire))) {
+              on_socket_error(asio::error::message_size);
+            } else {
+              start_receive_commands();
+            }
+          } else {
+            on_socket_error(ec);
+          }
+        });
+  }
+
+  asio::io_service io_service_;
+  typename Protocol::endpoint endpoint_;
+  typename Protocol::acceptor acceptor_;
+  typename Protocol::socket socket_;
+  char read_chunk_[4096];
+  std::string read_data_;  /// received data not yet extracted
+  std::unique_ptr<asio::io_service::work> work_;
+  std::thread thread_;
+
+  // owned by background thread
+  bool stopping_;
+  bool connected_;
+  // owned by Lua thread
+  bool open_;
+  bool send_binary_framing_;
+
+  spsc_queue<event> events_;            /// background -> Lua thread
+  spsc_queue<std::string> send_queue_;  /// Lua thread -> background
+  std::atomic<bool> event_pending_;
+  std::atomic<bool> write_scheduled_;
+  std::atomic<bool> binary_framing_;  /// framing of received data
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cond_;
+  std::mutex async_callback_mutex_;
+  std::function<void()> on_connection_async_;
+};
+
+typedef basic_command_stream_threaded_socket<asio::ip::tcp>
+    command_stream_threaded_socket;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+typedef basic_command_stream_threaded_socket<asio::local::stream_protocol>
+    command_stream_threaded_local_socket;
+#endif
+
+}  // namespace lrdb
@@ -0,0 +1,210 @@
+#pragma once
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lrdb {
+
+/// @brief line coverage collector.
+/// Executed lines are recorded to bitmap per chunk(source). Valid lines are
+/// taken from functions called at least once, so lines of never called
+/// function are not reported. Implicit return at the end of function is
+/// not counted as valid line, because it is unreachable after explicit
+/// return.
+/// Line hook is required only in functions that have not executed lines.
+/// template DebugInfo require members source(), what(), currentline(),
+/// linedefined(), lastlinedefined() and valid_lines_on_function().
+/// (see debug_info)
+class line_coverage {
+ public:
+  /// @brief coverage of a chunk
+  struct chunk_coverage {
+    std::string source;
+    std::vector<uint32_t> executed;  /// bitmap of executed lines
+    std::vector<uint32_t> valid;     /// bitmap of lines that has code
+
+    bool is_executed(int line) const { return test(executed, line); }
+    bool is_valid(int line) const { return test(valid, line); }
+    /// @brief max line number + 1 in bitmaps
+    int line_end() const {
+      return int(std::max(executed.size(), valid.size()) * 32);
+    }
+
+   private:
+    friend class line_coverage;
+    static bool test(const std::vector<uint32_t>& bits, int line) {
+      size_t index = size_t(line) / 32;
+      return line >= 0 && index < bits.size() &&
+             (bits[index] & (1u << (line % 32))) != 0;
+    }
+    static void set(std::vector<uint32_t>& bits, int line) {
+      if (line < 0) {
+        return;
+      }
+      size_t index = size_t(line) / 32;
+      if (index >= bits.size()) {
+        bits.resize(index + 1);
+      }
+      bits[index] |= 1u << (line % 32);
+    }
+  };
+
+  line_coverage() : running_(false) {}
+
+  /// @brief start recording. previous result is kept
+  void start() { running_ = true; }
+  /// @brief stop recording
+  void stop() { running_ = false; }
+  /// @brief recording
+  bool running() const { return running_; }
+
+  /// @brief clear result
+  void clear() {
+    chunks_.clear();
+    chunk_ids_.clear();
+    source_cache_.clear();
+    functions_.clear();
+  }
+
+  /// @brief recorded chunks
+  const std::vector<chunk_coverage>& chunks() const { return chunks_; }
+
+  /// @brief record executed line. call at line event
+  template <typename DebugInfo>
+  void hookline(DebugInfo& info) {
+    chunk_coverage::set(chunks_[chunk_id(info.source())].executed,
+                        info.currentline());
+  }
+
+  /// @brief function has not executed line.
+  /// It is called with called or returned function.
+  template <typename DebugInfo>
+  bool line_hook_required(DebugInfo& info) {
+    if (strcmp(info.what(), "C") == 0) {
+      return false;
+    }
+    size_t id = chunk_id(info.source());
+    function_key key = {id, info.linedefined(), info.lastlinedefined()};
+    function_coverage& function = functions_[key];
+    if (function.completed) {
+      return false;
+    }
+    if (!function.initialized) {
+      function.initialized = true;
+      function.lines = info.valid_lines_on_function();
+      int lastline = info.lastlinedefined();
+      if (!function.lines.empty() && function.lines.back() == lastline &&
+          lastline > info.linedefined()) {
+        function.lines.pop_back();
+      }
+      for (int line : function.lines) {
+        chunk_coverage::set(chunks_[id].valid, line);
+      }
+    }
+    // lines before next_line are executed. each line is passed once, and
+    // partially covered function stops at first not executed line
+    const chunk_coverage& chunk = chunks_[id];
+    for (; function.next_line < function.lines.size(); ++function.next_line) {
+      if (!chunk.is_executed(function.lines[function.next_line])) {
+        return true;
+      }
+    }
+    function.completed = true;
+    function.lines = std::vector<int>();
+    return false;
+  }
+
+  /// @brief get result in lcov tracefile format
+  std::string lcov() const {
+    std::string result;
+    for (const chunk_coverage& chunk : chunks_) {
+      result += "TN:\nSF:";
+      result += chunk.source[0] == '@' ? chunk.source.substr(1) : chunk.source;
+      result += '\n';
+      int found = 0;
+      int hit = 0;
+      for (int line = 0; line < chunk.line_end(); ++line) {
+        bool executed = chunk.is_executed(line);
+        if (!executed && !chunk.is_valid(line)) {
+          continue;
+        }
+        result += "DA:" + std::to_string(line) + "," +
+                  (executed ? "1" : "0") + "\n";
+        found++;
+        hit += executed ? 1 : 0;
+      }
+      result += "LF:" + std::to_string(found) + "\n";
+      result += "LH:" + std::to_string(hit) + "\n";
+      result += "end_of_record\n";
+    }
+    return result;
+  }
+
+ private:
+  struct function_coverage {
+    function_coverage() : initialized(false), completed(false), next_line(0) {}
+    bool initialized;
+    bool completed;
+    std::vector<int> lines;
+    size_t next_line;  /// index of lines to check next
+  };
+  /// functions are identified by lines, because closures of a function
+  /// share lines. Functions on same lines have same valid lines.
+  struct function_key {
+    size_t chunk_id;
+    int linedefined;
+    int lastlinedefined;
+    bool operator==(const function_key& other) const {
+      return chunk_id == other.chunk_id && linedefined == other.linedefined &&
+             lastlinedefined == other.lastlinedefined;
+    }
+  };
+  struct function_key_hash {
+    size_t operator()(const function_key& key) const {
+      return std::hash<size_t>()(key.chunk_id) ^
+             (std::hash<int>()(key.linedefined) * 31) ^
+             (std::hash<int>()(key.lastlinedefined) * 961);
+    }
+  };
+  struct source_cache_entry {
+    std::string source;
+    size_t chunk_id;
+  };
+
+  size_t chunk_id(const char* source) {
+    source_cache_entry& entry = source_cache_[source];
+    if (entry.source.empty() || entry.source != source) {
+      entry.source = source;
+      auto found = chunk_ids_.find(entry.source);
+      if (found != chunk_ids_.end()) {
+        entry.chunk_id = found->second;
+      } else {
+        entry.chunk_id = chunks_.size();
+        chunk_ids_[entry.source] = entry.chunk_id;
+        chunks_.push_back(chunk_coverage());
+        chunks_.back().source = entry.source;
+      }
+    }
+    return entry.chunk_id;
+  }
+
+  bool running_;
+  std::vector<chunk_coverage> chunks_;
+  std::unordered_map<std::string, size_t> chunk_ids_;
+  std::unordered_map<const void*, source_cache_entry> source_cache_;
+  std::unordered_map<function_key, function_coverage, function_key_hash>
+      functions_;
+};
+}  // namespace lrdb
+
+#else
+#error Needs at least a C++11 compiler
+#endif
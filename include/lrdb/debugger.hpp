@@ -2,14 +2,25 @@
 
 #if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <cmath>
 
+#include "coverage.hpp"
+#include "heap_snapshot.hpp"
+#include "json_writer.hpp"
 #include "picojson.h"
+#include "profiler.hpp"
 extern "C" {
 #include <lauxlib.h>
 #include <lua.h>
@@ -69,7 +80,7 @@ inline json::value to_json(lua_State* L, int index, int max_recursive = 1) {
 #pragma warning(push)
 #pragma warning(disable : 4996)
 #endif
-        sprintf(buffer, "%p", lua_topointer(L, -1));
+        sprintf(buffer, "%p", lua_topointer(L, index));
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -145,6 +156,106 @@ inline json::value to_json(lua_State* L, int index, int max_recursive = 1) {
   }
   return json::value();
 }
+/// @brief write Lua stack value as json without building json::value.
+/// Output is same as to_json except key order of table.
+inline void write_json(json_writer& writer, lua_State* L, int index,
+                       int max_recursive = 1) {
+  index = lua_absindex(L, index);
+  int type = lua_type(L, index);
+  switch (type) {
+    case LUA_TNIL:
+      writer.null_value();
+      return;
+    case LUA_TBOOLEAN:
+      writer.value(bool(lua_toboolean(L, index) != 0));
+      return;
+    case LUA_TNUMBER: {
+      double n = lua_tonumber(L, index);
+      if (std::isnan(n)) {
+        writer.value("NaN");
+      } else if (std::isinf(n)) {
+        writer.value("Infinity");
+      } else {
+        writer.value(n);
+      }
+      return;
+    }
+    case LUA_TSTRING: {
+      size_t len = 0;
+      const char* str = lua_tolstring(L, index, &len);
+      writer.value(str, len);
+      return;
+    }
+    case LUA_TTABLE: {
+      if (max_recursive <= 0) {
+        char buffer[128] = {};
+        snprintf(buffer, sizeof(buffer), "%p", lua_topointer(L, index));
+        int tt = luaL_getmetafield(L, index, "__name");
+        const char* type =
+            (tt == LUA_TSTRING) ? lua_tostring(L, -1) : luaL_typename(L, index);
+        writer.begin_object();
+        writer.key(type);
+        writer.value(buffer);
+        writer.end_object();
+        if (tt != LUA_TNIL) {
+          lua_pop(L, 1); /* remove '__name' */
+        }
+        return;
+      }
+      bool is_array = lua_rawlen(L, index) > 0;
+      if (is_array) {
+        writer.begin_array();
+      } else {
+        writer.begin_object();
+      }
+      lua_pushnil(L);
+      while (lua_next(L, index) != 0) {
+        int key_type = lua_type(L, -2);
+        if (is_array && key_type == LUA_TNUMBER) {
+          write_json(writer, L, -1, max_recursive - 1);
+        } else if (!is_array && key_type == LUA_TSTRING) {
+          size_t len = 0;
+          const char* key = lua_tolstring(L, -2, &len);
+          writer.key(key, len);
+          write_json(writer, L, -1, max_recursive - 1);
+        }
+        lua_pop(L, 1);  // pop value
+      }
+      if (is_array) {
+        writer.end_array();
+      } else {
+        writer.end_object();
+      }
+      return;
+    }
+    case LUA_TUSERDATA: {
+      if (luaL_callmeta(L, index, "__tostring") ||
+          luaL_callmeta(L, index, "__totable")) {
+        write_json(writer, L, -1, max_recursive);  // return value to json
+        lua_pop(L, 1);                              // pop return value
+        return;
+      }
+      // without conversion, written as type name like light userdata
+    }
+    // fallthrough
+    case LUA_TLIGHTUSERDATA:
+    case LUA_TTHREAD:
+    case LUA_TFUNCTION: {
+      int tt = luaL_getmetafield(L, index, "__name");
+      const char* type =
+          (tt == LUA_TSTRING) ? lua_tostring(L, -1) : luaL_typename(L, index);
+      char buffer[128] = {};
+      snprintf(buffer, sizeof(buffer), "%s: %p", type,
+               lua_topointer(L, index));
+      if (tt != LUA_TNIL) {
+        lua_pop(L, 1); /* remove '__name' */
+      }
+      writer.value(buffer);
+      return;
+    }
+  }
+  writer.null_value();
+}
 /// @brief push value to Lua stack from json
 inline void push_json(lua_State* L, const json::value& v) {
   if (v.is<json::null>()) {
@@ -175,9 +286,224 @@ inline void push_json(lua_State* L, const json::value& v) {
 }
 }  // namespace utility
 
+/// @brief handles of tables and userdata for lazy variable fetch.
+/// Values are pinned in registry until clear, and children of a value are
+/// fetched later by its handle with paging. Same value gets same handle.
+class variable_references {
+ public:
+  variable_references() : next_id_(1), cursor_id_(0), cursor_pos_(0) {}
+
+  /// @brief value is written as handle. tables and full userdata
+  static bool is_referable(lua_State* L, int index) {
+    int type = lua_type(L, index);
+    return type == LUA_TTABLE || type == LUA_TUSERDATA;
+  }
+  /// @brief pin value and get handle
+  /// @return handle. greater than 0
+  int pin(lua_State* L, int index) {
+    index = lua_absindex(L, index);
+    push_pins(L);
+    lua_pushvalue(L, index);
+    lua_rawget(L, -2);
+    int id = static_cast<int>(lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    if (id == 0) {
+      id = next_id_++;
+      lua_pushvalue(L, index);
+      lua_rawseti(L, -2, id);
+      lua_pushvalue(L, index);
+      lua_pushinteger(L, id);
+      lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);  // pop pins
+    return id;
+  }
+  /// @brief push pinned value of handle
+  /// @return If pinned return true. Otherwise return false and nothing pushed
+  bool push(lua_State* L, int id) {
+    if (id <= 0 || id >= next_id_) {
+      return false;
+    }
+    push_pins(L);
+    lua_rawgeti(L, -1, id);
+    lua_remove(L, -2);  // remove pins
+    return true;
+  }
+  /// @brief release all handles
+  void clear(lua_State* L) {
+    if (next_id_ > 1) {
+      lua_pushlightuserdata(L, pins_key());
+      lua_pushnil(L);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+    next_id_ = 1;
+    cursor_id_ = 0;
+    cursor_pos_ = 0;
+  }
+  /// @brief number of pinned values
+  size_t size() const { return size_t(next_id_ - 1); }
+
+  /// @brief write value. table and userdata are pinned and written as
+  /// {"reference": handle, "type": type name, "length": raw length of table}
+  /// other values are same as utility::write_json
+  void write(json_writer& writer, lua_State* L, int index) {
+    if (!is_referable(L, index)) {
+      utility::write_json(writer, L, index, 0);
+      return;
+    }
+    index = lua_absindex(L, index);
+    writer.begin_object();
+    writer.key("reference");
+    writer.value(double(pin(L, index)));
+    writer.key("type");
+    int tt = luaL_getmetafield(L, index, "__name");
+    writer.value((tt == LUA_TSTRING) ? lua_tostring(L, -1)
+                                     : luaL_typename(L, index));
+    if (tt != LUA_TNIL) {
+      lua_pop(L, 1); /* remove '__name' */
+    }
+    if (lua_type(L, index) == LUA_TTABLE) {
+      writer.key("length");
+      writer.value(double(lua_rawlen(L, index)));
+    }
+    writer.end_object();
+  }
+
+  /// @brief write children of handle as array of {"key": k, "value": v}.
+  /// Children of userdata are entries of __totable result. Fetching pages in
+  /// order continues table traversal from previous page.
+  /// @param start number of children to skip
+  /// @param count max number of children to write
+  /// @return false if handle is not pinned. then nothing is written
+  bool write_children(json_writer& writer, lua_State* L, int id, size_t start,
+                      size_t count) {
+    int top = lua_gettop(L);
+    if (!push_children(L, id)) {
+      lua_settop(L, top);
+      return false;
+    }
+    int table = lua_gettop(L);
+    size_t pos = 0;
+    lua_pushnil(L);
+    if (cursor_id_ == id && cursor_pos_ == start && start > 0) {
+      push_pins(L);
+      lua_pushlightuserdata(L, cursor_key());
+      lua_rawget(L, -2);
+      lua_remove(L, -2);  // remove pins
+      lua_pushvalue(L, -1);
+      lua_rawget(L, table);
+      bool alive = !lua_isnil(L, -1);
+      lua_pop(L, 1);
+      if (alive) {  // lua_next raise error for removed key
+        lua_remove(L, -2);  // remove nil
+        pos = start;
+      } else {
+        lua_pop(L, 1);
+      }
+    }
+    writer.begin_array();
+    size_t written = 0;
+    while (written < count && lua_next(L, table) != 0) {
+      if (pos++ >= start) {
+        writer.begin_object();
+        writer.key("key");
+        write(writer, L, -2);
+        writer.key("value");
+        write(writer, L, -1);
+        writer.end_object();
+        ++written;
+      }
+      lua_pop(L, 1);  // pop value
+    }
+    writer.end_array();
+    if (written > 0 && written == count) {  // last key is on stack top
+      push_pins(L);
+      lua_pushlightuserdata(L, cursor_key());
+      lua_pushvalue(L, -3);
+      lua_rawset(L, -3);
+      cursor_id_ = id;
+      cursor_pos_ = pos;
+    } else {
+      cursor_id_ = 0;
+    }
+    lua_settop(L, top);
+    return true;
+  }
+
+ private:
+  /// push pins table. [handle] = value, [value] = handle,
+  /// [-handle] = __totable result of userdata
+  void push_pins(lua_State* L) {
+    lua_pushlightuserdata(L, pins_key());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_createtable(L, 0, 0);
+      lua_pushlightuserdata(L, pins_key());
+      lua_pushvalue(L, -2);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+  }
+  /// push table for children of handle
+  bool push_children(lua_State* L, int id) {
+    if (!push(L, id)) {
+      return false;
+    }
+    if (lua_type(L, -1) == LUA_TTABLE) {
+      return true;
+    }
+    push_pins(L);
+    lua_rawgeti(L, -1, -id);
+    if (lua_istable(L, -1)) {
+      lua_remove(L, -2);  // remove pins
+      lua_remove(L, -2);  // remove userdata
+      return true;
+    }
+    lua_pop(L, 1);
+    if (luaL_callmeta(L, -2, "__totable") && !lua_istable(L, -1)) {
+      lua_pop(L, 1);  // pop return value
+    }
+    if (!lua_istable(L, -1)) {
+      lua_createtable(L, 0, 0);  // no children
+    }
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, -id);
+    lua_replace(L, -3);  // replace userdata
+    lua_pop(L, 1);       // pop pins
+    return true;
+  }
+  static void* pins_key() {
+    static int key_data = 0;
+    return &key_data;
+  }
+  static void* cursor_key() {
+    static int key_data = 0;
+    return &key_data;
+  }
+
+  int next_id_;
+  int cursor_id_;      /// handle of last fetched page
+  size_t cursor_pos_;  /// position of next page of cursor_id_
+};
+
 /// @brief line based break point type
 struct breakpoint_info {
-  breakpoint_info() : line(-1), hit_count(0) {}
+  breakpoint_info()
+      : line(-1),
+        hit_count(0),
+        condition_ref(LUA_NOREF),
+        hit_condition_op(HIT_COND_NONE),
+        hit_condition_value(0) {}
+  enum hit_condition_operator {
+    HIT_COND_NONE,
+    HIT_COND_LESS,
+    HIT_COND_LESS_EQUAL,
+    HIT_COND_EQUAL,
+    HIT_COND_GREATER,
+    HIT_COND_GREATER_EQUAL,
+    HIT_COND_MOD,
+    HIT_COND_INVALID,  /// unparsable hit_condition. always break
+  };
   std::string file;           /// source file
   std::string func;           /// function name(currently unused)
   int line;                   /// line number
@@ -185,6 +511,10 @@ struct breakpoint_info {
   std::string hit_condition;  // expression that controls how many hits of the
                               // breakpoint are ignored
   size_t hit_count;           /// breakpoint hit counts
+  int condition_ref;  /// compiled condition chunk reference in registry.
+                      /// LUA_REFNIL if failed to compile
+  hit_condition_operator hit_condition_op;  /// parsed hit_condition operator
+  double hit_condition_value;               /// parsed hit_condition operand
 };
 
 /// @brief debug data
@@ -192,20 +522,23 @@ struct breakpoint_info {
 class debug_info {
  public:
   typedef std::vector<std::pair<std::string, json::value> > local_vars_type;
-  debug_info() : state_(0), debug_(0) {}
+  debug_info() : state_(0), debug_(0), level_(0) {}
   debug_info(const debug_info& other)
       : state_(other.state_),
         debug_(other.debug_),
+        level_(other.level_),
         got_debug_(other.got_debug_) {}
   debug_info& operator=(const debug_info& other) {
     state_ = other.state_;
     debug_ = other.debug_;
+    level_ = other.level_;
     got_debug_ = other.got_debug_;
     return *this;
   }
   void assign(lua_State* L, lua_Debug* debug, const char* got_type = 0) {
     state_ = L;
     debug_ = debug;
+    level_ = 0;
     got_debug_.clear();
     if (got_type) {
       got_debug_.append(got_type);
@@ -313,19 +646,26 @@ class debug_info {
     }
     return debug_->short_src;
   }
-  /*
-  std::vector<bool> valid_lines_on_function() {
-    std::vector<bool> ret;
-    lua_getinfo(state_, "fL", debug_);
-    lua_pushnil(state_);
-    while (lua_next(state_, -2) != 0) {
-      int t = lua_type(state_, -1);
-      ret.push_back(lua_toboolean(state_, -1));
-      lua_pop(state_, 1);  // pop value
-    }
-    lua_pop(state_, 2);
+  /// @brief get line numbers that has code in function
+  /// @return sorted line numbers. empty if C function
+  std::vector<int> valid_lines_on_function() {
+    std::vector<int> ret;
+    if (!is_available() || !lua_getinfo(state_, "L", debug_)) {
+      return ret;
+    }
+    if (lua_istable(state_, -1)) {
+      lua_pushnil(state_);
+      while (lua_next(state_, -2) != 0) {
+        lua_pop(state_, 1);  // pop value
+        if (lua_type(state_, -1) == LUA_TNUMBER) {
+          ret.push_back(static_cast<int>(lua_tonumber(state_, -1)));
+        }
+      }
+    }
+    lua_pop(state_, 1);
+    std::sort(ret.begin(), ret.end());
     return ret;
-  }*/
+  }
 
   /// @brief evaluate script
   /// e.g.
@@ -353,26 +693,7 @@ class debug_info {
                                 bool global = true, bool upvalue = true,
                                 bool local = true, int object_depth = 1) {
     int stack_start = lua_gettop(state_);
-    int loadstat =
-        luaL_loadstring(state_, (std::string("return ") + script).c_str());
-    if (loadstat != 0) {
-      lua_pop(state_, 1);
-      loadstat = luaL_loadstring(state_, script);
-    }
-    if (!lua_isfunction(state_, -1)) {
-      error = lua_tostring(state_, -1);
-      return std::vector<json::value>();
-    }
-
-    create_eval_env(global, upvalue, local);
-#if LUA_VERSION_NUM >= 502
-    lua_setupvalue(state_, -2, 1);
-#else
-    lua_setfenv(state_, -2);
-#endif
-    int call_stat = lua_pcall(state_, 0, LUA_MULTRET, 0);
-    if (call_stat != 0) {
-      error = lua_tostring(state_, -1);
+    if (!eval_to_stack(script, error, global, upvalue, local)) {
       return std::vector<json::value>();
     }
     std::vector<json::value> ret;
@@ -383,6 +704,41 @@ class debug_info {
     lua_settop(state_, stack_start);
     return ret;
   }
+  /// @brief evaluate script and write return values as json array
+  /// @return false if error. then nothing is written
+  bool eval(json_writer& writer, const char* script, std::string& error,
+            bool global = true, bool upvalue = true, bool local = true,
+            int object_depth = 1) {
+    return write_eval(
+        writer, script, error, global, upvalue, local,
+        [&](int index) {
+          utility::write_json(writer, state_, index, object_depth);
+        });
+  }
+  /// @brief evaluate script and write return values as json array.
+  /// tables and userdata are written as handle of references
+  /// @return false if error. then nothing is written
+  bool eval(json_writer& writer, variable_references& references,
+            const char* script, std::string& error, bool global = true,
+            bool upvalue = true, bool local = true) {
+    return write_eval(writer, script, error, global, upvalue, local,
+                      [&](int index) {
+                        references.write(writer, state_, index);
+                      });
+  }
+  /// @brief set execute environment to loaded chunk at stack top
+  /// @param global execute environment include global
+  /// @param upvalue execute environment include upvalues
+  /// @param local execute environment include local variables
+  void set_eval_env(bool global = true, bool upvalue = true,
+                    bool local = true) {
+    create_eval_env(global, upvalue, local);
+#if LUA_VERSION_NUM >= 502
+    lua_setupvalue(state_, -2, 1);
+#else
+    lua_setfenv(state_, -2);
+#endif
+  }
   /// @brief get local variables
   /// @param object_depth depth of extract for table for return value
   /// @return array of name and value pair
@@ -411,6 +767,20 @@ class debug_info {
 #endif
     return localvars;
   }
+  /// @brief write local variables as json object. If same name variables
+  /// exist, latest declared one is written. (see get_local_vars)
+  void get_local_vars(json_writer& writer, int object_depth = 0) {
+    write_local_vars(writer, [&](int index, bool vararg) {
+      utility::write_json(writer, state_, index, vararg ? 1 : object_depth);
+    });
+  }
+  /// @brief write local variables as json object. tables and userdata are
+  /// written as handle of references
+  void get_local_vars(json_writer& writer, variable_references& references) {
+    write_local_vars(writer, [&](int index, bool) {
+      references.write(writer, state_, index);
+    });
+  }
   /// @brief set local variables
   /// @param name local variable name
   /// @param v assign value
@@ -450,6 +820,20 @@ class debug_info {
     lua_pop(state_, 1);  // pop current running function
     return localvars;
   }
+  /// @brief write upvalues as json object. tables and userdata are written
+  /// as handle of references
+  void get_upvalues(json_writer& writer, variable_references& references) {
+    writer.begin_object();
+    lua_getinfo(state_, "f", debug_);  // push current running function
+    int upvno = 1;
+    while (const char* varname = lua_getupvalue(state_, -1, upvno++)) {
+      writer.key(varname);
+      references.write(writer, state_, -1);
+      lua_pop(state_, 1);
+    }
+    lua_pop(state_, 1);  // pop current running function
+    writer.end_object();
+  }
   /// @brief set upvalue
   /// @param name upvalue name
   /// @param v assign value
@@ -480,72 +864,306 @@ class debug_info {
   /// @return If data is available, return true. Otherwise return false.
   bool is_available() { return state_ && debug_; }
 
+  /// @brief discard cached eval environments.
+  /// Assigned value to environment by eval is discarded.
+  static void clear_eval_env_cache(lua_State* L) {
+    lua_pushlightuserdata(L, eval_env_cache_key());
+    lua_pushnil(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+
  private:
+  enum eval_env_flags {
+    EVAL_ENV_GLOBAL = 1,
+    EVAL_ENV_UPVALUE = 2,
+    EVAL_ENV_LOCAL = 4,
+  };
+  /// @brief load and call script with eval environment.
+  /// return values are left on stack
+  /// @return false if error. stack is restored
+  bool eval_to_stack(const char* script, std::string& error, bool global,
+                     bool upvalue, bool local) {
+    int stack_start = lua_gettop(state_);
+    int loadstat =
+        luaL_loadstring(state_, (std::string("return ") + script).c_str());
+    if (loadstat != 0) {
+      lua_pop(state_, 1);
+      loadstat = luaL_loadstring(state_, script);
+    }
+    if (!lua_isfunction(state_, -1)) {
+      error = lua_tostring(state_, -1);
+      lua_settop(state_, stack_start);
+      return false;
+    }
+
+    set_eval_env(global, upvalue, local);
+    int call_stat = lua_pcall(state_, 0, LUA_MULTRET, 0);
+    if (call_stat != 0) {
+      error = lua_tostring(state_, -1);
+      lua_settop(state_, stack_start);
+      return false;
+    }
+    return true;
+  }
+  /// @brief write return values of script as json array
+  /// @param write_value write a return value of stack index
+  template <typename ValueWriter>
+  bool write_eval(json_writer& writer, const char* script, std::string& error,
+                  bool global, bool upvalue, bool local,
+                  ValueWriter write_value) {
+    int stack_start = lua_gettop(state_);
+    if (!eval_to_stack(script, error, global, upvalue, local)) {
+      return false;
+    }
+    writer.begin_array();
+    int ret_end = lua_gettop(state_);
+    for (int retindex = stack_start + 1; retindex <= ret_end; ++retindex) {
+      write_value(retindex);
+    }
+    writer.end_array();
+    lua_settop(state_, stack_start);
+    return true;
+  }
+  /// @brief write local variables as json object
+  /// @param write_value write a variable of stack index. second argument is
+  /// true for element of (*vararg)
+  template <typename ValueWriter>
+  void write_local_vars(json_writer& writer, ValueWriter write_value) {
+    writer.begin_object();
+    int varno = 1;
+    while (const char* varname = lua_getlocal(state_, debug_, varno++)) {
+      if (varname[0] != '(' && !has_local_var_from(varname, varno)) {
+        writer.key(varname);
+        write_value(-1, false);
+      }
+      lua_pop(state_, 1);
+    }
+#if LUA_VERSION_NUM >= 502
+    if (is_variadic_arg()) {
+      writer.key("(*vararg)");
+      writer.begin_array();
+      int varno = -1;
+      while (lua_getlocal(state_, debug_, varno--)) {
+        write_value(-1, true);
+        lua_pop(state_, 1);
+      }
+      writer.end_array();
+    }
+#endif
+    writer.end_object();
+  }
+  /// @brief local variable named name exists from varno
+  bool has_local_var_from(const char* name, int varno) {
+    while (const char* varname = lua_getlocal(state_, debug_, varno++)) {
+      lua_pop(state_, 1);
+      if (strcmp(varname, name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+  /// @brief push environment table for eval.
+  /// Variables are not copied, __index resolve name from the frame at
+  /// lookup. Environment is cached per thread, frame and running function,
+  /// and reused until clear_eval_env_cache.
   void create_eval_env(bool global = true, bool upvalue = true,
                        bool local = true) {
+    int flags = (global ? EVAL_ENV_GLOBAL : 0) |
+                (upvalue ? EVAL_ENV_UPVALUE : 0) | (local ? EVAL_ENV_LOCAL : 0);
+    // frame position from stack bottom. it is not changed by nested call
+    int frame = stack_depth(state_) - 1 - level_;
+    int cache_key = frame * 8 + flags;
+
+    lua_rawgetp(state_, LUA_REGISTRYINDEX, eval_env_cache_key());
+    if (lua_isnil(state_, -1)) {
+      lua_pop(state_, 1);
+      lua_createtable(state_, 0, 1);
+      lua_createtable(state_, 0, 1);
+      lua_pushstring(state_, "k");
+      lua_setfield(state_, -2, "__mode");
+      lua_setmetatable(state_, -2);
+      lua_pushlightuserdata(state_, eval_env_cache_key());
+      lua_pushvalue(state_, -2);
+      lua_rawset(state_, LUA_REGISTRYINDEX);
+    }
+    // keyed by thread object. entry of collected thread is removed by
+    // weak key, so that new thread at same address does not hit
+    lua_pushthread(state_);
+    lua_rawget(state_, -2);
+    if (lua_isnil(state_, -1)) {
+      lua_pop(state_, 1);
+      lua_createtable(state_, 0, 0);  // per thread cache
+      lua_createtable(state_, 0, 1);
+      lua_pushstring(state_, "v");
+      lua_setfield(state_, -2, "__mode");
+      lua_setmetatable(state_, -2);
+      lua_pushthread(state_);
+      lua_pushvalue(state_, -2);
+      lua_rawset(state_, -4);
+    }
+    lua_remove(state_, -2);  // remove cache root
+    lua_rawgeti(state_, -1, cache_key);
+    if (!lua_isnil(state_, -1) && is_eval_env_of_frame(-1)) {
+      lua_remove(state_, -2);  // remove thread cache
+      return;
+    }
+    lua_pop(state_, 1);
+
     lua_createtable(state_, 0, 0);
     int envtable = lua_gettop(state_);
-    lua_createtable(state_, 0, 0);  // create metatable for env
-    int metatable = lua_gettop(state_);
-    // use global
-    if (global) {
-      lua_pushglobaltable(state_);
-      lua_setfield(state_, metatable, "__index");
+    lua_createtable(state_, 1, 1);  // create metatable for env
+    lua_pushthread(state_);
+    lua_pushinteger(state_, frame);
+    lua_pushinteger(state_, flags);
+    lua_pushcclosure(state_, &eval_env_index, 3);
+    lua_setfield(state_, -2, "__index");
+    lua_getinfo(state_, "f", debug_);  // push current running function
+    lua_rawseti(state_, -2, 1);
+    lua_setmetatable(state_, envtable);
+#if LUA_VERSION_NUM < 502
+    lua_pushvalue(state_, envtable);
+    lua_setfield(state_, envtable, "_ENV");
+#endif
+    lua_pushvalue(state_, envtable);
+    lua_rawseti(state_, -3, cache_key);
+    lua_remove(state_, -2);  // remove thread cache
+  }
+
+  /// @brief cached environment at index is created for running function
+  /// of the frame. other function may be called at same frame position
+  bool is_eval_env_of_frame(int index) {
+    if (!lua_getmetatable(state_, index)) {
+      return false;
     }
+    lua_rawgeti(state_, -1, 1);
+    lua_getinfo(state_, "f", debug_);  // push current running function
+    bool same = lua_rawequal(state_, -1, -2) != 0;
+    lua_pop(state_, 3);
+    return same;
+  }
 
-    // use upvalue
-    if (upvalue) {
-      lua_getinfo(state_, "f", debug_);  // push current running function
+  static void* eval_env_cache_key() {
+    static int key_data = 0;
+    return &key_data;
+  }
 
-#if LUA_VERSION_NUM < 502
-      lua_getfenv(state_, -1);
-      lua_setfield(state_, metatable, "__index");
-#endif
-      int upvno = 1;
-      while (const char* varname = lua_getupvalue(state_, -1, upvno++)) {
-        if (strcmp(varname, "_ENV") == 0)  // override _ENV
-        {
-          lua_pushvalue(state_, -1);
-          lua_setfield(state_, metatable, "__index");
-        }
-        lua_setfield(state_, envtable, varname);
-      }
-      lua_pop(state_, 1);  // pop current running function
+  /// @brief count of stack frames
+  static int stack_depth(lua_State* L) {
+    lua_Debug ar;
+    if (!lua_getstack(L, 0, &ar)) {
+      return 0;
     }
-    // use local vars
-    if (local) {
-      int varno = 0;
-      while (const char* varname = lua_getlocal(state_, debug_, ++varno)) {
-        if (strcmp(varname, "_ENV") == 0)  // override _ENV
-        {
-          lua_pushvalue(state_, -1);
-          lua_setfield(state_, metatable, "__index");
-        }
-        lua_setfield(state_, envtable, varname);
+    int exist = 0;
+    int not_exist = 1;
+    while (lua_getstack(L, not_exist, &ar)) {
+      exist = not_exist;
+      not_exist *= 2;
+    }
+    while (not_exist - exist > 1) {
+      int mid = exist + (not_exist - exist) / 2;
+      if (lua_getstack(L, mid, &ar)) {
+        exist = mid;
+      } else {
+        not_exist = mid;
       }
+    }
+    return exist + 1;
+  }
+
+  /// @brief push variable of frame to L
+  /// @return If found return true. Otherwise return false and nothing pushed
+  static bool push_frame_var(lua_State* L, lua_State* thread, lua_Debug* ar,
+                             const char* name, int flags) {
+    if (flags & EVAL_ENV_LOCAL) {
 #if LUA_VERSION_NUM >= 502
-      // va arg
-      if (is_variadic_arg()) {
-        varno = 0;
-        lua_createtable(state_, 0, 0);
-        while (const char* varname = lua_getlocal(state_, debug_, --varno)) {
-          (void)varname;  // unused
-          lua_rawseti(state_, -2, -varno);
+      if (strcmp(name, "(*vararg)") == 0) {
+        int varno = 0;
+        lua_createtable(thread, 0, 0);
+        while (lua_getlocal(thread, ar, --varno)) {
+          lua_rawseti(thread, -2, -varno);
         }
         if (varno < -1) {
-          lua_setfield(state_, envtable, "(*vararg)");
-        } else {
-          lua_pop(state_, 1);
+          lua_xmove(thread, L, 1);
+          return true;
         }
+        lua_pop(thread, 1);
       }
 #endif
+      // last one is active if same name
+      int found = 0;
+      int varno = 0;
+      while (const char* varname = lua_getlocal(thread, ar, ++varno)) {
+        if (strcmp(varname, name) == 0) {
+          found = varno;
+        }
+        lua_pop(thread, 1);
+      }
+      if (found) {
+        lua_getlocal(thread, ar, found);
+        lua_xmove(thread, L, 1);
+        return true;
+      }
+    }
+    if (flags & EVAL_ENV_UPVALUE) {
+      lua_getinfo(thread, "f", ar);  // push current running function
+      int upvno = 1;
+      while (const char* varname = lua_getupvalue(thread, -1, upvno++)) {
+        if (strcmp(varname, name) == 0) {
+          lua_remove(thread, -2);  // pop current running function
+          lua_xmove(thread, L, 1);
+          return true;
+        }
+        lua_pop(thread, 1);
+      }
+      lua_pop(thread, 1);  // pop current running function
+    }
+    return false;
+  }
+
+  /// @brief __index of eval environment
+  /// upvalues: target thread, frame position from bottom, eval_env_flags
+  static int eval_env_index(lua_State* L) {
+    lua_State* thread = lua_tothread(L, lua_upvalueindex(1));
+    int frame = static_cast<int>(lua_tointeger(L, lua_upvalueindex(2)));
+    int flags = static_cast<int>(lua_tointeger(L, lua_upvalueindex(3)));
+
+    lua_Debug ar;
+    int level = stack_depth(thread) - 1 - frame;
+    if (level < 0 || !lua_getstack(thread, level, &ar)) {
+      return 0;  // frame already returned
+    }
+    if (lua_type(L, 2) == LUA_TSTRING &&
+        push_frame_var(L, thread, &ar, lua_tostring(L, 2), flags)) {
+      return 1;
+    }
+    if (!push_fallback_env(L, thread, &ar, flags)) {
+      return 0;
+    }
+    lua_pushvalue(L, 2);
+    lua_gettable(L, -2);
+    return 1;
+  }
+  /// @brief push _ENV of frame or global table
+  static bool push_fallback_env(lua_State* L, lua_State* thread,
+                                lua_Debug* ar, int flags) {
+#if LUA_VERSION_NUM >= 502
+    if (push_frame_var(L, thread, ar, "_ENV", flags)) {
+      return true;
+    }
+#else
+    if (flags & EVAL_ENV_UPVALUE) {
+      lua_getinfo(thread, "f", ar);  // push current running function
+      lua_getfenv(thread, -1);
+      lua_remove(thread, -2);  // pop current running function
+      lua_xmove(thread, L, 1);
+      return true;
     }
-    lua_setmetatable(state_, envtable);
-#if LUA_VERSION_NUM < 502
-    lua_pushvalue(state_, envtable);
-    lua_setfield(state_, envtable, "_ENV");
 #endif
-    return;
+    if (flags & EVAL_ENV_GLOBAL) {
+      lua_pushglobaltable(L);
+      return true;
+    }
+    return false;
   }
 
   friend class debugger;
@@ -553,6 +1171,7 @@ class debug_info {
 
   lua_State* state_;
   lua_Debug* debug_;
+  int level_;  /// stack level of debug_
   std::string got_debug_;
 };
 
@@ -564,6 +1183,7 @@ class stack_info : private debug_info {
     valid_ = lua_getstack(L, level, &debug_var_) != 0;
     if (valid_) {
       assign(L, &debug_var_);
+      level_ = level;
     }
   }
   stack_info(const stack_info& other)
@@ -601,6 +1221,7 @@ class stack_info : private debug_info {
   using debug_info::set_local_var;
   using debug_info::set_upvalue;
   using debug_info::short_src;
+  using debug_info::valid_lines_on_function;
 
  private:
   lua_Debug debug_var_;
@@ -614,8 +1235,32 @@ class debugger {
   typedef std::function<void(debugger& debugger)> pause_handler_type;
   typedef std::function<void(debugger& debugger)> tick_handler_type;
 
-  debugger() : state_(0), pause_(true), step_type_(STEP_ENTRY) {}
-  debugger(lua_State* L) : state_(0), pause_(true), step_type_(STEP_ENTRY) {
+  debugger()
+      : state_(0),
+        pause_(true),
+        step_type_(STEP_ENTRY),
+        hook_mask_(0),
+        hook_mask_dirty_(false),
+        line_hook_required_(true),
+        idle_hook_count_(1000),
+        hook_suspended_(false),
+        rehook_threads_(false),
+        source_serial_(0),
+        current_line_counts_(0),
+        current_line_counts_stale_(true) {}
+  debugger(lua_State* L)
+      : state_(0),
+        pause_(true),
+        step_type_(STEP_ENTRY),
+        hook_mask_(0),
+        hook_mask_dirty_(false),
+        line_hook_required_(true),
+        idle_hook_count_(1000),
+        hook_suspended_(false),
+        rehook_threads_(false),
+        source_serial_(0),
+        current_line_counts_(0),
+        current_line_counts_stale_(true) {
     reset(L);
   }
   ~debugger() { reset(); }
@@ -642,9 +1287,15 @@ class debugger {
       } else {
         info.hit_condition = ">=" + hit_condition;
       }
+      parse_hit_condition(info);
     }
 
+    if (state_) {
+      compile_condition(state_, info);
+    }
     line_breakpoints_.push_back(info);
+    rebuild_breakpoint_index();
+    update_hook_mask();
   }
   /// @brief clear breakpoints with filename and line number
   /// @param file source filename
@@ -652,14 +1303,26 @@ class debugger {
   void clear_breakpoints(const std::string& file, int line = -1) {
     line_breakpoints_.erase(
         std::remove_if(line_breakpoints_.begin(), line_breakpoints_.end(),
-                       [&](const breakpoint_info& b) {
-                         return (line < 0 || b.line == line) &&
-                                (b.file == file);
+                       [&](breakpoint_info& b) {
+                         if ((line < 0 || b.line == line) && (b.file == file)) {
+                           release_condition(b);
+                           return true;
+                         }
+                         return false;
                        }),
         line_breakpoints_.end());
+    rebuild_breakpoint_index();
+    update_hook_mask();
   }
   /// @brief clear breakpoints
-  void clear_breakpoints() { line_breakpoints_.clear(); }
+  void clear_breakpoints() {
+    for (size_t i = 0; i < line_breakpoints_.size(); ++i) {
+      release_condition(line_breakpoints_[i]);
+    }
+    line_breakpoints_.clear();
+    rebuild_breakpoint_index();
+    update_hook_mask();
+  }
 
   /// @brief get line break points.
   /// @return array of breakpoints.
@@ -673,6 +1336,130 @@ class debugger {
   /// return.
   void set_tick_handler(tick_handler_type handler) { tick_handler_ = handler; }
 
+  /// @brief set number of VM instructions between ticks while idle.
+  /// While no breakpoint is set and not stepping or pausing, line hooks are
+  /// removed and the tick handler is only called by the count hook.
+  /// @param count instruction count. must be greater than 0. default 1000
+  void set_idle_hook_count(int count) {
+    idle_hook_count_ = count > 0 ? count : 1;
+    update_hook_mask();
+  }
+
+  /// @brief get installed hook mask
+  /// @return combination of LUA_MASKLINE, LUA_MASKCOUNT, etc.
+  int hook_mask() const { return hook_mask_; }
+
+  /// @brief get sampling profiler. sampling is taken at hook events while
+  /// running. (see sampling_profiler)
+  sampling_profiler& profiler() { return profiler_; }
+
+  /// @brief start function profiler. Call and return hooks are enabled while
+  /// running. (see function_profiler)
+  void start_function_profile() {
+    function_profiler_.start();
+    update_hook_mask();
+  }
+  /// @brief stop function profiler. result is kept until next start
+  void stop_function_profile() {
+    function_profiler_.stop();
+    update_hook_mask();
+  }
+  /// @brief get function profiler result
+  const function_profiler& function_profile() const {
+    return function_profiler_;
+  }
+
+  /// @brief start allocation profiler. Allocator of debug target is wrapped
+  /// until stop or detach. (see allocation_profiler)
+  void start_alloc_profile() {
+    if (state_) {
+      alloc_profiler_.start(state_);
+      update_hook_mask();
+    }
+  }
+  /// @brief stop allocation profiler and restore allocator. result is kept
+  void stop_alloc_profile() {
+    if (alloc_profiler_.running()) {
+      set_alloc_running_thread(0);
+      alloc_profiler_.stop();
+      update_hook_mask();
+    }
+  }
+  /// @brief get allocation profiler result
+  const allocation_profiler& alloc_profile() const { return alloc_profiler_; }
+
+  /// @brief walk object graph of debug target and write snapshot.
+  /// Call in pause handler or request of server, graph is walked on current
+  /// thread. Temporary memory grows with number of objects and edges.
+  /// (see heap_snapshot)
+  void take_heap_snapshot(heap_snapshot& snapshot,
+                          heap_snapshot::writer_type writer) {
+    if (lua_State* L = heap_walk_state()) {
+      snapshot.take(L, writer);
+    }
+  }
+  /// @brief take baseline of heap_diff. (see take_heap_snapshot)
+  void take_heap_baseline(heap_diff& diff) {
+    if (lua_State* L = heap_walk_state()) {
+      diff.take_baseline(L);
+    }
+  }
+  /// @brief objects added since baseline. (see take_heap_snapshot)
+  /// @param max_groups max size of result
+  std::vector<heap_diff::growth> heap_growth(heap_diff& diff,
+                                             size_t max_groups = 20) {
+    if (lua_State* L = heap_walk_state()) {
+      return diff.diff(L, max_groups);
+    }
+    return std::vector<heap_diff::growth>();
+  }
+
+  /// @brief start line coverage recording. Line hook is enabled in functions
+  /// that have not executed lines. (see line_coverage)
+  void start_coverage() {
+    coverage_.start();
+    update_hook_mask();
+  }
+  /// @brief stop line coverage recording. result is kept
+  void stop_coverage() {
+    coverage_.stop();
+    update_hook_mask();
+  }
+  /// @brief get line coverage
+  line_coverage& coverage() { return coverage_; }
+
+  /// @brief start counting executed lines of file. Line hook is enabled in
+  /// functions of the file. counts are kept until clear_line_counts
+  /// @param file filename. matched same as breakpoints
+  void start_line_counts(const std::string& file) {
+    int path_id = file_path_id(normalize_file_path(file.c_str()));
+    counting_paths_.insert(path_id);
+    line_counts_[path_id];
+    update_line_counts_cache();
+    update_hook_mask();
+  }
+  /// @brief stop counting executed lines of file. counts are kept
+  void stop_line_counts(const std::string& file) {
+    counting_paths_.erase(file_path_id(normalize_file_path(file.c_str())));
+    update_line_counts_cache();
+    update_hook_mask();
+  }
+  /// @brief stop counting and remove counts of all files
+  void clear_line_counts() {
+    line_counts_.clear();
+    counting_paths_.clear();
+    update_line_counts_cache();
+    update_hook_mask();
+  }
+  /// @brief get executed counts of file
+  /// @return executed counts indexed by line number. empty if not counted
+  const std::vector<size_t>& line_counts(const std::string& file) {
+    static const std::vector<size_t> empty;
+    line_counts_type::const_iterator it =
+        line_counts_.find(file_path_id(normalize_file_path(file.c_str())));
+    return it != line_counts_.end() ? it->second : empty;
+  }
+
   /// @brief set pause handler. callback at paused by pause,step,breakpoint.
   /// If want continue pause,execute the loop so as not to return.
   ///  e.g. basic_server::init
@@ -698,12 +1485,40 @@ class debugger {
       }
     }
   }
+  /// @brief remove hook until resume_hook. breakpoints and step state are
+  /// kept. Debug target runs without any hook overhead.
+  void suspend_hook() {
+    hook_suspended_ = true;
+    if (state_) {
+      lua_sethook(state_, 0, 0, 0);
+    }
+  }
+  /// @brief install hook removed by suspend_hook.
+  /// It can be called from other thread. (lua_sethook is async safe)
+  /// Hook mask is fixed up at first hook event. Coroutines created while
+  /// suspended are found by walking object graph at the first hook event,
+  /// except ones referenced only by temporaries.
+  void resume_hook() {
+    rehook_threads_ = true;
+    hook_suspended_ = false;
+    if (state_) {
+      lua_sethook(state_, &hook_function, LUA_MASKLINE | LUA_MASKCOUNT,
+                  idle_hook_count_);
+    }
+  }
+  /// @brief hook is suspended
+  bool hook_suspended() const { return hook_suspended_; }
+
   /// @brief pause
-  void pause() { step_type_ = STEP_PAUSE; }
+  void pause() {
+    step_type_ = STEP_PAUSE;
+    update_hook_mask();
+  }
   /// @brief unpause(continue)
   void unpause() {
     pause_ = false;
     step_type_ = STEP_NONE;
+    update_hook_mask();
   }
   /// @brief paused
   /// @return If paused, return true. Otherwise return false.
@@ -738,18 +1553,21 @@ class debugger {
     step_type_ = STEP_OVER;
     step_callstack_size_ = get_call_stack().size();
     pause_ = false;
+    update_hook_mask();
   }
   /// @brief step in
   void step_in() {
     step_type_ = STEP_IN;
     step_callstack_size_ = get_call_stack().size();
     pause_ = false;
+    update_hook_mask();
   }
   /// @brief step out
   void step_out() {
     step_type_ = STEP_OUT;
     step_callstack_size_ = get_call_stack().size();
     pause_ = false;
+    update_hook_mask();
   }
   /// @brief get call stack info
   /// @return array of call stack information
@@ -775,17 +1593,124 @@ class debugger {
     lua_pop(state_, 1);  // pop global table
     return v;
   }
+  /// @brief write global table as json
+  void get_global_table(json_writer& writer, int object_depth = 1) {
+    lua_pushglobaltable(state_);
+    utility::write_json(writer, state_, -1, object_depth);
+    lua_pop(state_, 1);  // pop global table
+  }
+  /// @brief write global table as handle of references
+  void get_global_table(json_writer& writer, variable_references& references) {
+    lua_pushglobaltable(state_);
+    references.write(writer, state_, -1);
+    lua_pop(state_, 1);  // pop global table
+  }
+
+  /// @brief get variable references of current pause. handles are released
+  /// when pause handler returned
+  variable_references& references() { return references_; }
+  /// @brief write children of handle. (see variable_references)
+  /// @param reference handle
+  /// @param start number of children to skip
+  /// @param count max number of children
+  /// @return false if handle is not pinned
+  bool get_children(json_writer& writer, int reference, size_t start = 0,
+                    size_t count = size_t(-1)) {
+    lua_State* L = heap_walk_state();
+    return L && references_.write_children(writer, L, reference, start, count);
+  }
 
  private:
   void sethook() {
     lua_pushlightuserdata(state_, this_data_key());
     lua_pushlightuserdata(state_, this);
     lua_rawset(state_, LUA_REGISTRYINDEX);
-    lua_sethook(state_, &hook_function,
-                LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE, 0);
+    update_hook_mask();
+  }
+  /// line hook is only required by breakpoints, stepping and pausing.
+  /// otherwise count hook is enough for calling tick handler.
+  /// With breakpoints only, call and return hook decide line hook per
+  /// function. (see sync_hook_mask)
+  int required_hook_mask() const {
+    int mask = LUA_MASKCOUNT;
+    if (pause_ || step_type_ != STEP_NONE) {
+      mask = LUA_MASKLINE;
+    } else if (has_line_hook_targets()) {
+      mask = LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE | LUA_MASKCOUNT;
+    }
+    if (function_profiler_.running() || alloc_profiler_.running()) {
+      mask |= LUA_MASKCALL | LUA_MASKRET;
+    }
+    return mask;
+  }
+  /// line hook is required in some functions
+  bool has_line_hook_targets() const {
+    return !line_breakpoints_.empty() || coverage_.running() ||
+           !counting_paths_.empty();
+  }
+  /// line hook is decided per function by breakpoints, coverage and line
+  /// counts
+  bool line_hook_filtered() const {
+    return !pause_ && step_type_ == STEP_NONE && has_line_hook_targets();
+  }
+  template <typename DebugInfo>
+  bool line_hook_required(DebugInfo& info) {
+    return function_line_hook_required(info) ||
+           (coverage_.running() && coverage_.line_hook_required(info));
+  }
+  void update_hook_mask() {
+    hook_mask_ = required_hook_mask();
+    hook_mask_dirty_ = true;
+    if (state_ && !hook_suspended_) {
+      lua_sethook(state_, &hook_function, hook_mask_, idle_hook_count_);
+    }
+  }
+  static bool is_call_or_return_event(int event) {
+#if LUA_VERSION_NUM >= 502
+    if (event == LUA_HOOKTAILCALL) {
+      return true;
+    }
+#else
+    if (event == LUA_HOOKTAILRET) {
+      return true;
+    }
+#endif
+    return event == LUA_HOOKCALL || event == LUA_HOOKRET;
+  }
+  /// hook is per thread(coroutine). Every thread has line or count hook,
+  /// so that thread follow to mask change at next hook event.
+  void sync_hook_mask(lua_State* L, int event) {
+    if (hook_suspended_) {
+      lua_sethook(L, 0, 0, 0);
+      return;
+    }
+    int mask = hook_mask_;
+    if (line_hook_filtered()) {
+      if (!is_call_or_return_event(event)) {
+        // keep line hook state decided at function call or return
+        if (!hook_mask_dirty_ &&
+            (lua_gethookmask(L) | LUA_MASKLINE) == hook_mask_) {
+          return;
+        }
+        line_hook_required_ = line_hook_required(current_debug_info_);
+      }
+      if (!line_hook_required_) {
+        mask &= ~LUA_MASKLINE;
+      }
+    }
+    hook_mask_dirty_ = false;
+    if (lua_gethookmask(L) != mask ||
+        lua_gethookcount(L) != idle_hook_count_) {
+      lua_sethook(L, &hook_function, mask, idle_hook_count_);
+    }
   }
   void unsethook() {
     if (state_) {
+      stop_alloc_profile();
+      for (size_t i = 0; i < line_breakpoints_.size(); ++i) {
+        release_condition(line_breakpoints_[i]);
+      }
+      references_.clear(state_);
       lua_sethook(state_, 0, 0, 0);
       lua_pushlightuserdata(state_, this_data_key());
       lua_pushnil(state_);
@@ -797,60 +1722,278 @@ class debugger {
   debugger& operator=(const debugger&);  //=delete;
 
   static bool is_path_separator(char c) { return c == '\\' || c == '/'; }
-  static bool is_file_path_match(const char* path1, const char* path2) {
-    while (true) {
-      // skip './'
-      if (*path1 == '.' && is_path_separator(*(path1 + 1))) {
-        path1 += 2;
-        continue;
-      }
-      if (*path2 == '.' && is_path_separator(*(path2 + 1))) {
-        path2 += 2;
+  /// normalize for path compare. skip './' and unify path separator
+  static std::string normalize_file_path(const char* path) {
+    std::string ret;
+    while (*path) {
+      if (*path == '.' && is_path_separator(*(path + 1))) {
+        path += 2;
         continue;
       }
+      ret.push_back(is_path_separator(*path) ? '/' : *path);
+      path++;
+    }
+    return ret;
+  }
+  int file_path_id(const std::string& normalized_path) {
+    std::unordered_map<std::string, int>::iterator it =
+        file_path_ids_.find(normalized_path);
+    if (it != file_path_ids_.end()) {
+      return it->second;
+    }
+    int id = static_cast<int>(file_path_ids_.size());
+    file_path_ids_[normalized_path] = id;
+    return id;
+  }
+  /// @brief leading bytes of chunk source kept to detect address reuse.
+  /// whole source is kept when shorter, it is almost file name.
+  static const size_t SOURCE_HEAD_SIZE = 64;
+  /// @brief bound of cached sources, cleared all when exceeded.
+  static const size_t MAX_SOURCE_CACHE = 1024;
+  /// @brief bound of cached function decisions, cleared all when exceeded.
+  static const size_t MAX_FUNCTION_HOOK_CACHE = 8192;
+  struct source_cache_entry {
+    source_cache_entry() : path_id(-1), line_counts(0), serial(0) {}
+    std::string source_head;
+    int path_id;
+    std::vector<size_t>* line_counts;  /// counts if counting file
+    unsigned serial;                   /// changed when source is reassigned
 
-      if ((*path1 != *path2) &&
-          (!is_path_separator(*path1) || !is_path_separator(*path2))) {
+    bool matches(const char* source) const {
+      if (source_head.empty()) {
         return false;
       }
-      if (*path1 == '\0') {
-        return true;
-      }
-      path1++;
-      path2++;
+      // compare with terminator when whole source is kept
+      size_t n = source_head.size() < SOURCE_HEAD_SIZE
+                     ? source_head.size() + 1
+                     : SOURCE_HEAD_SIZE;
+      return strncmp(source_head.c_str(), source, n) == 0;
+    }
+  };
+  /// @brief get path id of chunk source.
+  /// source string is owned by function prototype, then cache by pointer.
+  /// keep source head for detect address reuse after collected.
+  int source_path_id(const char* source) {
+    return source_entry(source).path_id;
+  }
+  source_cache_entry& source_entry(const char* source) {
+    std::unordered_map<const void*, source_cache_entry>::iterator it =
+        source_cache_.find(source);
+    if (it != source_cache_.end() && it->second.matches(source)) {
+      return it->second;
+    }
+    if (it == source_cache_.end() &&
+        source_cache_.size() >= MAX_SOURCE_CACHE) {
+      clear_source_cache();
+    }
+    source_cache_entry& entry = source_cache_[source];
+    entry.source_head.assign(source, strnlen(source, SOURCE_HEAD_SIZE));
+    entry.serial = ++source_serial_;
+    // remove front @
+    entry.path_id = file_path_id(
+        normalize_file_path(source[0] == '@' ? source + 1 : source));
+    entry.line_counts = counting_line_counts(entry.path_id);
+    return entry;
+  }
+  void clear_source_cache() {
+    function_hook_cache_.clear();
+    source_cache_.clear();
+  }
+  /// @brief function prototype identified by source and defined lines
+  struct function_hook_key {
+    const void* source;
+    int linedefined;
+    int lastlinedefined;
+    bool operator==(const function_hook_key& other) const {
+      return source == other.source && linedefined == other.linedefined &&
+             lastlinedefined == other.lastlinedefined;
+    }
+  };
+  struct function_hook_key_hash {
+    size_t operator()(const function_hook_key& key) const {
+      return std::hash<const void*>()(key.source) ^
+             (std::hash<int>()(key.linedefined) * 31) ^
+             (std::hash<int>()(key.lastlinedefined) * 961);
+    }
+  };
+  /// @brief line hook decision of breakpoints and line counts.
+  /// valid while source entry is not reassigned.
+  struct function_hook_entry {
+    const source_cache_entry* source;
+    unsigned serial;
+    bool required;
+  };
+  std::vector<size_t>* counting_line_counts(int path_id) {
+    if (counting_paths_.count(path_id) == 0) {
+      return 0;
+    }
+    return &line_counts_[path_id];
+  }
+  void update_line_counts_cache() {
+    for (auto& entry : source_cache_) {
+      entry.second.line_counts = counting_line_counts(entry.second.path_id);
+    }
+    function_hook_cache_.clear();
+    current_line_counts_stale_ = true;
+  }
+  /// @brief function is in line counting file
+  template <typename DebugInfo>
+  bool has_line_counts_in_function(DebugInfo& info) {
+    return !counting_paths_.empty() && strcmp(info.what(), "C") != 0 &&
+           source_entry(info.source()).line_counts;
+  }
+  /// @brief resolve counts of running function at call and return, so that
+  /// line event only index it
+  template <typename DebugInfo>
+  void resolve_line_counts(DebugInfo& info) {
+    current_line_counts_ = has_line_counts_in_function(info)
+                               ? source_entry(info.source()).line_counts
+                               : 0;
+    current_line_counts_stale_ = false;
+  }
+  void count_line(debug_info& info) {
+    if (current_line_counts_stale_) {
+      resolve_line_counts(info);
+    }
+    std::vector<size_t>* counts = current_line_counts_;
+    int line = info.currentline();
+    if (!counts || line < 0) {
+      return;
+    }
+    if (counts->size() <= size_t(line)) {
+      counts->resize(line + 1);
+    }
+    (*counts)[line]++;
+  }
+  void rebuild_breakpoint_index() {
+    breakpoint_index_.clear();
+    breakpoint_lines_.clear();
+    // drop sources of collected chunks
+    clear_source_cache();
+    for (size_t i = 0; i < line_breakpoints_.size(); ++i) {
+      const breakpoint_info& b = line_breakpoints_[i];
+      int path_id = file_path_id(normalize_file_path(b.file.c_str()));
+      breakpoint_index_[b.line].push_back(std::make_pair(path_id, i));
+      breakpoint_lines_[path_id].push_back(b.line);
+    }
+    for (breakpoint_lines_type::iterator it = breakpoint_lines_.begin();
+         it != breakpoint_lines_.end(); ++it) {
+      std::sort(it->second.begin(), it->second.end());
     }
   }
+  /// @brief function contains any breakpoint line of path.
+  /// function is identified by source and defined line range.
+  template <typename DebugInfo>
+  bool has_breakpoint_in_function(DebugInfo& info, int path_id) {
+    breakpoint_lines_type::const_iterator lines =
+        breakpoint_lines_.find(path_id);
+    if (lines == breakpoint_lines_.end()) {
+      return false;
+    }
+    if (strcmp(info.what(), "main") == 0) {
+      return true;
+    }
+    std::vector<int>::const_iterator line = std::lower_bound(
+        lines->second.begin(), lines->second.end(), info.linedefined());
+    return line != lines->second.end() && *line <= info.lastlinedefined();
+  }
+  /// @brief breakpoints or line counts require line hook in function.
+  /// decided once per function prototype until breakpoints or counting
+  /// files change.
+  template <typename DebugInfo>
+  bool function_line_hook_required(DebugInfo& info) {
+    if (breakpoint_lines_.empty() && counting_paths_.empty()) {
+      return false;
+    }
+    if (strcmp(info.what(), "C") == 0) {
+      return false;
+    }
+    const char* source = info.source();
+    function_hook_key key = {source, info.linedefined(),
+                             info.lastlinedefined()};
+    function_hook_cache_type::iterator it = function_hook_cache_.find(key);
+    if (it != function_hook_cache_.end() &&
+        it->second.source->serial == it->second.serial &&
+        it->second.source->matches(source)) {
+      return it->second.required;
+    }
+    if (it == function_hook_cache_.end() &&
+        function_hook_cache_.size() >= MAX_FUNCTION_HOOK_CACHE) {
+      function_hook_cache_.clear();
+    }
+    const source_cache_entry& entry = source_entry(source);
+    function_hook_entry& cached = function_hook_cache_[key];
+    cached.source = &entry;
+    cached.serial = entry.serial;
+    cached.required = entry.line_counts ||
+                      has_breakpoint_in_function(info, entry.path_id);
+    return cached.required;
+  }
 
   breakpoint_info* search_breakpoints(debug_info& debuginfo) {
-    if (line_breakpoints_.empty()) {
+    if (breakpoint_index_.empty()) {
       return 0;
     }
-    int currentline = debuginfo.currentline();
-    for (line_breakpoint_type::iterator it = line_breakpoints_.begin();
-         it != line_breakpoints_.end(); ++it) {
-      if (currentline == it->line) {
-        const char* source = debuginfo.source();
-        if (!source) {
-          continue;
-        }
-        // remove front @
-        if (source[0] == '@') {
-          source++;
-        }
-        if (is_file_path_match(it->file.c_str(), source)) {
-          return &(*it);
-        }
+    breakpoint_index_type::const_iterator bucket =
+        breakpoint_index_.find(debuginfo.currentline());
+    if (bucket == breakpoint_index_.end()) {
+      return 0;
+    }
+    const char* source = debuginfo.source();
+    if (!source) {
+      return 0;
+    }
+    int path_id = source_path_id(source);
+    for (size_t i = 0; i < bucket->second.size(); ++i) {
+      if (bucket->second[i].first == path_id) {
+        return &line_breakpoints_[bucket->second[i].second];
       }
     }
     return 0;
   }
-  bool breakpoint_cond(const breakpoint_info& breakpoint,
-                       debug_info& debuginfo) {
-    if (!breakpoint.condition.empty()) {
-      json::array condret = debuginfo.eval(breakpoint.condition.c_str());
-      return !condret.empty() && condret[0].evaluate_as_boolean();
+  /// @brief compile condition once and keep chunk in registry
+  static void compile_condition(lua_State* L, breakpoint_info& breakpoint) {
+    if (breakpoint.condition.empty() ||
+        breakpoint.condition_ref != LUA_NOREF) {
+      return;
     }
-    return true;
+    int loadstat = luaL_loadstring(
+        L, (std::string("return ") + breakpoint.condition).c_str());
+    if (loadstat != 0) {
+      lua_pop(L, 1);
+      loadstat = luaL_loadstring(L, breakpoint.condition.c_str());
+    }
+    if (loadstat != 0) {
+      lua_pop(L, 1);
+      breakpoint.condition_ref = LUA_REFNIL;
+      return;
+    }
+    breakpoint.condition_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  void release_condition(breakpoint_info& breakpoint) {
+    if (state_ && breakpoint.condition_ref != LUA_NOREF) {
+      luaL_unref(state_, LUA_REGISTRYINDEX, breakpoint.condition_ref);
+    }
+    breakpoint.condition_ref = LUA_NOREF;
+  }
+  bool breakpoint_cond(breakpoint_info& breakpoint, debug_info& debuginfo) {
+    if (breakpoint.condition.empty()) {
+      return true;
+    }
+    lua_State* L = debuginfo.state_;
+    compile_condition(L, breakpoint);
+    if (breakpoint.condition_ref == LUA_REFNIL) {
+      return true;  // break for notify invalid condition
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, breakpoint.condition_ref);
+    debuginfo.set_eval_env();
+    if (lua_pcall(L, 0, 1, 0) != 0) {
+      lua_pop(L, 1);  // pop error message
+      return true;    // break for notify error
+    }
+    bool ret = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+    return ret;
   }
   static bool is_first_cond_operators(const std::string& cond) {
     const char* ops[] = {"<", "==", ">", "%"};  //,"<=" ,">="
@@ -862,29 +2005,111 @@ class debugger {
     return false;
   }
 
-  bool breakpoint_hit_cond(const breakpoint_info& breakpoint,
-                           debug_info& debuginfo) {
-    if (!breakpoint.hit_condition.empty()) {
-      json::array condret = debuginfo.eval(
-          (std::to_string(breakpoint.hit_count) + breakpoint.hit_condition)
-              .c_str());
+  static void parse_hit_condition(breakpoint_info& breakpoint) {
+    struct {
+      const char* op;
+      breakpoint_info::hit_condition_operator type;
+    } ops[] = {
+        {"<=", breakpoint_info::HIT_COND_LESS_EQUAL},
+        {">=", breakpoint_info::HIT_COND_GREATER_EQUAL},
+        {"==", breakpoint_info::HIT_COND_EQUAL},
+        {"<", breakpoint_info::HIT_COND_LESS},
+        {">", breakpoint_info::HIT_COND_GREATER},
+        {"%", breakpoint_info::HIT_COND_MOD},
+    };
+    const std::string& cond = breakpoint.hit_condition;
+    breakpoint.hit_condition_op = breakpoint_info::HIT_COND_INVALID;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+      size_t oplen = strlen(ops[i].op);
+      if (cond.compare(0, oplen, ops[i].op) != 0) {
+        continue;
+      }
+      const char* operand = cond.c_str() + oplen;
+      char* end = 0;
+      double value = strtod(operand, &end);
+      if (end == operand) {
+        return;
+      }
+      while (isspace(static_cast<unsigned char>(*end))) {
+        end++;
+      }
+      if (*end != '\0') {
+        return;
+      }
+      breakpoint.hit_condition_op = ops[i].type;
+      breakpoint.hit_condition_value = value;
+      return;
+    }
+  }
 
-      return condret.empty() || condret[0].evaluate_as_boolean();
+  static bool breakpoint_hit_cond(const breakpoint_info& breakpoint) {
+    double count = static_cast<double>(breakpoint.hit_count);
+    double value = breakpoint.hit_condition_value;
+    switch (breakpoint.hit_condition_op) {
+      case breakpoint_info::HIT_COND_LESS:
+        return count < value;
+      case breakpoint_info::HIT_COND_LESS_EQUAL:
+        return count <= value;
+      case breakpoint_info::HIT_COND_EQUAL:
+        return count == value;
+      case breakpoint_info::HIT_COND_GREATER:
+        return count > value;
+      case breakpoint_info::HIT_COND_GREATER_EQUAL:
+        return count >= value;
+      case breakpoint_info::HIT_COND_MOD:
+        // break while remainder is not zero. zero divide is always break
+        return value == 0 || std::fmod(count, value) != 0;
+      case breakpoint_info::HIT_COND_NONE:
+      case breakpoint_info::HIT_COND_INVALID:
+        break;
     }
     return true;
   }
   void hookline() {
+    if (coverage_.running()) {
+      coverage_.hookline(current_debug_info_);
+    }
+    if (!counting_paths_.empty()) {
+      count_line(current_debug_info_);
+    }
     current_breakpoint_ = search_breakpoints(current_debug_info_);
     if (current_breakpoint_ &&
         breakpoint_cond(*current_breakpoint_, current_debug_info_)) {
       current_breakpoint_->hit_count++;
-      if (breakpoint_hit_cond(*current_breakpoint_, current_debug_info_)) {
+      if (breakpoint_hit_cond(*current_breakpoint_)) {
         pause_ = true;
       }
     }
   }
-  void hookcall() {}
-  void hookret() {}
+  void hookcall() {
+    if (!counting_paths_.empty()) {
+      resolve_line_counts(current_debug_info_);
+    }
+    if (!line_hook_filtered()) {
+      return;
+    }
+    line_hook_required_ = line_hook_required(current_debug_info_);
+  }
+  void hookret() {
+    bool filtered = line_hook_filtered();
+    if (!filtered && counting_paths_.empty()) {
+      return;
+    }
+    // returning to caller
+    stack_info caller(current_debug_info_.state_, 1);
+    if (!counting_paths_.empty()) {
+      if (caller.is_available()) {
+        resolve_line_counts(caller);
+      } else {
+        current_line_counts_ = 0;
+        current_line_counts_stale_ = false;
+      }
+    }
+    if (filtered) {
+      line_hook_required_ =
+          caller.is_available() && line_hook_required(caller);
+    }
+  }
 
   void tick() {
     if (tick_handler_) {
@@ -920,6 +2145,28 @@ class debugger {
     }
   }
   void hook(lua_State* L, lua_Debug* ar) {
+    if (hook_suspended_) {  // hook inherited by coroutine
+      lua_sethook(L, 0, 0, 0);
+      return;
+    }
+    if (rehook_threads_.exchange(false)) {
+      hook_threads(L);
+    }
+    if (profiler_.running()) {
+      profiler_.hook(L);
+    }
+    if (alloc_profiler_.running()) {
+      bool switched = alloc_profiler_.running_thread() != L;
+      if (switched) {
+        set_alloc_running_thread(L);
+      }
+      if (switched || is_call_or_return_event(ar->event)) {
+        alloc_profiler_.hook(L, ar);
+      }
+    }
+    if (function_profiler_.running() && is_call_or_return_event(ar->event)) {
+      function_profiler_.hook(L, ar);
+    }
     current_debug_info_.assign(L, ar);
     current_breakpoint_ = 0;
     tick();
@@ -932,6 +2179,10 @@ class debugger {
       hookline();
     } else if (ar->event == LUA_HOOKCALL) {
       hookcall();
+#if LUA_VERSION_NUM >= 502
+    } else if (ar->event == LUA_HOOKTAILCALL) {
+      hookcall();
+#endif
     } else if (ar->event == LUA_HOOKRET) {
       hookret();
     }
@@ -941,7 +2192,50 @@ class debugger {
       if (step_type_ == STEP_NONE) {
         pause_ = false;
       }
+      debug_info::clear_eval_env_cache(L);
+      references_.clear(L);
+      update_hook_mask();
+    }
+    sync_hook_mask(L, ar->event);
+  }
+  /// running thread is referenced from registry, so that it is alive while
+  /// allocation profiler look its stack.
+  /// @param L running thread. null is release reference
+  void set_alloc_running_thread(lua_State* L) {
+    lua_State* target = L ? L : state_;
+    lua_pushlightuserdata(target, alloc_running_thread_key());
+    if (L) {
+      lua_pushthread(L);
+    } else {
+      lua_pushnil(target);
     }
+    lua_rawset(target, LUA_REGISTRYINDEX);
+    alloc_profiler_.set_running_thread(target);
+  }
+  /// @brief install hook to threads that have no hook. hook mask is fixed
+  /// up at first hook event of each thread.
+  void hook_threads(lua_State* L) {
+    heap_walker walker(
+        [&](const heap_walker::node& n) {
+          if (n.type != LUA_TTHREAD) {
+            return;
+          }
+          lua_State* co =
+              static_cast<lua_State*>(const_cast<void*>(n.pointer));
+          if (co != L && lua_gethook(co) != &hook_function) {
+            lua_sethook(co, &hook_function, LUA_MASKLINE | LUA_MASKCOUNT,
+                        idle_hook_count_);
+          }
+        },
+        [](uint32_t, uint32_t, const std::string&) {});
+    walker.walk(L);
+  }
+  lua_State* heap_walk_state() {
+    return current_debug_info_.state_ ? current_debug_info_.state_ : state_;
+  }
+  static void* alloc_running_thread_key() {
+    static int key_data = 0;
+    return &key_data;
   }
   static void* this_data_key() {
     static int key_data = 0;
@@ -952,9 +2246,19 @@ class debugger {
 
     debugger* self = static_cast<debugger*>(lua_touserdata(L, -1));
     lua_pop(L, 1);
+    if (!self) {  // detached. remove hook inherited by coroutine
+      lua_sethook(L, 0, 0, 0);
+      return;
+    }
     self->hook(L, ar);
   }
 
+  /// line number to pair of path id and index of line_breakpoints_
+  typedef std::unordered_map<int, std::vector<std::pair<int, size_t> > >
+      breakpoint_index_type;
+  /// path id to sorted breakpoint lines
+  typedef std::unordered_map<int, std::vector<int> > breakpoint_lines_type;
+
   enum step_type {
     STEP_NONE,
     STEP_OVER,
@@ -969,11 +2273,38 @@ class debugger {
   //  bool error_break_;
   step_type step_type_;
   size_t step_callstack_size_;
+  int hook_mask_;
+  bool hook_mask_dirty_;
+  bool line_hook_required_;
+  int idle_hook_count_;
+  std::atomic<bool> hook_suspended_;
+  std::atomic<bool> rehook_threads_;  /// hook threads at next hook event
   debug_info current_debug_info_;
   line_breakpoint_type line_breakpoints_;
+  breakpoint_index_type breakpoint_index_;
+  breakpoint_lines_type breakpoint_lines_;
+  std::unordered_map<std::string, int> file_path_ids_;
+  std::unordered_map<const void*, source_cache_entry> source_cache_;
+  unsigned source_serial_;
+  typedef std::unordered_map<function_hook_key, function_hook_entry,
+                             function_hook_key_hash>
+      function_hook_cache_type;
+  function_hook_cache_type function_hook_cache_;
   breakpoint_info* current_breakpoint_;
   pause_handler_type pause_handler_;
   tick_handler_type tick_handler_;
+  sampling_profiler profiler_;
+  function_profiler function_profiler_;
+  line_coverage coverage_;
+  allocation_profiler alloc_profiler_;
+  variable_references references_;
+  /// path id to executed counts indexed by line number
+  typedef std::unordered_map<int, std::vector<size_t> > line_counts_type;
+  line_counts_type line_counts_;
+  std::unordered_set<int> counting_paths_;
+  /// counts of running function. resolved at call and return
+  std::vector<size_t>* current_line_counts_;
+  bool current_line_counts_stale_;
 };
 }  // namespace lrdb
 
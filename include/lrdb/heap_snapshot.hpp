@@ -0,0 +1,682 @@
+#pragma once
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+namespace lrdb {
+
+/// @brief walk Lua object graph in breadth first order.
+/// Roots are globals, registry and current thread. Traverse table keys,
+/// values and metatable, function upvalues, userdata metatable and user
+/// value, and named local variables and functions of thread stack frames.
+/// Objects are numbered from 1 in visit order, 0 is virtual root.
+/// Garbage collector is stopped while walking, so visited objects are
+/// identified by address on C++ side. Only queued objects are referenced
+/// from a Lua array until they are visited.
+class heap_walker {
+ public:
+  /// max length of label and edge name
+  static const size_t MAX_NAME_LENGTH = 64;
+
+  struct node {
+    uint32_t id;
+    int type;            /// LUA_TTABLE, LUA_TSTRING, etc.
+    size_t shallow_size; /// estimated from entry counts
+    const void* pointer; /// address. string data for string
+    std::string label;   /// head of string
+  };
+  typedef std::function<void(const node&)> node_handler_type;
+  typedef std::function<void(uint32_t from, uint32_t to, const std::string&)>
+      edge_handler_type;
+
+  heap_walker(node_handler_type node_handler, edge_handler_type edge_handler)
+      : node_handler_(node_handler), edge_handler_(edge_handler) {}
+
+  /// @brief walk object graph
+  /// @param L running thread
+  void walk(lua_State* L) {
+    L_ = L;
+    lua_checkstack(L, 8);
+    bool gc_running = true;
+#if LUA_VERSION_NUM >= 502
+    gc_running = lua_gc(L, LUA_GCISRUNNING, 0) != 0;
+#endif
+    lua_gc(L, LUA_GCSTOP, 0);
+
+    visited_.clear();
+    lua_newtable(L);
+    queue_ = lua_gettop(L);
+    next_id_ = 1;
+
+    node root;
+    root.id = 0;
+    root.type = LUA_TNONE;
+    root.shallow_size = 0;
+    root.pointer = 0;
+    node_handler_(root);
+#if LUA_VERSION_NUM >= 502
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#else
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+#endif
+    edge(0, "globals");
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    edge(0, "registry");
+    lua_pushthread(L);
+    edge(0, "current_thread");
+
+    for (uint32_t id = 1; id < next_id_; ++id) {
+      lua_rawgeti(L, queue_, id);
+      visit(id);
+      lua_pop(L, 1);
+      lua_pushnil(L);
+      lua_rawseti(L, queue_, id);  // release
+    }
+    lua_pop(L, 1);  // pop queue
+    visited_map().swap(visited_);  // release before retained size pass
+    if (gc_running) {
+      lua_gc(L, LUA_GCRESTART, 0);
+    }
+  }
+
+  /// @brief edge names in a path are joined by '.', except "[...]"
+  static void append_path(std::string& path, const std::string& name) {
+    if (!path.empty() && name[0] != '[') {
+      path += '.';
+    }
+    path += name;
+  }
+
+  /// @brief escape for line based format. '\\', '\n' and '\r' are escaped
+  static std::string escape(const char* str, size_t len) {
+    std::string ret;
+    for (size_t i = 0; i < len && i < MAX_NAME_LENGTH; ++i) {
+      switch (str[i]) {
+        case '\\':
+          ret += "\\\\";
+          break;
+        case '\n':
+          ret += "\\n";
+          break;
+        case '\r':
+          ret += "\\r";
+          break;
+        default:
+          ret += str[i];
+      }
+    }
+    return ret;
+  }
+
+ private:
+  heap_walker(const heap_walker&);             //=delete;
+  heap_walker& operator=(const heap_walker&);  //=delete;
+
+  static bool is_object(int type) {
+    return type == LUA_TTABLE || type == LUA_TFUNCTION ||
+           type == LUA_TUSERDATA || type == LUA_TTHREAD ||
+           type == LUA_TSTRING;
+  }
+  /// @brief get id of object at stack top. new object is queued.
+  /// @return id. 0 if not object
+  uint32_t intern() {
+    int index = lua_gettop(L_);
+    if (!is_object(lua_type(L_, index))) {
+      return 0;
+    }
+    const void* address = lua_type(L_, index) == LUA_TSTRING
+                              ? lua_tostring(L_, index)
+                              : lua_topointer(L_, index);
+    std::pair<visited_map::iterator, bool> inserted =
+        visited_.insert(std::make_pair(address, next_id_));
+    if (!inserted.second) {
+      return inserted.first->second;
+    }
+    uint32_t id = next_id_++;
+    lua_pushvalue(L_, index);
+    lua_rawseti(L_, queue_, id);
+    return id;
+  }
+  /// @brief edge to object at stack top, and pop it
+  void edge(uint32_t from, const std::string& name) {
+    uint32_t to = intern();
+    lua_pop(L_, 1);
+    if (to != 0) {
+      edge_handler_(from, to, name);
+    }
+  }
+  std::string key_name(int index) {
+    int type = lua_type(L_, index);
+    if (type == LUA_TSTRING) {
+      size_t len = 0;
+      const char* str = lua_tolstring(L_, index, &len);
+      return escape(str, len);
+    } else if (type == LUA_TNUMBER) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "[%.14g]", lua_tonumber(L_, index));
+      return buf;
+    } else if (type == LUA_TBOOLEAN) {
+      return lua_toboolean(L_, index) ? "[true]" : "[false]";
+    }
+    return std::string("[") + lua_typename(L_, type) + "]";
+  }
+  /// visit object at stack top
+  void visit(uint32_t id) {
+    int index = lua_gettop(L_);
+    node n;
+    n.id = id;
+    n.type = lua_type(L_, index);
+    n.shallow_size = 0;
+    n.pointer = n.type == LUA_TSTRING ? lua_tostring(L_, index)
+                                      : lua_topointer(L_, index);
+
+    switch (n.type) {
+      case LUA_TSTRING: {
+        size_t len = 0;
+        const char* str = lua_tolstring(L_, index, &len);
+        n.shallow_size = 24 + len + 1;
+        n.label = escape(str, len);
+        node_handler_(n);
+        break;
+      }
+      case LUA_TTABLE: {
+        size_t entries = 0;
+        lua_pushnil(L_);
+        while (lua_next(L_, index)) {
+          entries++;
+          lua_pop(L_, 1);
+        }
+        n.shallow_size = 56 + entries * 32;
+        node_handler_(n);
+        visit_metatable(id, index);
+        lua_pushnil(L_);
+        while (lua_next(L_, index)) {
+          std::string name = key_name(-2);
+          edge(id, name);  // value
+          lua_pushvalue(L_, -1);
+          edge(id, "(key)");
+        }
+        break;
+      }
+      case LUA_TFUNCTION: {
+        int nups = 0;
+        while (lua_getupvalue(L_, index, nups + 1)) {
+          lua_pop(L_, 1);
+          nups++;
+        }
+        n.shallow_size = 32 + nups * (lua_iscfunction(L_, index) ? 16 : 48);
+        node_handler_(n);
+        for (int i = 1; i <= nups; ++i) {
+          const char* name = lua_getupvalue(L_, index, i);
+          edge(id, name && name[0] ? name : "(upvalue)");
+        }
+#if LUA_VERSION_NUM < 502
+        lua_getfenv(L_, index);
+        edge(id, "(environment)");
+#endif
+        break;
+      }
+      case LUA_TUSERDATA: {
+#if LUA_VERSION_NUM >= 502
+        n.shallow_size = 40 + lua_rawlen(L_, index);
+#else
+        n.shallow_size = 40 + lua_objlen(L_, index);
+#endif
+        node_handler_(n);
+        visit_metatable(id, index);
+#if LUA_VERSION_NUM >= 502
+        lua_getuservalue(L_, index);
+#else
+        lua_getfenv(L_, index);
+#endif
+        edge(id, "(uservalue)");
+        break;
+      }
+      case LUA_TTHREAD: {
+        lua_State* co = lua_tothread(L_, index);
+        lua_Debug ar;
+        int levels = 0;
+        while (lua_getstack(co, levels, &ar)) {
+          levels++;
+        }
+        n.shallow_size = 200 + levels * 72;
+        node_handler_(n);
+        visit_stack(id, co);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  void visit_metatable(uint32_t id, int index) {
+    if (lua_getmetatable(L_, index)) {
+      edge(id, "(metatable)");
+    }
+  }
+  /// functions and named local variables of stack frames.
+  /// temporaries are not traversed. (includes walker's own tables)
+  void visit_stack(uint32_t id, lua_State* co) {
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(co, level, &ar); ++level) {
+      std::string prefix = std::to_string(level) + ":";
+      if (co != L_) {
+        lua_checkstack(co, 2);
+      }
+      lua_getinfo(co, "f", &ar);
+      move_from(co);
+      edge(id, prefix + "(function)");
+      for (int n = 1;; ++n) {
+        const char* name = lua_getlocal(co, &ar, n);
+        if (!name) {
+          break;
+        }
+        move_from(co);
+        if (name[0] == '(') {
+          lua_pop(L_, 1);
+          continue;
+        }
+        edge(id, prefix + name);
+      }
+    }
+  }
+  void move_from(lua_State* co) {
+    if (co != L_) {
+      lua_xmove(co, L_, 1);
+    }
+  }
+
+  node_handler_type node_handler_;
+  edge_handler_type edge_handler_;
+  lua_State* L_;
+  typedef std::unordered_map<const void*, uint32_t> visited_map;
+  visited_map visited_;  /// object address to id
+  int queue_;
+  uint32_t next_id_;
+};
+
+/// @brief heap snapshot with retained sizes.
+/// Written in line based text format by chunks.
+///  N <id> <type> <shallow size> [<label>]
+///  E <from id> <to id> <edge name>
+///  R <id> <retained size>
+/// All N and E lines come first in id order, then R lines. Edge name and
+/// label are rest of line, escaped by heap_walker::escape.
+/// Graph is kept as compact arrays to compute dominator tree, and write
+/// retained sizes. (about 40 bytes per object and 8 bytes per edge)
+/// Memory is not bounded. Dominator tree needs whole graph, so that
+/// walker's visited map and queue, and the graph arrays grow with heap.
+/// Nodes and edges are streamed to writer, and visited map is released
+/// before retained sizes are computed.
+class heap_snapshot {
+ public:
+  typedef std::function<void(const std::string& chunk)> writer_type;
+
+  /// @param chunk_size size of text passed to writer at once
+  heap_snapshot(size_t chunk_size = 64 * 1024)
+      : chunk_size_(chunk_size), total_size_(0) {}
+
+  /// @brief take snapshot
+  /// @param L running thread
+  /// @param writer output for text chunks
+  void take(lua_State* L, writer_type writer) {
+    writer_ = writer;
+    clear();
+    buffer_.reserve(chunk_size_ + 256);
+    heap_walker walker(
+        [&](const heap_walker::node& n) {
+          shallow_sizes_.push_back(n.shallow_size);
+          edge_offsets_.push_back(uint32_t(edge_targets_.size()));
+          total_size_ += n.shallow_size;
+          buffer_ += "N " + std::to_string(n.id) + " " + type_name(L, n.type) +
+                     " " + std::to_string(n.shallow_size);
+          if (!n.label.empty()) {
+            buffer_ += " " + n.label;
+          }
+          buffer_ += '\n';
+          flush_if_needed();
+        },
+        [&](uint32_t from, uint32_t to, const std::string& name) {
+          edge_targets_.push_back(to);
+          buffer_ += "E " + std::to_string(from) + " " + std::to_string(to) +
+                     " " + name + "\n";
+          flush_if_needed();
+        });
+    walker.walk(L);
+    edge_offsets_.push_back(uint32_t(edge_targets_.size()));
+
+    std::vector<uint64_t> retained = retained_sizes();
+    for (size_t id = 0; id < retained.size(); ++id) {
+      buffer_ += "R " + std::to_string(id) + " " +
+                 std::to_string(retained[id]) + "\n";
+      flush_if_needed();
+    }
+    flush();
+    edge_count_ = edge_targets_.size();
+    clear_graph();
+  }
+
+  /// @brief number of objects in last snapshot. includes virtual root
+  size_t node_count() const { return node_count_; }
+  /// @brief number of edges in last snapshot
+  size_t edge_count() const { return edge_count_; }
+  /// @brief sum of shallow sizes in last snapshot
+  uint64_t total_size() const { return total_size_; }
+
+ private:
+  enum : uint32_t { UNDEFINED = 0xFFFFFFFFu };
+
+  static const char* type_name(lua_State* L, int type) {
+    return type == LUA_TNONE ? "root" : lua_typename(L, type);
+  }
+  void clear() {
+    clear_graph();
+    buffer_.clear();
+    total_size_ = 0;
+    node_count_ = 0;
+    edge_count_ = 0;
+  }
+  void clear_graph() {
+    node_count_ = shallow_sizes_.size();
+    std::vector<uint64_t>().swap(shallow_sizes_);
+    std::vector<uint32_t>().swap(edge_offsets_);
+    std::vector<uint32_t>().swap(edge_targets_);
+  }
+  void flush_if_needed() {
+    if (buffer_.size() >= chunk_size_) {
+      flush();
+    }
+  }
+  void flush() {
+    if (!buffer_.empty()) {
+      writer_(buffer_);
+      buffer_.clear();
+    }
+  }
+
+  /// dominator tree by Cooper, Harvey and Kennedy's iterative algorithm
+  std::vector<uint64_t> retained_sizes() {
+    const uint32_t count = uint32_t(shallow_sizes_.size());
+    // reverse post order by depth first search from root
+    std::vector<uint32_t> postorder_number(count, UNDEFINED);
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    {
+      std::vector<uint32_t> visiting(count, 0);  /// next edge index + 1
+      std::vector<uint32_t> stack;
+      stack.push_back(0);
+      visiting[0] = 1;
+      while (!stack.empty()) {
+        uint32_t node = stack.back();
+        uint32_t edge = edge_offsets_[node] + visiting[node] - 1;
+        if (edge < edge_offsets_[node + 1]) {
+          visiting[node]++;
+          uint32_t to = edge_targets_[edge];
+          if (visiting[to] == 0) {
+            visiting[to] = 1;
+            stack.push_back(to);
+          }
+        } else {
+          postorder_number[node] = uint32_t(order.size());
+          order.push_back(node);
+          stack.pop_back();
+        }
+      }
+    }
+    // predecessors
+    std::vector<uint32_t> pred_offsets(count + 1, 0);
+    for (uint32_t to : edge_targets_) {
+      pred_offsets[to + 1]++;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      pred_offsets[i + 1] += pred_offsets[i];
+    }
+    std::vector<uint32_t> preds(edge_targets_.size());
+    {
+      std::vector<uint32_t> fill(pred_offsets.begin(), pred_offsets.end() - 1);
+      for (uint32_t from = 0; from < count; ++from) {
+        for (uint32_t e = edge_offsets_[from]; e < edge_offsets_[from + 1];
+             ++e) {
+          preds[fill[edge_targets_[e]]++] = from;
+        }
+      }
+    }
+
+    std::vector<uint32_t> idom(count, UNDEFINED);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = order.size(); i-- > 0;) {  // reverse post order
+        uint32_t node = order[i];
+        if (node == 0) {
+          continue;
+        }
+        uint32_t new_idom = UNDEFINED;
+        for (uint32_t p = pred_offsets[node]; p < pred_offsets[node + 1];
+             ++p) {
+          uint32_t pred = preds[p];
+          if (idom[pred] == UNDEFINED) {
+            continue;
+          }
+          new_idom = new_idom == UNDEFINED
+                         ? pred
+                         : intersect(idom, postorder_number, pred, new_idom);
+        }
+        if (idom[node] != new_idom) {
+          idom[node] = new_idom;
+          changed = true;
+        }
+      }
+    }
+
+    std::vector<uint64_t> retained(shallow_sizes_.begin(),
+                                   shallow_sizes_.end());
+    for (uint32_t node : order) {  // children first
+      if (node != 0 && idom[node] != UNDEFINED) {
+        retained[idom[node]] += retained[node];
+      }
+    }
+    return retained;
+  }
+  static uint32_t intersect(const std::vector<uint32_t>& idom,
+                            const std::vector<uint32_t>& postorder_number,
+                            uint32_t a, uint32_t b) {
+    while (a != b) {
+      while (postorder_number[a] < postorder_number[b]) {
+        a = idom[a];
+      }
+      while (postorder_number[b] < postorder_number[a]) {
+        b = idom[b];
+      }
+    }
+    return a;
+  }
+
+  size_t chunk_size_;
+  writer_type writer_;
+  std::string buffer_;
+  std::vector<uint64_t> shallow_sizes_;
+  std::vector<uint32_t> edge_offsets_;
+  std::vector<uint32_t> edge_targets_;
+  uint64_t total_size_;
+  size_t node_count_;
+  size_t edge_count_;
+};
+
+/// @brief find objects added since baseline.
+/// Baseline is kept as sorted fingerprints (address and type) of objects,
+/// and compared with objects at diff. Added objects are grouped by type
+/// and path of nearest owner that exists in baseline, with number keys
+/// collapsed to "[]". e.g. "globals.cache[]"
+/// Object at reused address with same type is not detected as added.
+class heap_diff {
+ public:
+  /// max path components from root
+  static const size_t MAX_PATH_DEPTH = 32;
+  /// max distinct edge names kept for paths. others are named "?"
+  static const size_t MAX_NAMES = 65536;
+
+  struct growth {
+    std::string path;  /// owner path
+    const char* type;  /// type name of added objects
+    size_t count;
+    uint64_t size;  /// sum of shallow sizes
+  };
+
+  heap_diff() : added_count_(0), added_size_(0), removed_count_(0) {}
+
+  /// @brief take baseline
+  /// @param L running thread
+  void take_baseline(lua_State* L) {
+    std::vector<fingerprint>().swap(baseline_);
+    heap_walker walker(
+        [&](const heap_walker::node& n) {
+          if (n.id != 0) {
+            baseline_.push_back(fingerprint(n.pointer, n.type));
+          }
+        },
+        [](uint32_t, uint32_t, const std::string&) {});
+    walker.walk(L);
+    std::sort(baseline_.begin(), baseline_.end());
+  }
+  /// @brief release baseline
+  void clear() { std::vector<fingerprint>().swap(baseline_); }
+  /// @brief number of objects in baseline
+  size_t baseline_count() const { return baseline_.size(); }
+
+  /// @brief compare objects with baseline
+  /// @param L running thread
+  /// @param max_groups max size of result
+  /// @return added objects grouped by owner path, larger size first
+  std::vector<growth> diff(lua_State* L, size_t max_groups = 20) {
+    added_count_ = 0;
+    added_size_ = 0;
+    size_t found_count = 0;
+
+    std::vector<uint32_t> parents;  /// edge that object is found first
+    std::vector<uint32_t> names;
+    std::vector<uint32_t> owners;  /// nearest object in baseline
+    std::unordered_map<std::string, uint32_t> name_ids;
+    std::vector<std::string> name_list;
+    std::map<std::pair<uint32_t, int>, growth> owner_groups;
+
+    heap_walker walker(
+        [&](const heap_walker::node& n) {
+          if (n.id == 0) {
+            parents.push_back(0);
+            names.push_back(0);
+            owners.push_back(0);
+            return;
+          }
+          if (std::binary_search(baseline_.begin(), baseline_.end(),
+                                 fingerprint(n.pointer, n.type))) {
+            found_count++;
+            owners.push_back(n.id);
+            return;
+          }
+          uint32_t owner = owners[parents[n.id]];
+          owners.push_back(owner);
+          growth& g = owner_groups[std::make_pair(owner, n.type)];
+          g.type = lua_typename(L, n.type);
+          g.count++;
+          g.size += n.shallow_size;
+          added_count_++;
+          added_size_ += n.shallow_size;
+        },
+        [&](uint32_t from, uint32_t to, const std::string& name) {
+          if (to != parents.size()) {  // already found
+            return;
+          }
+          std::string key = collapse_number_key(name);
+          auto it = name_ids.find(key);
+          if (it == name_ids.end()) {
+            if (name_list.size() >= MAX_NAMES) {
+              key = "?";
+            }
+            uint32_t name_id = static_cast<uint32_t>(name_list.size());
+            it = name_ids.insert(std::make_pair(key, name_id)).first;
+            if (it->second == name_list.size()) {
+              name_list.push_back(key);
+            }
+          }
+          parents.push_back(from);
+          names.push_back(it->second);
+        });
+    walker.walk(L);
+    removed_count_ = baseline_.size() - found_count;
+
+    std::map<std::pair<std::string, std::string>, growth> path_groups;
+    for (const auto& owner_group : owner_groups) {
+      std::vector<uint32_t> chain;
+      for (uint32_t id = owner_group.first.first;
+           id != 0 && chain.size() < MAX_PATH_DEPTH; id = parents[id]) {
+        chain.push_back(id);
+      }
+      std::string path = chain.size() == MAX_PATH_DEPTH ? "..." : "";
+      for (size_t i = chain.size(); i-- > 0;) {
+        heap_walker::append_path(path, name_list[names[chain[i]]]);
+      }
+      const growth& g = owner_group.second;
+      growth& merged = path_groups[std::make_pair(path, g.type)];
+      merged.path = path;
+      merged.type = g.type;
+      merged.count += g.count;
+      merged.size += g.size;
+    }
+    std::vector<growth> result;
+    for (const auto& g : path_groups) {
+      result.push_back(g.second);
+    }
+    std::sort(result.begin(), result.end(),
+              [](const growth& a, const growth& b) { return a.size > b.size; });
+    if (result.size() > max_groups) {
+      result.resize(max_groups);
+    }
+    return result;
+  }
+
+  /// @brief number of added objects at last diff
+  size_t added_count() const { return added_count_; }
+  /// @brief sum of shallow sizes of added objects at last diff
+  uint64_t added_size() const { return added_size_; }
+  /// @brief number of baseline objects not found at last diff
+  size_t removed_count() const { return removed_count_; }
+
+ private:
+  typedef std::pair<const void*, int> fingerprint;
+
+  static std::string collapse_number_key(const std::string& name) {
+    if (name.size() > 2 && name[0] == '[' && name[name.size() - 1] == ']' &&
+        (isdigit(static_cast<unsigned char>(name[1])) || name[1] == '-')) {
+      return "[]";
+    }
+    return name;
+  }
+
+  std::vector<fingerprint> baseline_;
+  size_t added_count_;
+  uint64_t added_size_;
+  size_t removed_count_;
+};
+}  // namespace lrdb
+
+#else
+#error Needs at least a C++11 compiler
+#endif
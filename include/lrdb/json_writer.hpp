@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "message.hpp"
+#include "picojson.h"
+
+namespace lrdb {
+namespace json {
+using namespace ::picojson;
+}
+
+/// @brief streaming JSON writer to reusable buffer.
+/// Separators between values are written automatically, and output is same
+/// format as picojson. Buffer capacity is kept by clear, so that writing
+/// next message does not allocate.
+/// e.g.
+///  writer.begin_object();
+///  writer.key("a");
+///  writer.value(1.0);
+///  writer.end_object();  // {"a":1}
+/// Same values can be written as MessagePack for binary wire format.
+/// Then containers have 32bit size header that is fixed up at end.
+class json_writer {
+ public:
+  enum format_type {
+    JSON,
+    MSGPACK,
+  };
+  json_writer(format_type format = JSON) : format_(format), after_key_(false) {}
+
+  /// @brief clear written text. capacity is kept
+  void clear() {
+    buffer_.clear();
+    containers_.clear();
+    after_key_ = false;
+  }
+  /// @brief change output format. written text is cleared
+  void set_format(format_type format) {
+    format_ = format;
+    clear();
+  }
+  format_type format() const { return format_; }
+  /// @brief written text
+  const std::string& str() const { return buffer_; }
+
+  void null_value() {
+    separator();
+    if (format_ == MSGPACK) {
+      message::msgpack::write_nil(buffer_);
+      return;
+    }
+    buffer_ += "null";
+  }
+  void value(bool b) {
+    separator();
+    if (format_ == MSGPACK) {
+      message::msgpack::write_bool(buffer_, b);
+      return;
+    }
+    buffer_ += b ? "true" : "false";
+  }
+  /// @brief number. null if not finite
+  void value(double n) {
+    separator();
+    if (format_ == MSGPACK) {
+      message::msgpack::write_number(buffer_, n);
+      return;
+    }
+    if (!std::isfinite(n)) {
+      buffer_ += "null";
+      return;
+    }
+    char buf[64];
+    double tmp;
+    snprintf(buf, sizeof(buf),
+             fabs(n) < (1ULL << 53) && modf(n, &tmp) == 0 ? "%.f" : "%.17g",
+             n);
+    buffer_ += buf;
+  }
+  void value(const char* str, size_t len) {
+    separator();
+    write_string(str, len);
+  }
+  void value(const char* str) { value(str, strlen(str)); }
+  void value(const std::string& str) { value(str.data(), str.size()); }
+  /// @brief picojson value
+  void value(const json::value& v) {
+    separator();
+    if (format_ == MSGPACK) {
+      message::msgpack::encode(v, buffer_);
+      return;
+    }
+    v.serialize(std::back_inserter(buffer_));
+  }
+  /// @brief already serialized value of same format
+  void raw_value(const std::string& data) {
+    separator();
+    buffer_ += data;
+  }
+
+  void begin_object() { begin_container('{', char(0xdf)); }
+  void end_object() { end_container('}'); }
+  void begin_array() { begin_container('[', char(0xdd)); }
+  void end_array() { end_container(']'); }
+  /// @brief object key. value must be written next
+  void key(const char* str, size_t len) {
+    separator();
+    write_string(str, len);
+    if (format_ == JSON) {
+      buffer_ += ':';
+    }
+    after_key_ = true;
+  }
+  void key(const char* str) { key(str, strlen(str)); }
+  void key(const std::string& str) { key(str.data(), str.size()); }
+
+ private:
+  struct container {
+    size_t header;  /// position of container start
+    size_t size;    /// number of values or keys
+  };
+  void begin_container(char json_begin, char msgpack_type) {
+    separator();
+    containers_.push_back(container{buffer_.size(), 0});
+    if (format_ == MSGPACK) {
+      buffer_ += msgpack_type;
+      buffer_.append(4, '\0');
+    } else {
+      buffer_ += json_begin;
+    }
+  }
+  void end_container(char json_end) {
+    if (format_ == MSGPACK) {
+      uint32_t size = uint32_t(containers_.back().size);
+      for (int i = 0; i < 4; ++i) {
+        buffer_[containers_.back().header + 1 + i] =
+            char((size >> ((3 - i) * 8)) & 0xff);
+      }
+    } else {
+      buffer_ += json_end;
+    }
+    containers_.pop_back();
+  }
+  void separator() {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (!containers_.empty()) {
+      if (format_ == JSON && containers_.back().size > 0) {
+        buffer_ += ',';
+      }
+      containers_.back().size++;
+    }
+  }
+  void write_string(const char* str, size_t len) {
+    if (format_ == MSGPACK) {
+      message::msgpack::write_str(buffer_, str, len);
+      return;
+    }
+    buffer_ += '"';
+    const char* begin = str;
+    const char* end = str + len;
+    for (const char* it = str; it != end; ++it) {
+      const char* escaped = 0;
+      char buf[7];
+      switch (*it) {
+        case '"':
+          escaped = "\\\"";
+          break;
+        case '\\':
+          escaped = "\\\\";
+          break;
+        case '/':
+          escaped = "\\/";
+          break;
+        case '\b':
+          escaped = "\\b";
+          break;
+        case '\f':
+          escaped = "\\f";
+          break;
+        case '\n':
+          escaped = "\\n";
+          break;
+        case '\r':
+          escaped = "\\r";
+          break;
+        case '\t':
+          escaped = "\\t";
+          break;
+        default:
+          if (static_cast<unsigned char>(*it) < 0x20 || *it == 0x7f) {
+            snprintf(buf, sizeof(buf), "\\u%04x", *it & 0xff);
+            escaped = buf;
+          }
+          break;
+      }
+      if (escaped) {
+        buffer_.append(begin, it);
+        buffer_ += escaped;
+        begin = it + 1;
+      }
+    }
+    buffer_.append(begin, end);
+    buffer_ += '"';
+  }
+
+  format_type format_;
+  std::string buffer_;
+  std::vector<container> containers_;
+  bool after_key_;
+};
+}  // namespace lrdb
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
 #include "picojson.h"
 #include "lrdb/optional.hpp"
 
@@ -75,6 +80,9 @@ inline bool is_response(const json::value& msg) {
          msg.contains("id");
 }
 
+/// @brief JSON-RPC batch. array of requests
+inline bool is_batch(const json::value& msg) { return msg.is<json::array>(); }
+
 inline bool parse(const json::value& message, request_message& request) {
   if (!is_request(message)) {
     return false;
@@ -111,7 +119,7 @@ inline bool parse(const json::value& message, response_message& response) {
   return true;
 }
 
-inline std::string serialize(const request_message& msg) {
+inline json::value to_value(const request_message& msg) {
   json::object obj;
   obj["jsonrpc"] = json::value("2.0");
 
@@ -120,10 +128,13 @@ inline std::string serialize(const request_message& msg) {
     obj["params"] = msg.params;
   }
   obj["id"] = msg.id;
-  return json::value(obj).serialize();
+  return json::value(obj);
+}
+inline std::string serialize(const request_message& msg) {
+  return to_value(msg).serialize();
 }
 
-inline std::string serialize(const response_message& msg) {
+inline json::value to_value(const response_message& msg) {
   json::object obj;
   obj["jsonrpc"] = json::value("2.0");
 
@@ -137,10 +148,13 @@ inline std::string serialize(const response_message& msg) {
   }
 
   obj["id"] = msg.id;
-  return json::value(obj).serialize();
+  return json::value(obj);
+}
+inline std::string serialize(const response_message& msg) {
+  return to_value(msg).serialize();
 }
 
-inline std::string serialize(const notify_message& msg) {
+inline json::value to_value(const notify_message& msg) {
   json::object obj;
   obj["jsonrpc"] = json::value("2.0");
 
@@ -148,7 +162,10 @@ inline std::string serialize(const notify_message& msg) {
   if (!msg.params.is<json::null>()) {
     obj["params"] = msg.params;
   }
-  return json::value(obj).serialize();
+  return json::value(obj);
+}
+inline std::string serialize(const notify_message& msg) {
+  return to_value(msg).serialize();
 }
 
 inline const std::string& get_method(const json::value& msg) {
@@ -176,6 +193,301 @@ inline const json::value& get_id(const json::value& msg) {
   }
   return msg.get<json::object>().at("id");
 }
+/// @brief MessagePack codec for binary wire format.
+/// Values are same as json. Integral numbers are encoded as integer.
+namespace msgpack {
+inline void write_big_endian(std::string& out, uint64_t v, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out += char((v >> (i * 8)) & 0xff);
+  }
+}
+inline void write_nil(std::string& out) { out += char(0xc0); }
+inline void write_bool(std::string& out, bool b) {
+  out += char(b ? 0xc3 : 0xc2);
+}
+/// @brief number. nil if not finite, same as json
+inline void write_number(std::string& out, double n) {
+  if (!std::isfinite(n)) {
+    write_nil(out);
+    return;
+  }
+  if (std::floor(n) == n && std::fabs(n) < 9007199254740992.0) {
+    int64_t i = static_cast<int64_t>(n);
+    if (i >= 0) {
+      if (i < 0x80) {
+        out += char(i);
+      } else if (i <= 0xff) {
+        out += char(0xcc);
+        write_big_endian(out, uint64_t(i), 1);
+      } else if (i <= 0xffff) {
+        out += char(0xcd);
+        write_big_endian(out, uint64_t(i), 2);
+      } else if (i <= 0xffffffffLL) {
+        out += char(0xce);
+        write_big_endian(out, uint64_t(i), 4);
+      } else {
+        out += char(0xcf);
+        write_big_endian(out, uint64_t(i), 8);
+      }
+    } else {
+      if (i >= -32) {
+        out += char(i);
+      } else if (i >= -0x80) {
+        out += char(0xd0);
+        write_big_endian(out, uint64_t(i), 1);
+      } else if (i >= -0x8000) {
+        out += char(0xd1);
+        write_big_endian(out, uint64_t(i), 2);
+      } else if (i >= -0x80000000LL) {
+        out += char(0xd2);
+        write_big_endian(out, uint64_t(i), 4);
+      } else {
+        out += char(0xd3);
+        write_big_endian(out, uint64_t(i), 8);
+      }
+    }
+    return;
+  }
+  uint64_t bits;
+  memcpy(&bits, &n, sizeof(bits));
+  out += char(0xcb);
+  write_big_endian(out, bits, 8);
+}
+inline void write_str(std::string& out, const char* str, size_t len) {
+  if (len < 32) {
+    out += char(0xa0 | len);
+  } else if (len <= 0xff) {
+    out += char(0xd9);
+    write_big_endian(out, len, 1);
+  } else if (len <= 0xffff) {
+    out += char(0xda);
+    write_big_endian(out, len, 2);
+  } else {
+    out += char(0xdb);
+    write_big_endian(out, len, 4);
+  }
+  out.append(str, len);
+}
+inline void write_array_header(std::string& out, size_t size) {
+  if (size < 16) {
+    out += char(0x90 | size);
+  } else if (size <= 0xffff) {
+    out += char(0xdc);
+    write_big_endian(out, size, 2);
+  } else {
+    out += char(0xdd);
+    write_big_endian(out, size, 4);
+  }
+}
+inline void write_map_header(std::string& out, size_t size) {
+  if (size < 16) {
+    out += char(0x80 | size);
+  } else if (size <= 0xffff) {
+    out += char(0xde);
+    write_big_endian(out, size, 2);
+  } else {
+    out += char(0xdf);
+    write_big_endian(out, size, 4);
+  }
+}
+inline void encode(const json::value& v, std::string& out) {
+  if (v.is<bool>()) {
+    write_bool(out, v.get<bool>());
+  } else if (v.is<double>()) {
+    write_number(out, v.get<double>());
+  } else if (v.is<std::string>()) {
+    const std::string& str = v.get<std::string>();
+    write_str(out, str.data(), str.size());
+  } else if (v.is<json::array>()) {
+    const json::array& array = v.get<json::array>();
+    write_array_header(out, array.size());
+    for (const auto& e : array) {
+      encode(e, out);
+    }
+  } else if (v.is<json::object>()) {
+    const json::object& obj = v.get<json::object>();
+    write_map_header(out, obj.size());
+    for (const auto& e : obj) {
+      write_str(out, e.first.data(), e.first.size());
+      encode(e.second, out);
+    }
+  } else {
+    write_nil(out);
+  }
+}
+inline std::string encode(const json::value& v) {
+  std::string out;
+  encode(v, out);
+  return out;
+}
+
+namespace detail {
+class decoder {
+ public:
+  decoder(const std::string& data)
+      : it_(data.data()), end_(it_ + data.size()) {}
+  bool decode(json::value& v, int depth = 0) {
+    uint8_t type;
+    if (depth > 256 || !read(type)) {
+      return false;
+    }
+    if (type <= 0x7f) {
+      v = json::value(double(type));
+    } else if (type >= 0xe0) {
+      v = json::value(double(int8_t(type)));
+    } else if ((type & 0xe0) == 0xa0) {
+      return str(v, type & 0x1f);
+    } else if ((type & 0xf0) == 0x90) {
+      return array(v, type & 0x0f, depth);
+    } else if ((type & 0xf0) == 0x80) {
+      return map(v, type & 0x0f, depth);
+    } else {
+      uint64_t n;
+      switch (type) {
+        case 0xc0:
+          v = json::value();
+          return true;
+        case 0xc2:
+        case 0xc3:
+          v = json::value(type == 0xc3);
+          return true;
+        case 0xc4:
+        case 0xd9:
+          return read(n, 1) && str(v, n);
+        case 0xc5:
+        case 0xda:
+          return read(n, 2) && str(v, n);
+        case 0xc6:
+        case 0xdb:
+          return read(n, 4) && str(v, n);
+        case 0xca: {
+          float f;
+          uint32_t bits;
+          if (!read(n, 4)) {
+            return false;
+          }
+          bits = uint32_t(n);
+          memcpy(&f, &bits, sizeof(f));
+          return set_number(v, double(f));
+        }
+        case 0xcb: {
+          double d;
+          if (!read(n, 8)) {
+            return false;
+          }
+          memcpy(&d, &n, sizeof(d));
+          return set_number(v, d);
+        }
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+        case 0xcf:
+          if (!read(n, 1 << (type - 0xcc))) {
+            return false;
+          }
+          v = json::value(double(n));
+          return true;
+        case 0xd0:
+          return read(n, 1) && set_number(v, double(int8_t(n)));
+        case 0xd1:
+          return read(n, 2) && set_number(v, double(int16_t(n)));
+        case 0xd2:
+          return read(n, 4) && set_number(v, double(int32_t(n)));
+        case 0xd3:
+          return read(n, 8) && set_number(v, double(int64_t(n)));
+        case 0xdc:
+          return read(n, 2) && array(v, n, depth);
+        case 0xdd:
+          return read(n, 4) && array(v, n, depth);
+        case 0xde:
+          return read(n, 2) && map(v, n, depth);
+        case 0xdf:
+          return read(n, 4) && map(v, n, depth);
+        default:  // ext types are unsupported
+          return false;
+      }
+    }
+    return true;
+  }
+  bool at_end() const { return it_ == end_; }
+
+ private:
+  bool read(uint8_t& b) {
+    if (it_ == end_) {
+      return false;
+    }
+    b = uint8_t(*it_++);
+    return true;
+  }
+  bool read(uint64_t& n, int bytes) {
+    if (end_ - it_ < bytes) {
+      return false;
+    }
+    n = 0;
+    for (int i = 0; i < bytes; ++i) {
+      n = (n << 8) | uint8_t(*it_++);
+    }
+    return true;
+  }
+  /// @brief json can not have non finite number
+  static bool set_number(json::value& v, double n) {
+    v = std::isfinite(n) ? json::value(n) : json::value();
+    return true;
+  }
+  bool str(json::value& v, uint64_t len) {
+    if (uint64_t(end_ - it_) < len) {
+      return false;
+    }
+    v = json::value(std::string(it_, size_t(len)));
+    it_ += len;
+    return true;
+  }
+  bool array(json::value& v, uint64_t size, int depth) {
+    if (uint64_t(end_ - it_) < size) {  // at least 1 byte per element
+      return false;
+    }
+    v = json::value(json::array(size_t(size)));
+    json::array& a = v.get<json::array>();
+    for (auto& e : a) {
+      if (!decode(e, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool map(json::value& v, uint64_t size, int depth) {
+    v = json::value(json::object());
+    json::object& obj = v.get<json::object>();
+    for (uint64_t i = 0; i < size; ++i) {
+      json::value key;
+      if (!decode(key, depth + 1)) {
+        return false;
+      }
+      json::value& e =
+          obj[key.is<std::string>() ? key.get<std::string>() : key.to_str()];
+      if (!decode(e, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const char* it_;
+  const char* end_;
+};
+}  // namespace detail
+
+/// @brief decode MessagePack data
+/// @return empty if success. Otherwise error message (same as json::parse)
+inline std::string decode(const std::string& data, json::value& v) {
+  detail::decoder decoder(data);
+  if (!decoder.decode(v) || !decoder.at_end()) {
+    return "invalid MessagePack data";
+  }
+  return std::string();
+}
+}  // namespace msgpack
+
 namespace request {
 inline std::string serialize(const json::value& id, const std::string& medhod,
                              const json::value& param = json::value()) {
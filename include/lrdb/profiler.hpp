@@ -0,0 +1,746 @@
+#pragma once
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+namespace lrdb {
+
+/// @brief intern table of function identity for profilers.
+/// Lua function is identified by source and linedefined, C function by
+/// function pointer.
+class function_table {
+ public:
+  struct function_info {
+    std::string source;
+    std::string name;
+    int linedefined;
+    std::string label;  /// name with source location. e.g. "f (a.lua:3)"
+  };
+
+  /// @brief function identity. source string address and linedefined for
+  /// Lua function, function pointer for C function.
+  typedef std::pair<const void*, int> key_type;
+
+  /// @brief get function identity without interning.
+  /// source string is alive while the function is on stack.
+  /// @param ar activation record from hook or lua_getstack
+  static key_type key(lua_State* L, lua_Debug& ar) {
+    lua_getinfo(L, "S", &ar);
+    if (!is_c_function(ar)) {
+      return key_type(ar.source, ar.linedefined);
+    }
+    lua_getinfo(L, "f", &ar);
+    key_type key(reinterpret_cast<const void*>(lua_tocfunction(L, -1)),
+                 ar.linedefined);
+    lua_pop(L, 1);
+    return key;
+  }
+
+  /// @brief get function id.
+  /// @param ar activation record from hook or lua_getstack
+  /// @return id. index of functions()
+  int intern(lua_State* L, lua_Debug& ar) { return intern(L, ar, key(L, ar)); }
+  /// @brief get function id of identity from key()
+  int intern(lua_State* L, lua_Debug& ar, const key_type& key) {
+    bool cfunction = is_c_function(ar);
+    auto found = ids_.find(key);
+    // source string address may be reused after garbage collected.
+    // compare leading bytes only, that is whole source of file chunk
+    if (found != ids_.end() &&
+        (cfunction || strncmp(functions_[found->second].source.c_str(),
+                              ar.source, SOURCE_HEAD_SIZE) == 0)) {
+      return found->second;
+    }
+    lua_getinfo(L, "n", &ar);
+    function_info info;
+    if (ar.source) {
+      info.source = ar.source;
+    }
+    if (ar.name && ar.name[0] != '\0') {
+      info.name = ar.name;
+    } else if (ar.what && strcmp(ar.what, "main") == 0) {
+      info.name = "main";
+    } else {
+      info.name = "?";
+    }
+    info.linedefined = ar.linedefined;
+    info.label = info.name;
+    if (!cfunction) {
+      info.label += " (" + std::string(ar.short_src) + ":" +
+                    std::to_string(ar.linedefined) + ")";
+    }
+    int id = int(functions_.size());
+    functions_.push_back(info);
+    ids_[key] = id;
+    return id;
+  }
+
+  const std::vector<function_info>& functions() const { return functions_; }
+
+  void clear() {
+    functions_.clear();
+    ids_.clear();
+  }
+
+ private:
+  static const size_t SOURCE_HEAD_SIZE = 64;
+  struct key_hash {
+    size_t operator()(const key_type& key) const {
+      return std::hash<const void*>()(key.first) ^
+             (std::hash<int>()(key.second) * 31);
+    }
+  };
+  static bool is_c_function(const lua_Debug& ar) {
+    return ar.what && strcmp(ar.what, "C") == 0;
+  }
+
+  std::vector<function_info> functions_;
+  std::unordered_map<key_type, int, key_hash> ids_;
+};
+
+/// @brief sampling cpu profiler.
+/// Take call stack at hook event when sampling interval elapsed, and
+/// aggregate same call stacks. Driven by debugger hook.
+class sampling_profiler {
+ public:
+  typedef std::chrono::steady_clock clock_type;
+
+  /// max call stack depth of sample. deeper frames are truncated
+  static const size_t MAX_STACK_DEPTH = 256;
+
+  sampling_profiler() : running_(false), interval_(1000), sample_count_(0) {}
+
+  /// @brief start sampling. previous result is cleared
+  /// @param interval sampling interval. default 1ms
+  void start(std::chrono::microseconds interval =
+                 std::chrono::microseconds(1000)) {
+    clear();
+    interval_ = interval;
+    next_sample_time_ = clock_type::now() + interval_;
+    running_ = true;
+  }
+  /// @brief stop sampling. result is kept until start or clear
+  void stop() { running_ = false; }
+
+  /// @brief sampling is running
+  bool running() const { return running_; }
+
+  /// @brief clear result
+  void clear() {
+    functions_.clear();
+    stacks_.clear();
+    sample_count_ = 0;
+  }
+
+  /// @brief number of taken samples
+  size_t sample_count() const { return sample_count_; }
+
+  /// @brief call from hook. take sample if sampling interval elapsed
+  void hook(lua_State* L) {
+    clock_type::time_point now = clock_type::now();
+    if (now < next_sample_time_) {
+      return;
+    }
+    next_sample_time_ = now + interval_;
+    sample(L);
+  }
+
+  /// @brief take sample of call stack now
+  void sample(lua_State* L) {
+    stack_buffer_.clear();
+    lua_Debug ar;
+    for (int level = 0; stack_buffer_.size() < MAX_STACK_DEPTH &&
+                        lua_getstack(L, level, &ar);
+         ++level) {
+      stack_buffer_.push_back(functions_.intern(L, ar));
+    }
+    if (stack_buffer_.empty()) {
+      return;
+    }
+    // root frame first
+    std::reverse(stack_buffer_.begin(), stack_buffer_.end());
+    stack_map_type::iterator it = stacks_.find(stack_buffer_);
+    if (it != stacks_.end()) {
+      it->second++;
+    } else {
+      stacks_.insert(std::make_pair(stack_buffer_, size_t(1)));
+    }
+    sample_count_++;
+  }
+
+  /// @brief get result in collapsed stack format for flame graph.
+  /// a line per unique stack. e.g. "main (a.lua:0);f (a.lua:3) 42"
+  std::string collapsed_stacks() const {
+    const std::vector<function_table::function_info>& functions =
+        functions_.functions();
+    std::string result;
+    for (const auto& stack : stacks_) {
+      for (size_t i = 0; i < stack.first.size(); ++i) {
+        if (i != 0) {
+          result += ';';
+        }
+        // ';' is frame separator of collapsed stack format
+        for (char c : functions[stack.first[i]].label) {
+          result += c == ';' ? ',' : c;
+        }
+      }
+      result += ' ';
+      result += std::to_string(stack.second);
+      result += '\n';
+    }
+    return result;
+  }
+
+ private:
+  struct stack_hash {
+    size_t operator()(const std::vector<int>& stack) const {
+      size_t h = 14695981039346656037ULL & size_t(-1);
+      for (int id : stack) {
+        h = (h ^ size_t(id)) * (1099511628211ULL & size_t(-1));
+      }
+      return h;
+    }
+  };
+  typedef std::unordered_map<std::vector<int>, size_t, stack_hash>
+      stack_map_type;
+
+  bool running_;
+  std::chrono::microseconds interval_;
+  clock_type::time_point next_sample_time_;
+  size_t sample_count_;
+  function_table functions_;
+  stack_map_type stacks_;
+  std::vector<int> stack_buffer_;
+};
+
+/// @brief instrumenting function profiler.
+/// Measure call count, inclusive and exclusive time per function by call
+/// and return hooks. Each thread(coroutine) has shadow stack, and time is
+/// charged to the function on top of the running thread, so that suspended
+/// coroutine is not charged. Inclusive time of recursive function is counted
+/// at outermost call on the thread only. Functions on stack at start or stop
+/// are not counted completely. Shadow stacks of collected threads are
+/// dropped.
+class function_profiler {
+ public:
+  typedef std::chrono::steady_clock clock_type;
+
+  struct function_stats {
+    function_stats() : calls(0), inclusive(0), exclusive(0), active(0) {}
+    size_t calls;
+    clock_type::duration inclusive;
+    clock_type::duration exclusive;
+    int active;  /// number of activations on all shadow stacks
+  };
+
+  function_profiler()
+      : running_(false),
+        current_state_(0),
+        current_stack_(0),
+        sweep_threshold_(MIN_SWEEP_THRESHOLD) {}
+
+  /// @brief start profiling. previous result is cleared
+  void start() {
+    clear();
+    running_ = true;
+  }
+  /// @brief stop profiling. result is kept until start or clear
+  void stop() {
+    running_ = false;
+    stacks_.clear();
+    resume_chain_.clear();
+    current_state_ = 0;
+    current_stack_ = 0;
+    sweep_threshold_ = MIN_SWEEP_THRESHOLD;
+  }
+
+  /// @brief profiling is running
+  bool running() const { return running_; }
+
+  /// @brief clear result
+  void clear() {
+    functions_.clear();
+    stats_.clear();
+    stacks_.clear();
+    resume_chain_.clear();
+    current_state_ = 0;
+    current_stack_ = 0;
+    sweep_threshold_ = MIN_SWEEP_THRESHOLD;
+  }
+
+  /// @brief identity of profiled functions. same index with stats()
+  const std::vector<function_table::function_info>& functions() const {
+    return functions_.functions();
+  }
+  /// @brief profiled result. same index with functions()
+  const std::vector<function_stats>& stats() const { return stats_; }
+
+  /// @brief call from hook with call, tail call and return event
+  void hook(lua_State* L, lua_Debug* ar) {
+    clock_type::time_point now = clock_type::now();
+    if (current_stack_) {
+      clock_type::duration elapsed = now - last_time_;
+      if (!current_stack_->frames.empty()) {
+        current_stack_->frames.back().self += elapsed;
+      }
+      resume_chain_.back().second += elapsed;
+    }
+    if (current_state_ != L) {
+      current_state_ = L;
+      current_stack_ = &thread_stack(L);
+      switch_thread(current_stack_);
+    }
+    switch (ar->event) {
+      case LUA_HOOKCALL:
+        enter(*current_stack_, L, *ar);
+        break;
+#if LUA_VERSION_NUM >= 502
+      case LUA_HOOKTAILCALL:
+        // caller frame is replaced, and no return event for it
+        if (!current_stack_->frames.empty()) {
+          leave(*current_stack_);
+        }
+        enter(*current_stack_, L, *ar);
+        break;
+#else
+      case LUA_HOOKTAILRET:  // return from frame replaced by tail call
+        if (!current_stack_->frames.empty()) {
+          leave(*current_stack_);
+        }
+        break;
+#endif
+      case LUA_HOOKRET:
+        leave_to(*current_stack_, function_table::key(L, *ar));
+        break;
+      default:
+        break;
+    }
+    last_time_ = clock_type::now();
+  }
+
+ private:
+  struct frame {
+    int id;
+    function_table::key_type key;  /// matched with return without intern
+    clock_type::duration self;
+    clock_type::duration children;
+  };
+  struct shadow_stack {
+    std::vector<frame> frames;
+    /// number of frames indexed by function id. for recursion on this
+    /// thread
+    std::vector<int> depth;
+  };
+  static const size_t MIN_SWEEP_THRESHOLD = 64;
+
+  /// @brief get shadow stack of thread. stale stack of collected thread at
+  /// same address is discarded
+  shadow_stack& thread_stack(lua_State* L) {
+    bool known = register_thread(L);
+    auto found = stacks_.find(L);
+    if (found != stacks_.end()) {
+      if (!known) {
+        discard(found->second);
+      }
+      return found->second;
+    }
+    if (stacks_.size() >= sweep_threshold_) {
+      sweep_collected_threads(L);
+      sweep_threshold_ =
+          std::max(size_t(MIN_SWEEP_THRESHOLD), stacks_.size() * 2);
+    }
+    return stacks_[L];
+  }
+  /// @brief add thread to weak keyed table in registry.
+  /// @return false if thread is not in table
+  static bool register_thread(lua_State* L) {
+    lua_pushlightuserdata(L, threads_key());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_createtable(L, 0, 0);
+      lua_createtable(L, 0, 1);
+      lua_pushstring(L, "k");
+      lua_setfield(L, -2, "__mode");
+      lua_setmetatable(L, -2);
+      lua_pushlightuserdata(L, threads_key());
+      lua_pushvalue(L, -2);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+    lua_pushthread(L);
+    lua_rawget(L, -2);
+    bool known = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (!known) {
+      lua_pushthread(L);
+      lua_pushboolean(L, 1);
+      lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+    return known;
+  }
+  /// @brief drop shadow stacks of threads that are not in registry table
+  void sweep_collected_threads(lua_State* L) {
+    std::unordered_map<lua_State*, bool> alive;
+    lua_pushlightuserdata(L, threads_key());
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_pop(L, 1);
+      alive[lua_tothread(L, -1)] = true;
+    }
+    lua_pop(L, 1);
+    for (auto it = stacks_.begin(); it != stacks_.end();) {
+      if (alive.count(it->first) || &it->second == current_stack_) {
+        ++it;
+        continue;
+      }
+      discard(it->second);
+      shadow_stack* stack = &it->second;
+      resume_chain_.erase(
+          std::remove_if(
+              resume_chain_.begin(), resume_chain_.end(),
+              [&](const std::pair<shadow_stack*, clock_type::duration>& r) {
+                return r.first == stack;
+              }),
+          resume_chain_.end());
+      it = stacks_.erase(it);
+    }
+  }
+  /// @brief drop frames without counting. e.g. abandoned coroutine
+  void discard(shadow_stack& stack) {
+    for (const frame& f : stack.frames) {
+      stats_[f.id].active--;
+    }
+    stack.frames.clear();
+    stack.depth.clear();
+  }
+  static void* threads_key() {
+    static int key_data = 0;
+    return &key_data;
+  }
+
+  /// time of resumed coroutine is charged to resumer as children time, when
+  /// it yield or return to resumer.
+  void switch_thread(shadow_stack* stack) {
+    size_t size = resume_chain_.size();
+    if (size >= 2 && resume_chain_[size - 2].first == stack) {
+      clock_type::duration elapsed = resume_chain_.back().second;
+      resume_chain_.pop_back();
+      resume_chain_.back().second += elapsed;
+      if (!stack->frames.empty()) {
+        stack->frames.back().children += elapsed;
+      }
+    } else {
+      resume_chain_.push_back(std::make_pair(stack, clock_type::duration(0)));
+    }
+  }
+  void enter(shadow_stack& stack, lua_State* L, lua_Debug& ar) {
+    function_table::key_type key = function_table::key(L, ar);
+    int id = functions_.intern(L, ar, key);
+    if (stats_.size() <= size_t(id)) {
+      stats_.resize(id + 1);
+    }
+    function_stats& stats = stats_[id];
+    stats.calls++;
+    stats.active++;
+    if (stack.depth.size() <= size_t(id)) {
+      stack.depth.resize(id + 1);
+    }
+    stack.depth[id]++;
+    frame f = {id, key, clock_type::duration(0), clock_type::duration(0)};
+    stack.frames.push_back(f);
+  }
+  void leave(shadow_stack& stack) {
+    frame f = stack.frames.back();
+    stack.frames.pop_back();
+    clock_type::duration inclusive = f.self + f.children;
+    function_stats& stats = stats_[f.id];
+    stats.exclusive += f.self;
+    stats.active--;
+    if (--stack.depth[f.id] == 0) {
+      stats.inclusive += inclusive;
+    }
+    if (!stack.frames.empty()) {
+      stack.frames.back().children += inclusive;
+    }
+  }
+  /// pop frames until returning function. frames above it is unwound by
+  /// error. ignore return from function entered before start.
+  void leave_to(shadow_stack& stack, const function_table::key_type& key) {
+    for (size_t i = stack.frames.size(); i > 0; --i) {
+      if (stack.frames[i - 1].key == key) {
+        while (stack.frames.size() >= i) {
+          leave(stack);
+        }
+        return;
+      }
+    }
+  }
+
+  bool running_;
+  function_table functions_;
+  std::vector<function_stats> stats_;
+  std::unordered_map<lua_State*, shadow_stack> stacks_;
+  lua_State* current_state_;
+  shadow_stack* current_stack_;
+  /// resuming threads and running time of the thread
+  std::vector<std::pair<shadow_stack*, clock_type::duration> > resume_chain_;
+  clock_type::time_point last_time_;
+  size_t sweep_threshold_;  /// number of shadow stacks to sweep at
+};
+/// @brief allocation profiler.
+/// Wrap allocator function of lua_State, and attribute allocated bytes and
+/// counts to current line of the nearest Lua function on the stack of the
+/// running thread. The nearest Lua function is tracked by call and return
+/// hook, so that allocator only look current line of the frame. Running
+/// thread is notified by hook, so allocations just after coroutine switch
+/// may be attributed to the resumer.
+/// Bytes are counted for new blocks and growth of reallocated blocks.
+class allocation_profiler {
+ public:
+  /// max stack level to search Lua function from C function
+  static const int MAX_SEARCH_LEVEL = 8;
+
+  struct site_stats {
+    site_stats() : linedefined(-1), line(-1), count(0), bytes(0) {}
+    std::string source;  /// empty if allocated outside of Lua function
+    std::string name;
+    int linedefined;
+    int line;
+    size_t count;
+    size_t bytes;
+  };
+
+  allocation_profiler()
+      : state_(0),
+        running_thread_(0),
+        original_alloc_(0),
+        original_ud_(0),
+        total_count_(0),
+        total_bytes_(0),
+        frame_level_(-1),
+        frame_chunk_(NO_CHUNK) {}
+  ~allocation_profiler() { stop(); }
+
+  /// @brief install allocator to lua_State. previous result is cleared
+  void start(lua_State* L) {
+    stop();
+    clear();
+    original_alloc_ = lua_getallocf(L, &original_ud_);
+    lua_setallocf(L, &alloc_function, this);
+    state_ = L;
+    running_thread_ = L;
+  }
+  /// @brief restore original allocator. result is kept until start or clear
+  void stop() {
+    if (!state_) {
+      return;
+    }
+    void* ud = 0;
+    if (lua_getallocf(state_, &ud) == &alloc_function && ud == this) {
+      lua_setallocf(state_, original_alloc_, original_ud_);
+    }
+    state_ = 0;
+    running_thread_ = 0;
+    frame_level_ = -1;
+  }
+  /// @brief allocator is installed
+  bool running() const { return state_ != 0; }
+
+  /// @brief running thread. thread must be alive while profiling
+  lua_State* running_thread() const { return running_thread_; }
+  void set_running_thread(lua_State* L) {
+    if (running_thread_ != L) {
+      running_thread_ = L;
+      frame_level_ = -1;
+    }
+  }
+
+  /// @brief call from hook with call and return event, and at first event
+  /// after running thread is changed. search the nearest Lua function.
+  void hook(lua_State* L, lua_Debug* ar) {
+    // returning function is still on stack
+    int base = is_return_event(ar->event) ? 1 : 0;
+    frame_level_ = -1;
+    lua_Debug frame;
+    for (int level = base; level < base + MAX_SEARCH_LEVEL; ++level) {
+      if (!lua_getstack(L, level, &frame)) {
+        break;
+      }
+      lua_getinfo(L, "S", &frame);
+      if (strcmp(frame.what, "C") != 0) {
+        frame_level_ = level - base;
+        frame_chunk_ = chunk_id(frame.source);
+        break;
+      }
+    }
+  }
+
+  /// @brief clear result
+  void clear() {
+    sites_.clear();
+    site_ids_.clear();
+    chunk_ids_.clear();
+    chunk_cache_.clear();
+    frame_level_ = -1;
+    total_count_ = 0;
+    total_bytes_ = 0;
+  }
+
+  size_t total_count() const { return total_count_; }
+  size_t total_bytes() const { return total_bytes_; }
+
+  /// @brief get allocation sites ordered by allocated bytes
+  /// @param n max number of sites
+  std::vector<site_stats> top(size_t n) const {
+    std::vector<site_stats> result = sites_;
+    std::sort(result.begin(), result.end(),
+              [](const site_stats& a, const site_stats& b) {
+                return a.bytes > b.bytes;
+              });
+    if (result.size() > n) {
+      result.resize(n);
+    }
+    return result;
+  }
+
+ private:
+  allocation_profiler(const allocation_profiler&);             //=delete;
+  allocation_profiler& operator=(const allocation_profiler&);  //=delete;
+
+  static const size_t NO_CHUNK = size_t(-1);
+  /// leading bytes of source to detect address reuse
+  static const size_t SOURCE_HEAD_SIZE = 64;
+  /// bound of chunk_cache_, cleared all when exceeded
+  static const size_t MAX_CHUNK_CACHE = 1024;
+
+  /// chunk id and line
+  typedef std::pair<size_t, int> site_key;
+  struct site_key_hash {
+    size_t operator()(const site_key& key) const {
+      return std::hash<size_t>()(key.first) ^
+             (std::hash<int>()(key.second) * 31);
+    }
+  };
+  struct chunk_cache_entry {
+    std::string source_head;
+    size_t id;
+  };
+
+  static bool is_return_event(int event) {
+#if LUA_VERSION_NUM < 502
+    if (event == LUA_HOOKTAILRET) {
+      return true;
+    }
+#endif
+    return event == LUA_HOOKRET;
+  }
+
+  static void* alloc_function(void* ud, void* ptr, size_t osize,
+                              size_t nsize) {
+    allocation_profiler* self = static_cast<allocation_profiler*>(ud);
+    // record before forward, stack of running thread may be reallocated
+    if (nsize > 0 && (!ptr || nsize > osize)) {
+      self->record(ptr ? nsize - osize : nsize, !ptr);
+    }
+    return self->original_alloc_(self->original_ud_, ptr, osize, nsize);
+  }
+  /// must not push to Lua stack, it may allocate
+  void record(size_t bytes, bool new_block) {
+    lua_Debug ar;
+    bool found = frame_level_ >= 0 && running_thread_ &&
+                 lua_getstack(running_thread_, frame_level_, &ar);
+    site_key key(size_t(NO_CHUNK), -1);
+    if (found) {
+      lua_getinfo(running_thread_, "l", &ar);
+      key = site_key(frame_chunk_, ar.currentline);
+    }
+    auto cached = site_ids_.find(key);
+    size_t id = cached != site_ids_.end() ? cached->second
+                                          : site_id(key, found ? &ar : 0);
+    site_stats& site = sites_[id];
+    if (new_block) {
+      site.count++;
+      total_count_++;
+    }
+    site.bytes += bytes;
+    total_bytes_ += bytes;
+  }
+  /// @brief add site of chunk and line. null ar is allocation outside of
+  /// Lua function
+  size_t site_id(const site_key& key, lua_Debug* ar) {
+    site_stats site;
+    if (ar) {
+      lua_getinfo(running_thread_, "Sn", ar);
+      site.source = ar->source;
+      site.name = ar->name ? ar->name : strcmp(ar->what, "main") == 0 ? "main"
+                                                                      : "?";
+      site.linedefined = ar->linedefined;
+      site.line = ar->currentline;
+    }
+    size_t id = sites_.size();
+    sites_.push_back(site);
+    site_ids_[key] = id;
+    return id;
+  }
+  /// @brief get id of chunk source. source string is cached by address,
+  /// and address reuse after collected is detected by leading bytes
+  size_t chunk_id(const char* source) {
+    auto cached = chunk_cache_.find(source);
+    if (cached != chunk_cache_.end() &&
+        strncmp(cached->second.source_head.c_str(), source,
+                SOURCE_HEAD_SIZE) == 0) {
+      return cached->second.id;
+    }
+    if (cached == chunk_cache_.end() &&
+        chunk_cache_.size() >= MAX_CHUNK_CACHE) {
+      chunk_cache_.clear();
+    }
+    auto found = chunk_ids_.find(source);
+    size_t id = found != chunk_ids_.end() ? found->second : chunk_ids_.size();
+    if (found == chunk_ids_.end()) {
+      chunk_ids_[source] = id;
+    }
+    chunk_cache_entry& entry = chunk_cache_[source];
+    entry.source_head.assign(source, strnlen(source, SOURCE_HEAD_SIZE));
+    entry.id = id;
+    return id;
+  }
+
+  lua_State* state_;
+  lua_State* running_thread_;
+  lua_Alloc original_alloc_;
+  void* original_ud_;
+  size_t total_count_;
+  size_t total_bytes_;
+  std::vector<site_stats> sites_;
+  /// stable id of sites_ per chunk and line
+  std::unordered_map<site_key, size_t, site_key_hash> site_ids_;
+  /// stable id per chunk source
+  std::unordered_map<std::string, size_t> chunk_ids_;
+  /// lookup cache of chunk_ids_ by source address
+  std::unordered_map<const void*, chunk_cache_entry> chunk_cache_;
+  /// stack level of the nearest Lua function on running thread. -1 if none
+  int frame_level_;
+  size_t frame_chunk_;  /// chunk id of the nearest Lua function
+};
+}  // namespace lrdb
+
+#else
+#error Needs at least a C++11 compiler
+#endif
@@ -6,9 +6,23 @@
 #include <vector>
 
 #include "basic_server.hpp"
+#include "command_stream/shared_memory.hpp"
 #include "command_stream/socket.hpp"
+#include "command_stream/threaded_socket.hpp"
 namespace lrdb {
 typedef basic_server<command_stream_socket> server;
+/// networking on background thread
+typedef basic_server<command_stream_threaded_socket> threaded_server;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+/// Unix domain socket for clients on same host
+typedef basic_server<command_stream_local_socket> local_server;
+typedef basic_server<command_stream_threaded_local_socket>
+    threaded_local_server;
+#endif
+#ifdef LRDB_HAS_SHARED_MEMORY_STREAM
+/// shared memory rings for clients on same host
+typedef basic_server<command_stream_shared_memory> shared_memory_server;
+#endif
 }
 
 #else
@@ -29,15 +29,19 @@ export class ChildProcessAdapter implements DebugClientAdapter {
       this.onOpen.emit()
     }, 0)
     this.child.on('message', (msg: unknown) => {
-      if (isJsonRpcMessage(msg)) {
-        this.onMessage.emit(msg)
+      // batch response is array of responses
+      const messages = Array.isArray(msg) ? msg : [msg]
+      for (const m of messages) {
+        if (isJsonRpcMessage(m)) {
+          this.onMessage.emit(m)
+        }
       }
     })
     this.child.on('close', () => {
       this.onClose.emit()
     })
   }
-  send(request: DebugRequest): boolean {
+  send(request: DebugRequest | DebugRequest[]): boolean {
     return this.child.send(request)
   }
   end(): void {
@@ -1,14 +1,31 @@
 import { isJsonRpcMessage, JsonRpcMessage } from '../JsonRpc'
 import { DebugRequest, DebugClientAdapter } from '../Client'
 import { TypedEventEmitter } from '../TypedEventEmitter'
+import * as MessagePack from '../MessagePack'
 import * as net from 'net'
-import * as readline from 'readline'
+
+export type WireFormat = 'json' | 'msgpack'
+
+export interface TcpAdapterOptions {
+  // preferred wire format. used if server advertises it in "connected"
+  format?: WireFormat
+}
+
+const SET_FORMAT_ID = 'lrdb_set_format'
 
 export class TcpAdapter implements DebugClientAdapter {
   private _connection: net.Socket
+  private _format: WireFormat = 'json'
+  private _buffer: Buffer = Buffer.alloc(0)
+  // requests are held while format is negotiating
+  private _pending?: (DebugRequest | DebugRequest[])[]
   onMessage: TypedEventEmitter<JsonRpcMessage> =
     new TypedEventEmitter<JsonRpcMessage>()
-  public constructor(port: number, host: string) {
+  public constructor(
+    port: number,
+    host: string,
+    private options: TcpAdapterOptions = {},
+  ) {
     const connection = net.connect(port, host)
     this._connection = connection
 
@@ -24,20 +41,86 @@ export class TcpAdapter implements DebugClientAdapter {
       this.onError.emit(err)
     })
 
-    const rl = readline.createInterface({
-      input: connection,
+    connection.on('data', (data: Buffer) => {
+      this._buffer = Buffer.concat([this._buffer, data])
+      this.parse()
     })
-
-    rl.on('line', (input: string) => {
-      const message = JSON.parse(input)
-      if (isJsonRpcMessage(message)) {
-        this.onMessage.emit(message)
+  }
+  private parse(): void {
+    // format may be switched by a message, so that extract one by one
+    for (;;) {
+      let message: unknown
+      if (this._format === 'msgpack') {
+        if (this._buffer.length < 4) {
+          return
+        }
+        const size = this._buffer.readUInt32BE(0)
+        if (this._buffer.length < 4 + size) {
+          return
+        }
+        message = MessagePack.decode(this._buffer.subarray(4, 4 + size))
+        this._buffer = this._buffer.subarray(4 + size)
+      } else {
+        const end = this._buffer.indexOf('\n')
+        if (end < 0) {
+          return
+        }
+        message = JSON.parse(this._buffer.toString('utf8', 0, end))
+        this._buffer = this._buffer.subarray(end + 1)
       }
-    })
+      // batch response is array of responses
+      const messages = Array.isArray(message) ? message : [message]
+      for (const m of messages) {
+        if (isJsonRpcMessage(m) && !this.negotiate(m)) {
+          this.onMessage.emit(m)
+        }
+      }
+    }
+  }
+  // @return true if message is consumed by format negotiation
+  private negotiate(message: JsonRpcMessage): boolean {
+    if ('method' in message && message.method === 'connected') {
+      const params = message.params as { formats?: WireFormat[] } | undefined
+      const format = this.options.format
+      if (format && format !== 'json' && params?.formats?.includes(format)) {
+        this._pending = []
+        this.write({
+          jsonrpc: '2.0',
+          id: SET_FORMAT_ID,
+          method: 'set_format',
+          params: { format },
+        })
+      }
+      return false
+    }
+    if ('id' in message && message.id === SET_FORMAT_ID) {
+      if (!('error' in message && message.error) && this.options.format) {
+        this._format = this.options.format
+      }
+      const pending = this._pending ?? []
+      this._pending = undefined
+      for (const request of pending) {
+        this.write(request)
+      }
+      return true
+    }
+    return false
   }
-  send(request: DebugRequest): boolean {
+  private write(request: DebugRequest | DebugRequest[]): boolean {
+    if (this._format === 'msgpack') {
+      return this._connection.write(
+        MessagePack.frame(MessagePack.encode(request)),
+      )
+    }
     return this._connection.write(`${JSON.stringify(request)}\n`)
   }
+  send(request: DebugRequest | DebugRequest[]): boolean {
+    if (this._pending) {
+      this._pending.push(request)
+      return true
+    }
+    return this.write(request)
+  }
   end(): void {
     this._connection.end()
   }
@@ -22,13 +22,30 @@ export type DebugRequest =
   | GetUpvaluesRequest
   | EvalRequest
   | GetGlobalRequest
+  | GetChildrenRequest
+  | ProfileStartRequest
+  | ProfileStopRequest
+  | FunctionProfileStartRequest
+  | FunctionProfileStopRequest
+  | CoverageStartRequest
+  | CoverageStopRequest
+  | GetCoverageRequest
+  | StartLineCountsRequest
+  | StopLineCountsRequest
+  | GetLineCountsRequest
+  | AllocProfileStartRequest
+  | AllocProfileStopRequest
+  | HeapSnapshotRequest
+  | HeapBaselineRequest
+  | HeapDiffRequest
+  | SetFormatRequest
 
 export interface DebugClientAdapter {
   onMessage: TypedEventTarget<JsonRpcMessage>
   onOpen: TypedEventTarget<void>
   onClose: TypedEventTarget<void>
   onError: TypedEventTarget<Error>
-  send(request: DebugRequest): boolean
+  send(request: DebugRequest | DebugRequest[]): boolean
   end(): void
 }
 
@@ -39,7 +56,9 @@ export class Client {
     adapter.onMessage.on((msg) => {
       if (isJsonRpcNotify(msg)) {
         const notify = msg as DebuggerNotify
-        this.currentStatus_ = notify.method
+        if (notify.method !== 'heap_snapshot_chunk') {
+          this.currentStatus_ = notify.method
+        }
         this.onNotify.emit(notify)
       }
     })
@@ -52,35 +71,59 @@ export class Client {
     return this.currentStatus_
   }
   send<T extends DebugRequest>(request: T): Promise<DebugResponseType<T>> {
+    return this.sendRequests(request, [request])[0]
+  }
+  // requests are sent as one JSON-RPC batch and executed in order.
+  // responses are in same order as requests
+  batch<T extends DebugRequest>(
+    requests: BatchRequest<T>[],
+  ): Promise<DebugResponseType<T>[]> {
+    const batch = requests.map(
+      (request) =>
+        ({ ...request, jsonrpc: '2.0', id: this.seqId++ }) as unknown as T,
+    )
+    return Promise.all(this.sendRequests(batch, batch))
+  }
+  private sendRequests<T extends DebugRequest>(
+    message: T | T[],
+    requests: T[],
+  ): Promise<DebugResponseType<T>>[] {
     const { onMessage, onError } = this.adapter
-    return new Promise<DebugResponseType<T>>((resolve, reject) => {
-      const onReceiveMessage = (msg: JsonRpcMessage) => {
-        if (isJsonRpcResponse(msg)) {
-          if (request.id === msg.id) {
-            if (msg.error) {
-              reject(Error(JSON.stringify(msg.error)))
-            } else {
-              resolve(msg as DebugResponseType<T>)
+    const sendErrors: (() => void)[] = []
+    const responses = requests.map(
+      (request) =>
+        new Promise<DebugResponseType<T>>((resolve, reject) => {
+          const onReceiveMessage = (msg: JsonRpcMessage) => {
+            if (isJsonRpcResponse(msg)) {
+              if (request.id === msg.id) {
+                if (msg.error) {
+                  reject(Error(JSON.stringify(msg.error)))
+                } else {
+                  resolve(msg as DebugResponseType<T>)
+                }
+                onMessage.off(onReceiveMessage)
+                onError.off(onReceiveError)
+              }
             }
+          }
+          const onReceiveError = (err: Error) => {
+            reject(err)
             onMessage.off(onReceiveMessage)
             onError.off(onReceiveError)
           }
-        }
-      }
-      const onReceiveError = (err: Error) => {
-        reject(err)
-        onMessage.off(onReceiveMessage)
-        onError.off(onReceiveError)
-      }
-
-      const ret = this.adapter.send(request)
-      if (ret) {
-        onMessage.on(onReceiveMessage)
-        onError.on(onReceiveError)
-      } else {
-        reject(Error('Send error'))
-      }
-    })
+          onMessage.on(onReceiveMessage)
+          onError.on(onReceiveError)
+          sendErrors.push(() => {
+            onMessage.off(onReceiveMessage)
+            onError.off(onReceiveError)
+            reject(Error('Send error'))
+          })
+        }),
+    )
+    if (!this.adapter.send(message)) {
+      sendErrors.forEach((sendError) => sendError())
+    }
+    return responses
   }
 
   step = (): Promise<DebugResponseType<StepRequest>> =>
@@ -160,6 +203,159 @@ export class Client {
       id: this.seqId++,
       params,
     })
+  getChildren = (
+    params: GetChildrenRequest['params'],
+  ): Promise<DebugResponseType<GetChildrenRequest>> =>
+    this.send({
+      method: 'get_children',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+
+  profileStart = (
+    params?: ProfileStartRequest['params'],
+  ): Promise<DebugResponseType<ProfileStartRequest>> =>
+    this.send({
+      method: 'profile_start',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+  profileStop = (): Promise<DebugResponseType<ProfileStopRequest>> =>
+    this.send({
+      method: 'profile_stop',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+
+  functionProfileStart = (): Promise<
+    DebugResponseType<FunctionProfileStartRequest>
+  > =>
+    this.send({
+      method: 'function_profile_start',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+  functionProfileStop = (): Promise<
+    DebugResponseType<FunctionProfileStopRequest>
+  > =>
+    this.send({
+      method: 'function_profile_stop',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+
+  coverageStart = (
+    params?: CoverageStartRequest['params'],
+  ): Promise<DebugResponseType<CoverageStartRequest>> =>
+    this.send({
+      method: 'coverage_start',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+  coverageStop = (): Promise<DebugResponseType<CoverageStopRequest>> =>
+    this.send({
+      method: 'coverage_stop',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+  getCoverage = (
+    params?: GetCoverageRequest['params'],
+  ): Promise<DebugResponseType<GetCoverageRequest>> =>
+    this.send({
+      method: 'get_coverage',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+
+  startLineCounts = (
+    params: StartLineCountsRequest['params'],
+  ): Promise<DebugResponseType<StartLineCountsRequest>> =>
+    this.send({
+      method: 'start_line_counts',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+  stopLineCounts = (
+    params?: StopLineCountsRequest['params'],
+  ): Promise<DebugResponseType<StopLineCountsRequest>> =>
+    this.send({
+      method: 'stop_line_counts',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+  getLineCounts = (
+    params: GetLineCountsRequest['params'],
+  ): Promise<DebugResponseType<GetLineCountsRequest>> =>
+    this.send({
+      method: 'get_line_counts',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+
+  allocProfileStart = (): Promise<
+    DebugResponseType<AllocProfileStartRequest>
+  > =>
+    this.send({
+      method: 'alloc_profile_start',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+  allocProfileStop = (
+    params?: AllocProfileStopRequest['params'],
+  ): Promise<DebugResponseType<AllocProfileStopRequest>> =>
+    this.send({
+      method: 'alloc_profile_stop',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
+
+  // snapshot text chunks are passed to onChunk before response
+  heapSnapshot = async (
+    params?: HeapSnapshotRequest['params'],
+    onChunk?: (data: string) => void,
+  ): Promise<DebugResponseType<HeapSnapshotRequest>> => {
+    const id = this.seqId++
+    const onChunkNotify = (notify: DebuggerNotify) => {
+      if (notify.method === 'heap_snapshot_chunk' && notify.params.id === id) {
+        onChunk?.(notify.params.data)
+      }
+    }
+    this.onNotify.on(onChunkNotify)
+    try {
+      return await this.send({
+        method: 'heap_snapshot',
+        jsonrpc: '2.0',
+        id,
+        params,
+      })
+    } finally {
+      this.onNotify.off(onChunkNotify)
+    }
+  }
+
+  heapBaseline = (): Promise<DebugResponseType<HeapBaselineRequest>> =>
+    this.send({
+      method: 'heap_baseline',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+    })
+  heapDiff = (
+    params?: HeapDiffRequest['params'],
+  ): Promise<DebugResponseType<HeapDiffRequest>> =>
+    this.send({
+      method: 'heap_diff',
+      jsonrpc: '2.0',
+      id: this.seqId++,
+      params,
+    })
 
   end(): void {
     this.adapter.end()
@@ -178,8 +374,12 @@ export type DebuggerNotify =
   | ConnectedNotify
   | ExitNotify
   | RunningNotify
+  | HeapSnapshotChunkNotify
 
-export type RunningStatus = DebuggerNotify['method']
+export type RunningStatus = Exclude<
+  DebuggerNotify['method'],
+  'heap_snapshot_chunk'
+>
 
 export interface PausedNotify extends JsonRpcNotify {
   method: 'paused'
@@ -189,7 +389,12 @@ export interface PausedNotify extends JsonRpcNotify {
 }
 export interface ConnectedNotify extends JsonRpcNotify {
   method: 'connected'
-  params?: never
+  params?: {
+    protocol_version: string
+    lua: { version: string; release: string; copyright: string }
+    // wire formats for set_format. absent if stream supports only json
+    formats?: ('json' | 'msgpack')[]
+  }
 }
 export interface ExitNotify extends JsonRpcNotify {
   method: 'exit'
@@ -199,6 +404,15 @@ export interface RunningNotify extends JsonRpcNotify {
   method: 'running'
   params?: never
 }
+// "N <id> <type> <size> [<label>]", "E <from> <to> <name>" and
+// "R <id> <retained size>" lines
+export interface HeapSnapshotChunkNotify extends JsonRpcNotify {
+  method: 'heap_snapshot_chunk'
+  params: {
+    id: number
+    data: string
+  }
+}
 
 interface StepRequest extends JsonRpcRequest {
   method: 'step'
@@ -249,6 +463,7 @@ export interface GetLocalVariableRequest extends JsonRpcRequest {
   params: {
     stack_no: number
     depth?: number
+    lazy?: boolean
   }
 }
 export interface GetUpvaluesRequest extends JsonRpcRequest {
@@ -256,6 +471,7 @@ export interface GetUpvaluesRequest extends JsonRpcRequest {
   params: {
     stack_no: number
     depth?: number
+    lazy?: boolean
   }
 }
 export interface EvalRequest extends JsonRpcRequest {
@@ -264,6 +480,7 @@ export interface EvalRequest extends JsonRpcRequest {
     chunk: string
     stack_no: number
     depth?: number
+    lazy?: boolean
     global?: boolean
     local?: boolean
     upvalue?: boolean
@@ -273,6 +490,107 @@ export interface GetGlobalRequest extends JsonRpcRequest {
   method: 'get_global'
   params?: {
     depth?: number
+    lazy?: boolean
+  }
+}
+// reference is handle written by lazy requests. valid until resume
+export interface GetChildrenRequest extends JsonRpcRequest {
+  method: 'get_children'
+  params: {
+    reference: number
+    start?: number
+    count?: number
+  }
+}
+
+export interface ProfileStartRequest extends JsonRpcRequest {
+  method: 'profile_start'
+  params?: {
+    interval?: number
+  }
+}
+export interface ProfileStopRequest extends JsonRpcRequest {
+  method: 'profile_stop'
+  params?: never
+}
+
+export interface FunctionProfileStartRequest extends JsonRpcRequest {
+  method: 'function_profile_start'
+  params?: never
+}
+export interface FunctionProfileStopRequest extends JsonRpcRequest {
+  method: 'function_profile_stop'
+  params?: never
+}
+
+export interface CoverageStartRequest extends JsonRpcRequest {
+  method: 'coverage_start'
+  params?: {
+    clear?: boolean
+  }
+}
+export interface CoverageStopRequest extends JsonRpcRequest {
+  method: 'coverage_stop'
+  params?: never
+}
+export interface GetCoverageRequest extends JsonRpcRequest {
+  method: 'get_coverage'
+  params?: {
+    format?: 'json' | 'lcov'
+  }
+}
+
+export interface StartLineCountsRequest extends JsonRpcRequest {
+  method: 'start_line_counts'
+  params: {
+    file: string
+  }
+}
+export interface StopLineCountsRequest extends JsonRpcRequest {
+  method: 'stop_line_counts'
+  params?: {
+    file?: string
+  }
+}
+export interface GetLineCountsRequest extends JsonRpcRequest {
+  method: 'get_line_counts'
+  params: {
+    file: string
+  }
+}
+
+export interface AllocProfileStartRequest extends JsonRpcRequest {
+  method: 'alloc_profile_start'
+  params?: never
+}
+export interface AllocProfileStopRequest extends JsonRpcRequest {
+  method: 'alloc_profile_stop'
+  params?: {
+    count?: number
+  }
+}
+
+export interface HeapSnapshotRequest extends JsonRpcRequest {
+  method: 'heap_snapshot'
+  params?: {
+    chunk_size?: number
+  }
+}
+export interface HeapBaselineRequest extends JsonRpcRequest {
+  method: 'heap_baseline'
+  params?: never
+}
+export interface HeapDiffRequest extends JsonRpcRequest {
+  method: 'heap_diff'
+  params?: {
+    count?: number
+  }
+}
+// sent by TcpAdapter. following messages are length prefixed frames
+export interface SetFormatRequest extends JsonRpcRequest {
+  method: 'set_format'
+  params: {
+    format: 'json' | 'msgpack'
   }
 }
 
@@ -291,12 +609,81 @@ type Breakpoint = {
   hit_count: number
 }
 
+// table or userdata written by lazy requests
+type VariableReference = {
+  reference: number
+  type: string
+  length?: number
+}
+type ChildVariable = {
+  key: unknown
+  value: unknown
+}
+
+type ProfileResult = {
+  samples: number
+  collapsed: string
+}
+
+type FunctionProfile = {
+  func: string
+  file: string
+  line: number
+  calls: number
+  inclusive: number // microseconds
+  exclusive: number // microseconds
+}
+
+type ChunkCoverage = {
+  file: string
+  executed: number[]
+  unexecuted: number[]
+}
+
+type LineCount = {
+  line: number
+  count: number
+}
+
+type AllocSite = {
+  file?: string
+  func?: string
+  line?: number
+  count: number
+  bytes: number
+}
+type AllocProfile = {
+  total_count: number
+  total_bytes: number
+  sites: AllocSite[]
+}
+
+type HeapSnapshot = {
+  nodes: number
+  edges: number
+  total_size: number
+}
+
+type HeapGrowth = {
+  path: string // owner path e.g. "globals.cache[]"
+  type: string
+  count: number
+  size: number
+}
+type HeapDiff = {
+  added_count: number
+  added_size: number
+  removed_count: number
+  groups: HeapGrowth[]
+}
+
 type ResponceResultType = {
   get_stacktrace: StackInfo[]
   get_local_variable: Record<string, unknown>
   get_upvalues: Record<string, unknown>
   eval: unknown
-  get_global: Record<string, unknown>
+  get_global: Record<string, unknown> | VariableReference
+  get_children: ChildVariable[]
   step: never
   step_in: never
   step_out: never
@@ -305,8 +692,26 @@ type ResponceResultType = {
   add_breakpoint: never
   get_breakpoints: Breakpoint[]
   clear_breakpoints: never
+  profile_start: never
+  profile_stop: ProfileResult
+  function_profile_start: never
+  function_profile_stop: FunctionProfile[]
+  coverage_start: never
+  coverage_stop: never
+  get_coverage: ChunkCoverage[] | string
+  start_line_counts: never
+  stop_line_counts: never
+  get_line_counts: LineCount[]
+  alloc_profile_start: never
+  alloc_profile_stop: AllocProfile
+  heap_snapshot: HeapSnapshot
+  heap_baseline: { objects: number }
+  heap_diff: HeapDiff
+  set_format: never
 }
 
+export type BatchRequest<T extends DebugRequest> = Omit<T, 'jsonrpc' | 'id'>
+
 export type DebugResponseType<T extends DebugRequest> = Pick<T, 'id'> & {
   result: ResponceResultType[T['method']]
 }
@@ -0,0 +1,207 @@
+// MessagePack codec for binary wire format negotiated by "set_format".
+// Values are same as JSON. Integral numbers are encoded as integer.
+
+function encodeValue(value: unknown, out: number[]): void {
+  if (value === null || value === undefined) {
+    out.push(0xc0)
+  } else if (typeof value === 'boolean') {
+    out.push(value ? 0xc3 : 0xc2)
+  } else if (typeof value === 'number') {
+    encodeNumber(value, out)
+  } else if (typeof value === 'string') {
+    const bytes = Buffer.from(value, 'utf8')
+    writeHeader(out, bytes.length, 0xa0, 0x1f, [0xd9, 0xda, 0xdb])
+    for (const b of bytes) {
+      out.push(b)
+    }
+  } else if (Array.isArray(value)) {
+    writeHeader(out, value.length, 0x90, 0x0f, [undefined, 0xdc, 0xdd])
+    for (const v of value) {
+      encodeValue(v, out)
+    }
+  } else {
+    const entries = Object.entries(value as object).filter(
+      ([, v]) => v !== undefined,
+    )
+    writeHeader(out, entries.length, 0x80, 0x0f, [undefined, 0xde, 0xdf])
+    for (const [k, v] of entries) {
+      encodeValue(k, out)
+      encodeValue(v, out)
+    }
+  }
+}
+
+// fix type, or 8/16/32 bit size types
+function writeHeader(
+  out: number[],
+  size: number,
+  fix: number,
+  fixMax: number,
+  types: (number | undefined)[],
+): void {
+  if (size <= fixMax) {
+    out.push(fix | size)
+  } else if (size <= 0xff && types[0] !== undefined) {
+    out.push(types[0], size)
+  } else if (size <= 0xffff) {
+    out.push(types[1] as number, size >> 8, size & 0xff)
+  } else {
+    out.push(types[2] as number)
+    writeUint32(out, size)
+  }
+}
+
+function writeUint32(out: number[], n: number): void {
+  out.push((n >>> 24) & 0xff, (n >>> 16) & 0xff, (n >>> 8) & 0xff, n & 0xff)
+}
+
+function encodeNumber(n: number, out: number[]): void {
+  if (!Number.isFinite(n)) {
+    out.push(0xc0)
+  } else if (Number.isInteger(n) && n >= 0 && n <= 0xffffffff) {
+    if (n < 0x80) {
+      out.push(n)
+    } else if (n <= 0xff) {
+      out.push(0xcc, n)
+    } else if (n <= 0xffff) {
+      out.push(0xcd, n >> 8, n & 0xff)
+    } else {
+      out.push(0xce)
+      writeUint32(out, n)
+    }
+  } else if (Number.isInteger(n) && n < 0 && n >= -0x80000000) {
+    if (n >= -32) {
+      out.push(n & 0xff)
+    } else {
+      out.push(0xd2)
+      writeUint32(out, n >>> 0)
+    }
+  } else {
+    const buf = Buffer.alloc(8)
+    buf.writeDoubleBE(n)
+    out.push(0xcb, ...buf)
+  }
+}
+
+export function encode(value: unknown): Buffer {
+  const out: number[] = []
+  encodeValue(value, out)
+  return Buffer.from(out)
+}
+
+class Decoder {
+  private offset = 0
+  constructor(private buf: Buffer) {}
+
+  decode(): unknown {
+    const type = this.buf.readUInt8(this.offset++)
+    if (type <= 0x7f) {
+      return type
+    } else if (type >= 0xe0) {
+      return type - 0x100
+    } else if (type >= 0xa0 && type <= 0xbf) {
+      return this.str(type & 0x1f)
+    } else if (type >= 0x90 && type <= 0x9f) {
+      return this.array(type & 0x0f)
+    } else if (type >= 0x80 && type <= 0x8f) {
+      return this.map(type & 0x0f)
+    }
+    switch (type) {
+      case 0xc0:
+        return null
+      case 0xc2:
+        return false
+      case 0xc3:
+        return true
+      case 0xc4:
+      case 0xd9:
+        return this.str(this.uint(1))
+      case 0xc5:
+      case 0xda:
+        return this.str(this.uint(2))
+      case 0xc6:
+      case 0xdb:
+        return this.str(this.uint(4))
+      case 0xca:
+        return this.read(4, (o) => this.buf.readFloatBE(o))
+      case 0xcb:
+        return this.read(8, (o) => this.buf.readDoubleBE(o))
+      case 0xcc:
+        return this.uint(1)
+      case 0xcd:
+        return this.uint(2)
+      case 0xce:
+        return this.uint(4)
+      case 0xcf:
+        return Number(this.read(8, (o) => this.buf.readBigUInt64BE(o)))
+      case 0xd0:
+        return this.read(1, (o) => this.buf.readInt8(o))
+      case 0xd1:
+        return this.read(2, (o) => this.buf.readInt16BE(o))
+      case 0xd2:
+        return this.read(4, (o) => this.buf.readInt32BE(o))
+      case 0xd3:
+        return Number(this.read(8, (o) => this.buf.readBigInt64BE(o)))
+      case 0xdc:
+        return this.array(this.uint(2))
+      case 0xdd:
+        return this.array(this.uint(4))
+      case 0xde:
+        return this.map(this.uint(2))
+      case 0xdf:
+        return this.map(this.uint(4))
+    }
+    throw new Error(`unsupported MessagePack type: ${type}`)
+  }
+  get done(): boolean {
+    return this.offset >= this.buf.length
+  }
+
+  private read<T>(size: number, reader: (offset: number) => T): T {
+    const v = reader(this.offset)
+    this.offset += size
+    return v
+  }
+  private uint(size: number): number {
+    return this.read(size, (o) => this.buf.readUIntBE(o, size))
+  }
+  private str(size: number): string {
+    if (this.offset + size > this.buf.length) {
+      throw new RangeError('MessagePack data is truncated')
+    }
+    const s = this.buf.toString('utf8', this.offset, this.offset + size)
+    this.offset += size
+    return s
+  }
+  private array(size: number): unknown[] {
+    const a: unknown[] = []
+    for (let i = 0; i < size; ++i) {
+      a.push(this.decode())
+    }
+    return a
+  }
+  private map(size: number): Record<string, unknown> {
+    const m: Record<string, unknown> = {}
+    for (let i = 0; i < size; ++i) {
+      const key = String(this.decode())
+      m[key] = this.decode()
+    }
+    return m
+  }
+}
+
+export function decode(buf: Buffer): unknown {
+  const decoder = new Decoder(buf)
+  const value = decoder.decode()
+  if (!decoder.done) {
+    throw new Error('MessagePack data has trailing bytes')
+  }
+  return value
+}
+
+// 4 bytes big endian length prefixed frame
+export function frame(data: Buffer): Buffer {
+  const header = Buffer.alloc(4)
+  header.writeUInt32BE(data.length)
+  return Buffer.concat([header, data])
+}
@@ -1,27 +1,76 @@
+#include <cstring>
 #include <iostream>
 
 #include "lrdb/server.hpp"
 
-typedef std::unique_ptr<lrdb::server> server_ptr;
+// activated server. detached mode use threaded server.
+struct server_holder {
+  std::unique_ptr<lrdb::server> server;
+  std::unique_ptr<lrdb::threaded_server> detached_server;
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+  std::unique_ptr<lrdb::local_server> local_server;
+  std::unique_ptr<lrdb::threaded_local_server> detached_local_server;
+#endif
+  void reset() {
+    server.reset();
+    detached_server.reset();
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+    local_server.reset();
+    detached_local_server.reset();
+#endif
+  }
+};
 
+template <typename Server, typename DetachedServer, typename Address>
+void activate(lua_State* L, std::unique_ptr<Server>& server,
+              std::unique_ptr<DetachedServer>& detached_server,
+              const Address& address, const char* mode) {
+  if (mode && strcmp(mode, "detached") == 0) {
+    detached_server.reset(new DetachedServer(address));
+    detached_server->reset_on_connect(L);
+  } else {
+    server.reset(new Server(address));
+    server->reset(L);
+  }
+}
+
+/// lrdb_server.activate([port or path [, mode]])
+/// string that is not number is path of Unix domain socket.
+/// mode "detached": debug target runs without hook until client connected.
+/// otherwise wait for connection by debug client.
 int lrdb_activate(lua_State* L) {
-  server_ptr* server = (server_ptr*)lua_touserdata(L, lua_upvalueindex(1));
+  server_holder* holder =
+      (server_holder*)lua_touserdata(L, lua_upvalueindex(1));
+  uint16_t port = 21110;
+  const char* path = 0;
   if (lua_isnumber(L, 1)) {
-    server->reset(new lrdb::server((int16_t)lua_tonumber(L, 1)));
+    port = (uint16_t)lua_tonumber(L, 1);
+  } else if (lua_type(L, 1) == LUA_TSTRING) {
+    path = lua_tostring(L, 1);
+  }
+  const char* mode = lua_tostring(L, 2);
+  holder->reset();
+  if (path) {
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+    activate(L, holder->local_server, holder->detached_local_server,
+             std::string(path), mode);
+#else
+    return luaL_error(L, "Unix domain socket is not supported");
+#endif
   } else {
-    server->reset(new lrdb::server(21110));
+    activate(L, holder->server, holder->detached_server, port, mode);
   }
-  (*server)->reset(L);
   return 0;
 }
 int lrdb_deactivate(lua_State* L) {
-  server_ptr* server = (server_ptr*)lua_touserdata(L, lua_upvalueindex(1));
-  server->reset();
+  server_holder* holder =
+      (server_holder*)lua_touserdata(L, lua_upvalueindex(1));
+  holder->reset();
   return 0;
 }
 int lrdb_destruct(lua_State* L) {
-  server_ptr* server = (server_ptr*)lua_touserdata(L, 1);
-  server->~server_ptr();
+  server_holder* holder = (server_holder*)lua_touserdata(L, 1);
+  holder->~server_holder();
   return 0;
 }
 
@@ -35,8 +84,8 @@ extern "C" __attribute__((visibility("default")))
   lua_createtable(L, 0, 3);
   int mod = lua_gettop(L);
 
-  void* storage = lua_newuserdata(L, sizeof(server_ptr));
-  new (storage) server_ptr();
+  void* storage = lua_newuserdata(L, sizeof(server_holder));
+  new (storage) server_holder();
   int sserver = lua_gettop(L);
   lua_createtable(L, 0, 1);
   lua_pushcclosure(L, &lrdb_destruct, 0);
@@ -51,4 +100,4 @@ extern "C" __attribute__((visibility("default")))
 
   lua_pushvalue(L, mod);
   return 1;
-}
\ No newline at end of file
+}
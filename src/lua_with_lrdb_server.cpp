@@ -1,3 +1,4 @@
+#include <fstream>
 #include <iostream>
 
 #ifdef LRDB_ENABLE_STDINOUT_STREAM
@@ -30,8 +31,22 @@ int exec(const char* program, DebugServer& debug_server, int argc,
   return ret ? 1 : 0;
 }
 
+// run program without debug server, and write line coverage in lcov format
+int exec_coverage(const char* program, const char* coverage_file, int argc,
+                  char* argv[]) {
+  lrdb::debugger debugger;
+  debugger.unpause();
+  debugger.start_coverage();
+  int ret = exec(program, debugger, argc, argv);
+  std::ofstream ofs(coverage_file);
+  ofs << debugger.coverage().lcov();
+  return ret;
+}
+
 int main(int argc, char* argv[]) {
   int port = 0;
+  const char* socket_path = 0;
+  const char* coverage_file = 0;
   const char* program = 0;
 
   // parse args
@@ -39,9 +54,19 @@ int main(int argc, char* argv[]) {
   for (; i < argc; ++i) {
     if (argv[i][0] == '-') {
       if (i + 1 < argc) {
-        if (strcmp(argv[i], "-p") || strcmp(argv[i], "--port")) {
+        if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) {
           port = atoi(argv[i + 1]);
           ++i;
+        } else if (strcmp(argv[i], "-s") == 0 ||
+                   strcmp(argv[i], "--socket") == 0) {
+          socket_path = argv[i + 1];
+          ++i;
+        } else if (strcmp(argv[i], "-c") == 0 ||
+                   strcmp(argv[i], "--coverage") == 0) {
+          coverage_file = argv[i + 1];
+          ++i;
+        } else {
+          return 1;  // invalid argument
         }
       } else {
         return 1;  // invalid argument
@@ -57,6 +82,18 @@ int main(int argc, char* argv[]) {
   }
   std::cout << LUA_COPYRIGHT << std::endl;
 
+  if (coverage_file) {
+    return exec_coverage(program, coverage_file, argc - i, &argv[i]);
+  }
+
+  if (socket_path) {
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+    lrdb::local_server debug_server((std::string(socket_path)));
+    return exec(program, debug_server, argc - i, &argv[i]);
+#else
+    return -1;
+#endif
+  }
   if (port == 0)  // if no port use std::cin and std::cout
   {
 #ifdef LRDB_ENABLE_STDINOUT_STREAM
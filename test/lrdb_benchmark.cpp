@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "lrdb/debugger.hpp"
+#include "lrdb/message.hpp"
+#include "lrdb/server.hpp"
+
+// Micro benchmark for debugger hook overhead.
+// Not registered to ctest. usage: lrdb_benchmark [iterations]
+
+namespace {
+std::atomic<size_t> allocation_count(0);
+}
+
+// count heap allocations for serialize benchmark
+void* operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+#ifdef LRDB_USE_BOOST_ASIO
+using namespace boost::asio;
+#endif
+
+const char* BENCH_LUA_SCRIPT =
+    "local n = 0\n"
+    "for i = 1, ... do\n"
+    "  n = n + i\n"
+    "end\n"
+    "return n\n";
+const char* BENCH_LUA_SCRIPT_NAME = "@bench_loop.lua";
+const int BENCH_LUA_HOT_LINE = 3;
+
+// sampled call stack is 20 levels deep
+const char* BENCH_CALL_SCRIPT =
+    "local function f(depth, n)\n"
+    "  if depth > 0 then\n"
+    "    return f(depth - 1, n) + 1\n"
+    "  end\n"
+    "  local s = 0\n"
+    "  for i = 1, n do\n"
+    "    s = s + i\n"
+    "  end\n"
+    "  return s\n"
+    "end\n"
+    "local n = 0\n"
+    "for i = 1, ... do\n"
+    "  n = n + f(20, 100)\n"
+    "end\n"
+    "return n\n";
+const char* BENCH_CALL_SCRIPT_NAME = "@bench_call.lua";
+
+/// @brief run benchmark loop script
+/// @return elapsed seconds. negative if script error
+double run_loop_script(lua_State* L, int iterations,
+                       const char* script = BENCH_LUA_SCRIPT,
+                       const char* script_name = BENCH_LUA_SCRIPT_NAME) {
+  if (luaL_loadbuffer(L, script, strlen(script), script_name) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return -1;
+  }
+  lua_pushinteger(L, iterations);
+  auto start = std::chrono::steady_clock::now();
+  int ret = lua_pcall(L, 1, 1, 0);
+  auto end = std::chrono::steady_clock::now();
+  if (ret != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return -1;
+  }
+  lua_pop(L, 1);
+  return std::chrono::duration<double>(end - start).count();
+}
+
+void report(const char* name, int iterations, double seconds) {
+  printf("%-46s %10.1f ns/iter %12.0f iter/sec\n", name,
+         seconds * 1e9 / iterations, iterations / seconds);
+}
+
+/// @brief run script once with new lua state
+/// @param setup configure debugger before run. null is without debugger
+/// @param call run call script instead of loop script
+/// @return elapsed seconds. negative if script error
+double run_once(int iterations, std::function<void(lrdb::debugger&)> setup,
+                bool call = false) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  double seconds = -1;
+  {
+    lrdb::debugger debugger;
+    if (setup) {
+      debugger.reset(L);
+      debugger.unpause();
+      setup(debugger);
+    }
+    seconds = call ? run_loop_script(L, iterations, BENCH_CALL_SCRIPT,
+                                     BENCH_CALL_SCRIPT_NAME)
+                   : run_loop_script(L, iterations);
+    debugger.reset();
+  }
+  lua_close(L);
+  return seconds;
+}
+
+/// @brief run benchmark with new lua state
+/// @param setup configure debugger before run. null is without debugger
+void bench(const char* name, int iterations,
+           std::function<void(lrdb::debugger&)> setup) {
+  double seconds = run_once(iterations, setup);
+  if (seconds >= 0) {
+    report(name, iterations, seconds);
+  }
+}
+
+/// @brief overhead of profiler against idle debugger, whose count hook
+/// already costs on every instruction. Runs are interleaved and the fastest
+/// of each is compared, so that drift of machine is cancelled.
+/// @param setup start profiler
+/// @param call run call script instead of loop script
+void bench_overhead(const char* name, int iterations,
+                    std::function<void(lrdb::debugger&)> setup,
+                    bool call = false) {
+  const int repeat = 10;
+  double idle = -1;
+  double profiled = -1;
+  for (int i = 0; i < repeat; ++i) {
+    double seconds = run_once(iterations, [](lrdb::debugger&) {}, call);
+    if (seconds < 0) {
+      return;
+    }
+    idle = idle < 0 ? seconds : std::min(idle, seconds);
+    seconds = run_once(iterations, setup, call);
+    if (seconds < 0) {
+      return;
+    }
+    profiled = profiled < 0 ? seconds : std::min(profiled, seconds);
+  }
+  printf("%-46s %10.1f %% (%.1f / %.1f ns/iter)\n", name,
+         (profiled / idle - 1) * 100, profiled * 1e9 / iterations,
+         idle * 1e9 / iterations);
+}
+
+/// @brief run benchmark with debug server and connected idle client.
+/// client set breakpoint on never reached line of script, then line hook is
+/// enabled on loop.
+template <typename Server>
+void bench_server(const char* name, int iterations,
+                  std::function<void(Server&)> setup) {
+  const uint16_t port = 21116;
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    Server server(port);
+    setup(server);
+    server.reset(L);
+    asio::ip::tcp::iostream client;
+    std::thread connect([&] {
+      client.connect("localhost", std::to_string(port));
+      lrdb::json::object breakpoint;
+      breakpoint["file"] = lrdb::json::value("bench_loop.lua");
+      breakpoint["line"] = lrdb::json::value(100.);
+      client << lrdb::message::request::serialize(
+                    0, "add_breakpoint", lrdb::json::value(breakpoint))
+             << std::endl;
+      client << lrdb::message::request::serialize(1, "continue") << std::endl;
+    });
+    run_loop_script(L, 1);  // wait for connection and continue from entry
+    connect.join();
+
+    double seconds = run_loop_script(L, iterations);
+    if (seconds >= 0) {
+      report(name, iterations, seconds);
+    }
+    server.reset();
+    client.close();
+  }
+  lua_close(L);
+}
+
+const char* BENCH_BIG_TABLE_SCRIPT =
+    "local t = {}\n"
+    "for i = 1, 10000 do\n"
+    "  t['key' .. i] = {name = 'item' .. i, value = i * 0.5, tags = {1, 2}}\n"
+    "end\n"
+    "return t\n";
+
+/// @brief serialize big table to response message
+/// @param serialize return message size
+void bench_serialize(const char* name, int iterations,
+                     std::function<size_t(lua_State*)> serialize) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  if (luaL_dostring(L, BENCH_BIG_TABLE_SCRIPT) == 0) {
+    size_t bytes = 0;
+    size_t allocations = allocation_count.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      bytes += serialize(L);
+    }
+    auto end = std::chrono::steady_clock::now();
+    allocations = allocation_count.load() - allocations;
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%-46s %10.1f allocs/iter %9.1f MB/sec\n", name,
+           double(allocations) / iterations, bytes / seconds / 1e6);
+  }
+  lua_close(L);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+  if (iterations <= 0) {
+    return 1;
+  }
+
+  bench("no debugger", iterations, nullptr);
+  bench("idle", iterations, [](lrdb::debugger&) {});
+  bench("breakpoint on other file", iterations, [](lrdb::debugger& debugger) {
+    debugger.add_breakpoint("other.lua", BENCH_LUA_HOT_LINE);
+  });
+  bench("conditional breakpoint (never true)", iterations,
+        [](lrdb::debugger& debugger) {
+          debugger.add_breakpoint("bench_loop.lua", BENCH_LUA_HOT_LINE,
+                                  "i < 0");
+        });
+  bench("hit condition breakpoint (never true)", iterations,
+        [](lrdb::debugger& debugger) {
+          debugger.add_breakpoint("bench_loop.lua", BENCH_LUA_HOT_LINE, "",
+                                  "==0");
+        });
+  bench("line counts on hot file", iterations, [](lrdb::debugger& debugger) {
+    debugger.start_line_counts("bench_loop.lua");
+  });
+  auto start_sampling = [](lrdb::debugger& debugger) {
+    debugger.profiler().start(std::chrono::microseconds(1000));
+  };
+  bench("sampling profiler 1kHz", iterations, start_sampling);
+  bench_overhead("sampling profiler 1kHz overhead", iterations,
+                 start_sampling);
+  bench_overhead("sampling profiler 1kHz overhead, call depth 20",
+                 std::max(iterations / 100, 1), start_sampling, true);
+
+  bench_server<lrdb::server>(
+      "server idle client, poll every tick", iterations,
+      [](lrdb::server& server) {
+        server.set_poll_interval(1, std::chrono::microseconds(0));
+      });
+  bench_server<lrdb::server>("server idle client, default poll", iterations,
+                             [](lrdb::server&) {});
+  bench_server<lrdb::threaded_server>(
+      "threaded server idle client, poll every tick", iterations,
+      [](lrdb::threaded_server& server) {
+        server.set_poll_interval(1, std::chrono::microseconds(0));
+      });
+
+  const int serialize_iterations = std::max(iterations / 100000, 10);
+  const int serialize_depth = 3;
+  bench_serialize("big table response by to_json", serialize_iterations,
+                  [&](lua_State* L) {
+                    lrdb::message::response_message response(
+                        1, lrdb::utility::to_json(L, -1, serialize_depth));
+                    return lrdb::message::serialize(response).size();
+                  });
+  lrdb::json_writer writer;
+  bench_serialize("big table response by json_writer", serialize_iterations,
+                  [&](lua_State* L) {
+                    writer.clear();
+                    writer.begin_object();
+                    writer.key("jsonrpc");
+                    writer.value("2.0");
+                    writer.key("result");
+                    lrdb::utility::write_json(writer, L, -1, serialize_depth);
+                    writer.key("id");
+                    writer.value(1.0);
+                    writer.end_object();
+                    return writer.str().size();
+                  });
+
+  {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    {
+      lrdb::threaded_server server(21116);
+      server.reset_on_connect(L);
+      double seconds = run_loop_script(L, iterations);
+      if (seconds >= 0) {
+        report("threaded server attach on connect, no client", iterations,
+               seconds);
+      }
+      server.reset();
+    }
+    lua_close(L);
+  }
+  return 0;
+}
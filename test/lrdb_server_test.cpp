@@ -1,11 +1,18 @@
 
+#include <algorithm>
+#include <future>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 #include "lrdb/client.hpp"
 #include "lrdb/message.hpp"
 #include "lrdb/server.hpp"
 
+#ifdef LRDB_HAS_SHARED_MEMORY_STREAM
+#include <sys/wait.h>
+#endif
+
 #include "gtest/gtest.h"
 
 namespace {
@@ -13,12 +20,13 @@ namespace {
 #ifdef LRDB_USE_BOOST_ASIO
 using namespace boost::asio;
 #endif
-class DebugServerTest : public ::testing::Test {
+template <typename Server>
+class BasicDebugServerTest : public ::testing::Test {
  protected:
-  DebugServerTest()
+  BasicDebugServerTest()
       : server(21115), client_stream("localhost", "21115"), pause_(0) {}
 
-  virtual ~DebugServerTest() {}
+  virtual ~BasicDebugServerTest() {}
 
   virtual void SetUp() {
     L = luaL_newstate();
@@ -33,7 +41,7 @@ class DebugServerTest : public ::testing::Test {
     L = 0;
   }
   lua_State* L;
-  lrdb::server server;
+  Server server;
   asio::ip::tcp::iostream client_stream;
 
   std::function<void(const lrdb::json::value&)> notify_handler;
@@ -77,6 +85,52 @@ class DebugServerTest : public ::testing::Test {
     return error_res;
   }
 
+  /// @brief sync_request after set_format "msgpack"
+  lrdb::json::value msgpack_request(
+      const std::string& method,
+      const lrdb::json::value& param = lrdb::json::value()) {
+    int rid = rid_++;
+    lrdb::json::value req;
+    lrdb::json::parse(req,
+                      lrdb::message::request::serialize(rid, method, param));
+    write_frame(lrdb::message::msgpack::encode(req));
+
+    while (true) {
+      lrdb::json::value v;
+      if (!read_frame(v)) {
+        return lrdb::json::value();
+      }
+      const lrdb::json::value& resid = lrdb::message::get_id(v);
+      if (resid.is<double>() && resid.get<double>() == rid) {
+        return v;
+      } else {
+        notify(v);
+      }
+    }
+  }
+  void write_frame(const std::string& data) {
+    uint32_t size = uint32_t(data.size());
+    for (int i = 3; i >= 0; --i) {
+      client_stream.put(char((size >> (i * 8)) & 0xff));
+    }
+    client_stream << data << std::flush;
+  }
+  bool read_frame(lrdb::json::value& v) {
+    char header[4];
+    if (!client_stream.read(header, 4)) {
+      return false;
+    }
+    uint32_t size = 0;
+    for (int i = 0; i < 4; ++i) {
+      size = (size << 8) | uint8_t(header[i]);
+    }
+    std::string data(size, '\0');
+    if (!client_stream.read(&data[0], size)) {
+      return false;
+    }
+    return lrdb::message::msgpack::decode(data, v).empty();
+  }
+
   void notify(const lrdb::json::value& v) {
     if (notify_handler) {
       notify_handler(v);
@@ -114,37 +168,48 @@ class DebugServerTest : public ::testing::Test {
     ASSERT_STREQ(0, errorstring);
   }
 };
+typedef BasicDebugServerTest<lrdb::server> DebugServerTest;
 }
 
-TEST_F(DebugServerTest, ConnectTest1) {
+typedef ::testing::Types<lrdb::server, lrdb::threaded_server> ServerTypes;
+TYPED_TEST_CASE(BasicDebugServerTest, ServerTypes);
+
+TYPED_TEST(BasicDebugServerTest, ConnectTest1) {
   const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
 
   std::thread client([&] {
-
     lrdb::json::object break_point;
     break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
     break_point["line"] = lrdb::json::value(5.);
 
     lrdb::json::value res =
-        sync_request("add_breakpoint", lrdb::json::value(break_point));
+        this->sync_request("add_breakpoint", lrdb::json::value(break_point));
     ASSERT_TRUE(res.evaluate_as_boolean());
-    res = sync_request("get_breakpoints");
+    res = this->sync_request("get_breakpoints");
     ASSERT_TRUE(res.evaluate_as_boolean());
 
-    res = sync_request("get_stacktrace");
+    res = this->sync_request("get_stacktrace");
     ASSERT_TRUE(res.evaluate_as_boolean());
 
-    res = sync_request("continue");
+    res = this->sync_request("continue");
     ASSERT_TRUE(res.evaluate_as_boolean());
-    wait_for_paused();
-    res = sync_request("continue");
+    this->wait_for_paused();
+
+    lrdb::json::object stack_var_req_param_obj;
+    stack_var_req_param_obj["stack_no"] = lrdb::json::value(0.);
+    res = this->sync_request("get_local_variable",
+                             lrdb::json::value(stack_var_req_param_obj));
     ASSERT_TRUE(res.evaluate_as_boolean());
+    ASSERT_TRUE(lrdb::message::get_id(res).is<double>());
 
-    client_stream.close();
+    res = this->sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    this->client_stream.close();
   });
 
-  luaDofile(L, TEST_LUA_SCRIPT);
-  server.exit();
+  this->luaDofile(this->L, TEST_LUA_SCRIPT);
+  this->server.exit();
 
   client.join();
 }
@@ -278,6 +343,806 @@ TEST_F(DebugServerTest, ConnectTest5) {
   client.join();
 }
 
+TEST_F(DebugServerTest, PauseRequestTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/pause_loop.lua";
+
+  server.set_poll_interval(100000, std::chrono::microseconds(1000));
+  std::thread client([&] {
+    lrdb::json::value res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    res = sync_request("pause");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    std::string reason;
+    notify_handler = [&](const lrdb::json::value& v) {
+      if (lrdb::message::get_method(v) == "paused") {
+        reason = lrdb::message::get_param(v).get("reason").to_str();
+      }
+    };
+    while (!pause_) {
+      std::string line;
+      std::getline(client_stream, line, '\n');
+      lrdb::json::value v;
+      ASSERT_TRUE(lrdb::json::parse(v, line).empty());
+      notify(v);
+    }
+    notify_handler = nullptr;
+    ASSERT_EQ("pause", reason);
+
+    lrdb::json::object eval_param;
+    eval_param["chunk"] = lrdb::json::value("_G.stop = true");
+    eval_param["stack_no"] = lrdb::json::value(0.);
+    sync_request("eval", lrdb::json::value(eval_param));
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TEST_F(DebugServerTest, ProfileRequestTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/profile_test1.lua";
+
+  std::thread client([&] {
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(13.);
+    break_point["hit_condition"] = lrdb::json::value("==5");
+    lrdb::json::value res =
+        sync_request("add_breakpoint", lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    lrdb::json::object profile_param;
+    profile_param["interval"] = lrdb::json::value(0.);
+    res = sync_request("profile_start", lrdb::json::value(profile_param));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    ASSERT_FALSE(res.contains("error"));
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    res = sync_request("profile_stop");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    const lrdb::json::value& result = res.get("result");
+    ASSERT_LT(0., result.get("samples").get<double>());
+    ASSERT_NE(std::string::npos,
+              result.get("collapsed").to_str().find("leaf ("));
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TEST_F(DebugServerTest, ParamlessRequestTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
+
+  std::thread client([&] {
+    // params are optional for these requests
+    const char* methods[] = {"profile_start",       "profile_stop",
+                             "coverage_start",      "get_coverage",
+                             "coverage_stop",       "alloc_profile_start",
+                             "alloc_profile_stop",  "heap_snapshot",
+                             "heap_baseline",       "heap_diff",
+                             "stop_line_counts"};
+    for (const char* method : methods) {
+      lrdb::json::value res = sync_request(method);
+      ASSERT_TRUE(res.evaluate_as_boolean()) << method;
+      ASSERT_FALSE(res.contains("error")) << method;
+    }
+    // required params are missing
+    lrdb::json::value res = sync_request("start_line_counts");
+    ASSERT_TRUE(res.contains("error"));
+    res = sync_request("get_line_counts");
+    ASSERT_TRUE(res.contains("error"));
+    // params must be object
+    res = sync_request("get_global", lrdb::json::value(lrdb::json::array()));
+    ASSERT_TRUE(res.contains("error"));
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+TEST_F(DebugServerTest, ResultCacheTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/variable_reference_test1.lua";
+
+  std::thread client([&] {
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(9.);
+    lrdb::json::value res =
+        sync_request("add_breakpoint", lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    lrdb::json::object param;
+    param["stack_no"] = lrdb::json::value(0.);
+    param["depth"] = lrdb::json::value(2.);
+    res = sync_request("get_local_variable", lrdb::json::value(param));
+    lrdb::json::value locals = res.get("result");
+    ASSERT_EQ(3U, locals.get("list").get<lrdb::json::array>().size());
+    res = sync_request("get_local_variable", lrdb::json::value(param));
+    ASSERT_EQ(locals, res.get("result"));
+    ASSERT_EQ(double(rid_ - 1), res.get("id").get<double>());
+
+    res = sync_request("get_stacktrace");
+    lrdb::json::value stacktrace = res.get("result");
+    res = sync_request("get_stacktrace");
+    ASSERT_EQ(stacktrace, res.get("result"));
+
+    // eval discards cached results
+    lrdb::json::object eval_param;
+    eval_param["chunk"] = lrdb::json::value("table.insert(list, 40)");
+    eval_param["stack_no"] = lrdb::json::value(0.);
+    res = sync_request("eval", lrdb::json::value(eval_param));
+    ASSERT_FALSE(res.contains("error"));
+    res = sync_request("get_local_variable", lrdb::json::value(param));
+    ASSERT_EQ(
+        4U, res.get("result").get("list").get<lrdb::json::array>().size());
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TEST_F(DebugServerTest, BatchRequestTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/variable_reference_test1.lua";
+
+  std::thread client([&] {
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(9.);
+    lrdb::json::value res =
+        sync_request("add_breakpoint", lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    lrdb::json::object frame;
+    frame["stack_no"] = lrdb::json::value(0.);
+    lrdb::json::object eval_param(frame);
+    eval_param["chunk"] = lrdb::json::value("value");
+    lrdb::json::array batch;
+    lrdb::json::parse(batch.emplace_back(),
+                      lrdb::message::request::serialize(100, "get_stacktrace"));
+    lrdb::json::parse(
+        batch.emplace_back(),
+        lrdb::message::request::serialize(101, "get_local_variable",
+                                          lrdb::json::value(frame)));
+    lrdb::json::parse(batch.emplace_back(),
+                      lrdb::message::request::serialize(
+                          102, "eval", lrdb::json::value(eval_param)));
+    batch.emplace_back(lrdb::json::object());
+    lrdb::json::parse(batch.emplace_back(),
+                      lrdb::message::request::serialize(103, "unknown"));
+    client_stream << lrdb::json::value(batch).serialize() << std::endl;
+
+    lrdb::json::value responses;
+    while (!responses.is<lrdb::json::array>()) {
+      std::string line;
+      std::getline(client_stream, line, '\n');
+      ASSERT_FALSE(client_stream.bad());
+      ASSERT_EQ("", lrdb::json::parse(responses, line));
+    }
+    const lrdb::json::array& results = responses.get<lrdb::json::array>();
+    ASSERT_EQ(5U, results.size());
+    ASSERT_EQ(100., results[0].get("id").get<double>());
+    ASSERT_TRUE(results[0].get("result").is<lrdb::json::array>());
+    ASSERT_EQ(101., results[1].get("id").get<double>());
+    ASSERT_EQ("abc",
+              results[1].get("result").get("value").get<std::string>());
+    ASSERT_EQ(102., results[2].get("id").get<double>());
+    ASSERT_EQ("abc", results[2].get("result").get(0).get<std::string>());
+    ASSERT_TRUE(results[3].get("id").is<lrdb::json::null>());
+    ASSERT_TRUE(results[3].contains("error"));
+    ASSERT_EQ(103., results[4].get("id").get<double>());
+    ASSERT_TRUE(results[4].contains("error"));
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TEST_F(DebugServerTest, SendQueueTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/variable_reference_test1.lua";
+
+  // every message over limit is written before next one
+  server.command_stream().set_send_queue_limit(
+      1024, lrdb::command_stream_socket::BLOCK);
+  std::string snapshot;
+  notify_handler = [&](const lrdb::json::value& v) {
+    if (lrdb::message::get_method(v) == "heap_snapshot_chunk") {
+      snapshot += v.get("params").get("data").get<std::string>();
+    }
+  };
+  std::thread client([&] {
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(9.);
+    lrdb::json::value res =
+        sync_request("add_breakpoint", lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    // many small notifies are queued while client is not reading
+    // response is sent after all chunks
+    lrdb::json::object param;
+    param["chunk_size"] = lrdb::json::value(256.);
+    res = sync_request("heap_snapshot", lrdb::json::value(param));
+    ASSERT_TRUE(res.get("result").is<lrdb::json::object>());
+    res = sync_request("get_stacktrace");
+    ASSERT_TRUE(res.get("result").is<lrdb::json::array>());
+    ASSERT_FALSE(snapshot.empty());
+    std::istringstream is(snapshot);
+    std::string line;
+    size_t nodes = 0;
+    while (std::getline(is, line)) {
+      if (line.compare(0, 2, "N ") == 0) {
+        ASSERT_EQ("N " + std::to_string(nodes) + " ",
+                  line.substr(0, 3 + std::to_string(nodes).size()));
+        nodes++;
+      }
+    }
+    ASSERT_LT(0U, nodes);
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TEST_F(DebugServerTest, SendQueueDisconnectTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/variable_reference_test1.lua";
+
+  server.command_stream().set_send_queue_limit(
+      1024, lrdb::command_stream_socket::DISCONNECT);
+  std::promise<std::string> overflow;
+  bool overflowed = false;
+  server.command_stream().on_error = [&](const std::string& message) {
+    if (!overflowed) {
+      overflowed = true;
+      overflow.set_value(message);
+    }
+  };
+  std::thread client([&] {
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(9.);
+    lrdb::json::value res =
+        sync_request("add_breakpoint", lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    res = sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    wait_for_paused();
+
+    // response larger than socket buffers is queued over limit while client
+    // is not reading
+    client_stream.rdbuf()->set_option(
+        asio::socket_base::receive_buffer_size(4096));
+    lrdb::json::object eval_param;
+    eval_param["chunk"] =
+        lrdb::json::value("return string.rep('x', 16 * 1024 * 1024)");
+    eval_param["stack_no"] = lrdb::json::value(0.);
+    client_stream << lrdb::message::request::serialize(
+                         rid_++, "eval", lrdb::json::value(eval_param))
+                  << std::endl;
+    std::future<std::string> error = overflow.get_future();
+    ASSERT_EQ(std::future_status::ready,
+              error.wait_for(std::chrono::seconds(10)));
+    ASSERT_EQ("send queue overflow", error.get());
+
+    client_stream.close();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  server.exit();
+
+  client.join();
+}
+
+TYPED_TEST(BasicDebugServerTest, MsgpackFormatTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/variable_reference_test1.lua";
+
+  lrdb::json::value formats;
+  this->notify_handler = [&](const lrdb::json::value& v) {
+    if (lrdb::message::get_method(v) == "connected") {
+      formats = v.get("params").get("formats");
+    }
+  };
+  std::thread client([&] {
+    lrdb::json::object format;
+    format["format"] = lrdb::json::value("msgpack");
+    lrdb::json::value res =
+        this->sync_request("set_format", lrdb::json::value(format));
+    ASSERT_FALSE(res.contains("error"));
+    ASSERT_TRUE(formats.is<lrdb::json::array>());
+    ASSERT_EQ(2U, formats.get<lrdb::json::array>().size());
+    ASSERT_EQ("msgpack", formats.get(1).get<std::string>());
+
+    lrdb::json::object break_point;
+    break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+    break_point["line"] = lrdb::json::value(9.);
+    res = this->msgpack_request("add_breakpoint",
+                                lrdb::json::value(break_point));
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    ASSERT_FALSE(res.contains("error"));
+
+    res = this->msgpack_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+    // "running" and then "paused" at breakpoint
+    while (true) {
+      lrdb::json::value v;
+      ASSERT_TRUE(this->read_frame(v));
+      this->notify(v);
+      if (lrdb::message::get_method(v) == "paused") {
+        break;
+      }
+    }
+
+    lrdb::json::object frame;
+    frame["stack_no"] = lrdb::json::value(0.);
+    res = this->msgpack_request("get_local_variable", lrdb::json::value(frame));
+    ASSERT_EQ("abc", res.get("result").get("value").get<std::string>());
+    ASSERT_EQ(3U,
+              res.get("result").get("list").get<lrdb::json::array>().size());
+    ASSERT_EQ(20., res.get("result").get("list").get(1).get<double>());
+    // cached result
+    lrdb::json::value cached =
+        this->msgpack_request("get_local_variable", lrdb::json::value(frame));
+    ASSERT_EQ(res.get("result"), cached.get("result"));
+
+    format["format"] = lrdb::json::value("json");
+    res = this->msgpack_request("set_format", lrdb::json::value(format));
+    ASSERT_FALSE(res.contains("error"));
+
+    res = this->sync_request("get_local_variable", lrdb::json::value(frame));
+    ASSERT_EQ("abc", res.get("result").get("value").get<std::string>());
+
+    res = this->sync_request("continue");
+    ASSERT_TRUE(res.evaluate_as_boolean());
+
+    this->client_stream.close();
+  });
+
+  this->luaDofile(this->L, TEST_LUA_SCRIPT);
+  this->server.exit();
+
+  client.join();
+}
+
+TYPED_TEST(BasicDebugServerTest, OversizedFrameTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
+
+  std::thread client([&] {
+    lrdb::json::object format;
+    format["format"] = lrdb::json::value("msgpack");
+    lrdb::json::value res =
+        this->sync_request("set_format", lrdb::json::value(format));
+    ASSERT_FALSE(res.contains("error"));
+
+    // length prefix over max_frame_size closes connection
+    for (int i = 0; i < 4; ++i) {
+      this->client_stream.put(char(0xff));
+    }
+    this->client_stream << std::flush;
+    // paused target is resumed by the close
+    lrdb::json::value v;
+    while (this->read_frame(v)) {
+    }
+    this->client_stream.close();
+  });
+
+  this->luaDofile(this->L, TEST_LUA_SCRIPT);
+  this->server.exit();
+
+  client.join();
+}
+
+TEST(DetachedDebugServerTest, AttachOnConnectTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/pause_loop.lua";
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    lrdb::threaded_server server(21117);
+    server.set_poll_interval(1, std::chrono::microseconds(0));
+    server.reset_on_connect(L);
+    ASSERT_EQ(0, lua_gethookmask(L));
+    ASSERT_EQ(0, luaL_dostring(L, "for i = 1, 1000 do end"));
+    ASSERT_EQ(0, lua_gethookmask(L));
+
+    std::thread client([&] {
+      asio::ip::tcp::iostream client_stream("localhost", "21117");
+      client_stream << lrdb::message::request::serialize(0, "pause")
+                    << std::endl;
+      std::string line;
+      while (std::getline(client_stream, line, '\n')) {
+        lrdb::json::value v;
+        ASSERT_TRUE(lrdb::json::parse(v, line).empty());
+        if (lrdb::message::get_method(v) == "paused") {
+          break;
+        }
+      }
+      lrdb::json::object eval_param;
+      eval_param["chunk"] = lrdb::json::value("_G.stop = true");
+      eval_param["stack_no"] = lrdb::json::value(0.);
+      client_stream << lrdb::message::request::serialize(
+                           1, "eval", lrdb::json::value(eval_param))
+                    << std::endl;
+      client_stream << lrdb::message::request::serialize(2, "continue")
+                    << std::endl;
+      std::getline(client_stream, line, '\n');
+      std::getline(client_stream, line, '\n');
+      client_stream.close();
+    });
+
+    // run until client stop it
+    ASSERT_EQ(0, luaL_dofile(L, TEST_LUA_SCRIPT));
+    client.join();
+
+    // hook is removed after disconnection
+    for (int i = 0; i < 1000 && lua_gethookmask(L) != 0; ++i) {
+      ASSERT_EQ(0, luaL_dostring(L, "for i = 1, 10000 do end"));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(0, lua_gethookmask(L));
+    server.reset();
+  }
+  lua_close(L);
+}
+
+TEST(DetachedDebugServerTest, AttachOnConnectCoroutineTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/resume_loop.lua";
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    lrdb::threaded_server server(21119);
+    server.set_poll_interval(1, std::chrono::microseconds(0));
+    server.reset_on_connect(L);
+    // coroutine is created and suspended without hook
+    ASSERT_EQ(0, luaL_loadfile(L, TEST_LUA_SCRIPT));
+    ASSERT_EQ(0, lua_pcall(L, 0, 1, 0));
+    ASSERT_EQ(0, lua_gethookmask(L));
+
+    std::thread client([&] {
+      asio::ip::tcp::iostream client_stream("localhost", "21119");
+      lrdb::json::object break_point;
+      break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+      break_point["line"] = lrdb::json::value(3.);
+      client_stream << lrdb::message::request::serialize(
+                           0, "add_breakpoint", lrdb::json::value(break_point))
+                    << std::endl;
+      std::string reason;
+      std::string line;
+      while (std::getline(client_stream, line, '\n')) {
+        lrdb::json::value v;
+        ASSERT_TRUE(lrdb::json::parse(v, line).empty());
+        if (lrdb::message::get_method(v) == "paused") {
+          reason = lrdb::message::get_param(v).get("reason").to_str();
+          break;
+        }
+      }
+      lrdb::json::object eval_param;
+      eval_param["chunk"] = lrdb::json::value("_G.stop = true");
+      eval_param["stack_no"] = lrdb::json::value(0.);
+      client_stream << lrdb::message::request::serialize(
+                           1, "eval", lrdb::json::value(eval_param))
+                    << std::endl;
+      client_stream << lrdb::message::request::serialize(2,
+                                                         "clear_breakpoints")
+                    << std::endl;
+      client_stream << lrdb::message::request::serialize(3, "continue")
+                    << std::endl;
+      std::getline(client_stream, line, '\n');
+      std::getline(client_stream, line, '\n');
+      std::getline(client_stream, line, '\n');
+      client_stream.close();
+      ASSERT_EQ("breakpoint", reason);
+    });
+
+    // run until client stop it at breakpoint in coroutine
+    ASSERT_EQ(0, lua_pcall(L, 0, 0, 0));
+    client.join();
+    server.reset();
+  }
+  lua_close(L);
+}
+
+TEST(DebugClientTest, PipelineTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    lrdb::server server(21118);
+    server.reset(L);
+
+    std::thread client_thread([&] {
+      lrdb::client client;
+      int paused = 0;
+      client.set_notify_handler("paused",
+                                [&](const lrdb::json::value&) { paused++; });
+      ASSERT_TRUE(client.command_stream().connect("localhost", "21118"));
+      while (paused < 1) {
+        client.command_stream().run_one();
+      }
+
+      // many requests without waiting for responses
+      const int REQUEST_COUNT = 1000;
+      int responses = 0;
+      for (int i = 0; i < REQUEST_COUNT; ++i) {
+        client.get_stacktrace([&](const lrdb::json::value& res) {
+          ASSERT_FALSE(res.contains("error"));
+          ASSERT_TRUE(res.get("result").is<lrdb::json::array>());
+          responses++;
+        });
+      }
+      int id = client.add_breakpoint(TEST_LUA_SCRIPT, 6);
+      ASSERT_EQ(size_t(REQUEST_COUNT + 1), client.pending_count());
+      ASSERT_TRUE(client.wait_all());
+      ASSERT_EQ(REQUEST_COUNT, responses);
+      lrdb::json::value res;
+      ASSERT_TRUE(client.wait_response(id, res));
+      ASSERT_FALSE(res.contains("error"));
+
+      client.unpause();
+      while (paused < 2) {
+        ASSERT_TRUE(client.command_stream().is_open());
+        client.command_stream().run_one();
+      }
+
+      // requests after set_format are sent in MessagePack
+      client.set_format("msgpack");
+      id = client.get_local_variable(0);
+      ASSERT_TRUE(client.wait_response(id, res));
+      ASSERT_EQ("abc",
+                res.get("result").get("local_array").get(2).get<std::string>());
+      id = client.eval("return local_array[3]", 0);
+      ASSERT_TRUE(client.wait_response(id, res));
+      ASSERT_EQ("abc", res.get("result").get(0).get<std::string>());
+      // sent without params
+      id = client.stop_line_counts();
+      ASSERT_TRUE(client.wait_response(id, res));
+      ASSERT_FALSE(res.contains("error"));
+
+      // pending requests fail at close
+      bool closed = false;
+      client.get_breakpoints([&](const lrdb::json::value& response) {
+        ASSERT_TRUE(response.contains("error"));
+        closed = true;
+      });
+      client.command_stream().close();
+      ASSERT_TRUE(closed);
+      ASSERT_EQ(0U, client.pending_count());
+    });
+
+    ASSERT_EQ(0, luaL_dofile(L, TEST_LUA_SCRIPT));
+    client_thread.join();
+    server.reset();
+  }
+  lua_close(L);
+}
+
+#ifdef LRDB_HAS_LOCAL_SOCKETS
+TEST(LocalSocketDebugServerTest, ConnectTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
+  const char* SOCKET_PATH = "lrdb_server_test.sock";
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    lrdb::local_server server((std::string(SOCKET_PATH)));
+    server.reset(L);
+
+    std::thread client([&] {
+      asio::local::stream_protocol::iostream client_stream;
+      client_stream.connect(
+          asio::local::stream_protocol::endpoint(SOCKET_PATH));
+      client_stream << lrdb::message::request::serialize(0, "get_stacktrace")
+                    << std::endl;
+      client_stream << lrdb::message::request::serialize(1, "continue")
+                    << std::endl;
+      std::string line;
+      std::vector<std::string> methods;
+      while (std::getline(client_stream, line, '\n')) {
+        lrdb::json::value v;
+        ASSERT_TRUE(lrdb::json::parse(v, line).empty());
+        if (lrdb::message::get_id(v).is<double>()) {
+          ASSERT_FALSE(v.contains("error"));
+        } else {
+          methods.push_back(lrdb::message::get_method(v));
+        }
+        if (lrdb::message::get_id(v) == lrdb::json::value(1.)) {
+          break;
+        }
+      }
+      ASSERT_LE(1U, methods.size());
+      ASSERT_EQ("connected", methods[0]);
+      client_stream.close();
+    });
+
+    ASSERT_EQ(0, luaL_dofile(L, TEST_LUA_SCRIPT));
+    server.exit();
+    client.join();
+    server.reset();
+  }
+  // socket file is removed
+  ASSERT_EQ(nullptr, std::fopen(SOCKET_PATH, "r"));
+  lua_close(L);
+}
+TEST(LocalSocketDebugServerTest, StaleSocketFileTest) {
+  const char* SOCKET_PATH = "lrdb_server_test.sock";
+
+  {
+    // socket file left by crashed process
+    asio::io_service io_service;
+    asio::local::stream_protocol::acceptor acceptor(
+        io_service, asio::local::stream_protocol::endpoint(SOCKET_PATH));
+  }
+  struct stat st;
+  ASSERT_EQ(0, stat(SOCKET_PATH, &st));
+  {
+    lrdb::local_server server((std::string(SOCKET_PATH)));
+    // socket file of running server is not replaced
+    ASSERT_THROW(lrdb::local_server((std::string(SOCKET_PATH))),
+                 std::exception);
+    ASSERT_EQ(0, stat(SOCKET_PATH, &st));
+  }
+  ASSERT_NE(0, stat(SOCKET_PATH, &st));
+}
+#endif
+
+#ifdef LRDB_HAS_SHARED_MEMORY_STREAM
+TEST(SharedMemoryDebugServerTest, ConnectTest) {
+  const char* TEST_LUA_SCRIPT = "../test/lua/test1.lua";
+  const char* NAME = "/lrdb_server_test";
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  {
+    // small rings. large messages wait for reader
+    lrdb::shared_memory_server server(NAME, 1024);
+    server.reset(L);
+
+    std::thread client_thread([&] {
+      lrdb::shared_memory_client client;
+      std::vector<std::string> notifies;
+      size_t snapshot_size = 0;
+      bool breakpoint_paused = false;
+      client.on_notify = [&](const lrdb::json::value& v) {
+        notifies.push_back(lrdb::message::get_method(v));
+        if (notifies.back() == "paused" &&
+            v.get("params").get("reason") == lrdb::json::value("breakpoint")) {
+          breakpoint_paused = true;
+        }
+        if (notifies.back() == "heap_snapshot_chunk") {
+          snapshot_size +=
+              v.get("params").get("data").get<std::string>().size();
+        }
+      };
+      ASSERT_TRUE(client.command_stream().connect(NAME));
+      ASSERT_FALSE(lrdb::shared_memory_client().command_stream().connect(
+          NAME, std::chrono::milliseconds(10)));
+
+      lrdb::json::object break_point;
+      break_point["file"] = lrdb::json::value(TEST_LUA_SCRIPT);
+      break_point["line"] = lrdb::json::value(6.);
+      lrdb::json::value res =
+          client.request("add_breakpoint", lrdb::json::value(break_point));
+      ASSERT_FALSE(res.contains("error"));
+      res = client.request("continue");
+      ASSERT_FALSE(res.contains("error"));
+      // pause at entry is skipped if continue is received before that
+      while (!breakpoint_paused) {
+        ASSERT_TRUE(client.command_stream().is_open());
+        client.command_stream().run_one();
+      }
+
+      lrdb::json::object frame;
+      frame["stack_no"] = lrdb::json::value(0.);
+      res = client.request("get_local_variable", lrdb::json::value(frame));
+      ASSERT_EQ("abc",
+                res.get("result").get("local_array").get(2).get<std::string>());
+
+      lrdb::json::object param;
+      param["chunk_size"] = lrdb::json::value(4096.);
+      res = client.request("heap_snapshot", lrdb::json::value(param));
+      ASSERT_LT(1024., res.get("result").get("total_size").get<double>());
+      ASSERT_LT(1024U, snapshot_size);
+
+      res = client.request("continue");
+      ASSERT_FALSE(res.contains("error"));
+      client.command_stream().close();
+    });
+
+    ASSERT_EQ(0, luaL_dofile(L, TEST_LUA_SCRIPT));
+    client_thread.join();
+    server.reset();
+  }
+  lua_close(L);
+}
+TEST(SharedMemoryDebugServerTest, CrashedClientTest) {
+  const char* NAME = "/lrdb_server_test";
+
+  lrdb::command_stream_shared_memory stream(NAME, 1024);
+  // object of running server is not recreated
+  ASSERT_THROW(lrdb::command_stream_shared_memory(NAME, 1024),
+               std::runtime_error);
+
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+  if (pid == 0) {
+    // exit without close
+    lrdb::command_stream_shared_memory_client client;
+    _exit(client.connect(NAME) ? 0 : 1);
+  }
+  stream.wait_for_connection();
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_EQ(0, status);
+
+  // returns at close
+  stream.run_one();
+  ASSERT_FALSE(stream.is_open());
+
+  std::thread server_thread([&] { stream.wait_for_connection(); });
+  lrdb::command_stream_shared_memory_client client;
+  ASSERT_TRUE(client.connect(NAME));
+  server_thread.join();
+  ASSERT_TRUE(stream.is_open());
+}
+#endif
+
 int main(int argc, char* argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
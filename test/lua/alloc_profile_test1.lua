@@ -0,0 +1,15 @@
+local t = {}
+local function allocate(n)
+  for i = 1, n do
+    t[i] = {i}
+  end
+end
+allocate(1000)
+local co = coroutine.wrap(function()
+  local s = {}
+  for i = 1, 100 do
+    s[i] = string.rep("x", 100) .. i
+  end
+  coroutine.yield(s)
+end)
+co()
@@ -0,0 +1,17 @@
+local function branch(v)
+  if v then
+    return 1
+  else
+    return 2
+  end
+end
+local function never_called()
+  return 3
+end
+local function covered(v)
+  return v + 1
+end
+for i = 1, 3 do
+  branch(true)
+  covered(i)
+end
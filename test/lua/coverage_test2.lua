@@ -0,0 +1,8 @@
+local first, second = function() return 1 end, function(v)
+  if v then
+    return 2
+  end
+  return 3
+end
+first()
+second(false)
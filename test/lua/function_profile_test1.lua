@@ -0,0 +1,27 @@
+local function leaf(n)
+  local s = 0
+  for i = 1, n do
+    s = s + i
+  end
+  return s
+end
+local function tail(n)
+  return leaf(n)
+end
+local function recursive(n)
+  if n > 0 then
+    return recursive(n - 1) + 1
+  end
+  return leaf(1000)
+end
+local co = coroutine.wrap(function()
+  for i = 1, 3 do
+    leaf(1000)
+    coroutine.yield()
+  end
+end)
+for i = 1, 3 do
+  co()
+  tail(1000)
+  recursive(3)
+end
@@ -0,0 +1,19 @@
+local function work(n, yield)
+  local s = 0
+  for i = 1, n do
+    s = s + i
+  end
+  if yield then
+    coroutine.yield()
+  end
+  return s
+end
+-- coroutines suspended in work are never resumed
+for i = 1, 100 do
+  local co = coroutine.wrap(work)
+  co(10, true)
+  collectgarbage()
+end
+for i = 1, 3 do
+  work(100000)
+end
@@ -0,0 +1,3 @@
+for i = 1, 50 do
+  cache[#cache + 1] = {name = "entry" .. i}
+end
@@ -0,0 +1,11 @@
+big = {}
+for i = 1, 100 do
+  big[i] = {string.rep("x", 1000) .. i}
+end
+local holder = setmetatable({}, {__index = big})
+local co = coroutine.create(function(t)
+  local kept = t
+  coroutine.yield()
+end)
+coroutine.resume(co, {"coroutine local"})
+local breakline = 1
@@ -0,0 +1,3 @@
+stop = false
+while not stop do
+end
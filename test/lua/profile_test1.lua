@@ -0,0 +1,14 @@
+local function leaf(n)
+  local s = 0
+  for i = 1, n do
+    s = s + i
+  end
+  return s
+end
+local function caller()
+  local s = leaf(100000)
+  return s
+end
+for i = 1, 10 do
+  caller()
+end
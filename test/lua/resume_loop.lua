@@ -0,0 +1,12 @@
+local co = coroutine.wrap(function()
+  while true do
+    coroutine.yield()
+  end
+end)
+co()
+return function()
+  stop = false
+  while not stop do
+    co()
+  end
+end
@@ -0,0 +1,12 @@
+
+function testfn()
+local big = {}
+for i = 1, 1000 do
+  big["key" .. i] = {index = i}
+end
+local list = {10, 20, 30}
+local value = "abc"
+return big, list, value
+end
+
+testfn()
@@ -1,5 +1,7 @@
 
 #include <iostream>
+#include <set>
+#include <sstream>
 
 #include "kaguya.hpp"
 #include "lrdb/debugger.hpp"
@@ -195,12 +197,42 @@ TEST_F(DebuggerTest, TickTest1) {
   const char* TEST_LUA_SCRIPT = "test1.lua";
 
   int tick_count = 0;
+  debugger.set_idle_hook_count(1);
   debugger.set_tick_handler([&](lrdb::debugger&) { tick_count++; });
 
   luaDofile(L, TEST_LUA_SCRIPT);
 
   ASSERT_TRUE(tick_count > 0);
 }
+TEST_F(DebuggerTest, HookMaskTest) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // idle
+  ASSERT_EQ(LUA_MASKCOUNT, debugger.hook_mask());
+  ASSERT_EQ(LUA_MASKCOUNT, lua_gethookmask(L));
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11);
+  ASSERT_TRUE(debugger.hook_mask() & LUA_MASKLINE);
+  ASSERT_TRUE(debugger.hook_mask() & LUA_MASKCALL);
+
+  int break_count = 0;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_count++;
+    debugger.clear_breakpoints();
+    debugger.unpause();
+    ASSERT_EQ(LUA_MASKCOUNT, debugger.hook_mask());
+  });
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_EQ(1, break_count);
+  ASSERT_EQ(LUA_MASKCOUNT, lua_gethookmask(L));
+
+  debugger.step_in();
+  ASSERT_EQ(LUA_MASKLINE, debugger.hook_mask());
+  debugger.unpause();
+  ASSERT_EQ(LUA_MASKCOUNT, debugger.hook_mask());
+  debugger.pause();
+  ASSERT_EQ(LUA_MASKLINE, debugger.hook_mask());
+}
 
 TEST_F(DebuggerTest, EvalTest1) {
   const char* TEST_LUA_SCRIPT = "eval_test1.lua";
@@ -225,6 +257,71 @@ TEST_F(DebuggerTest, EvalTest1) {
   luaDofile(L, TEST_LUA_SCRIPT);
 }
 
+TEST_F(DebuggerTest, EvalLazyEnvTest) {
+  const char* TEST_LUA_SCRIPT = "eval_test1.lua";
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 4);
+
+  bool breaked = false;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    breaked = true;
+    // resolve from nested function in eval chunk
+    std::vector<picojson::value> ret = debugger.current_debug_info().eval(
+        "(function() return local_value end)()");
+    ASSERT_EQ(1U, ret.size());
+    ASSERT_EQ(2, ret[0].get<double>());
+
+    // caller frame
+    auto callstack = debugger.get_call_stack();
+    ASSERT_LE(2U, callstack.size());
+    ret = callstack[1].eval("local_value3, arg");
+    ASSERT_EQ(2U, ret.size());
+    ASSERT_EQ(4, ret[0].get<double>());
+    ASSERT_EQ(2, ret[1].get<double>());
+
+    // reused environment resolve current value
+    ASSERT_TRUE(debugger.current_debug_info().set_local_var(
+        "local_value", picojson::value(5.0)));
+    ret = debugger.current_debug_info().eval("local_value");
+    ASSERT_EQ(1U, ret.size());
+    ASSERT_EQ(5, ret[0].get<double>());
+
+    debugger.current_debug_info().eval("assigned_in_eval = 3");
+    ret = debugger.current_debug_info().eval("assigned_in_eval");
+    ASSERT_EQ(1U, ret.size());
+    ASSERT_EQ(3, ret[0].get<double>());
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_TRUE(breaked);
+
+  lua_getglobal(L, "assigned_in_eval");
+  ASSERT_TRUE(lua_isnil(L, -1));
+  lua_pop(L, 1);
+}
+
+TEST_F(DebuggerTest, EvalEnvFrameFunctionTest) {
+  // eval chunk in caller frame without pause
+  lua_pushcfunction(L, [](lua_State* L) -> int {
+    std::string chunk = luaL_checkstring(L, 1);
+    lrdb::stack_info info(L, 1);
+    std::vector<picojson::value> ret = info.eval(chunk.c_str());
+    lua_pushboolean(L, !ret.empty() && ret[0].is<double>());
+    return 1;
+  });
+  lua_setglobal(L, "eval_in_caller");
+
+  // other function at same frame position does not see environment of
+  // previous function
+  ASSERT_EQ(0, luaL_dostring(L,
+                             "local function a() local x = 1 "
+                             "eval_in_caller('y = x') "
+                             "return eval_in_caller('y') end "
+                             "local function b() "
+                             "return eval_in_caller('y') end "
+                             "assert(a()) assert(not b())"));
+}
+
 TEST_F(DebuggerTest, EvalTest2) {
   const char* TEST_LUA_SCRIPT = "eval_test2.lua";
 
@@ -356,6 +453,24 @@ TEST_F(DebuggerTest, ConditionBreakPointTest) {
   ASSERT_EQ(require_line_number, break_line_numbers);
 }
 
+TEST_F(DebuggerTest, ConditionBreakPointErrorTest) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // runtime error condition break for notify to user
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11, "i.x == 4");
+
+  int break_count = 0;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_count++;
+    debugger.clear_breakpoints();
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  ASSERT_EQ(1, break_count);
+}
+
 TEST_F(DebuggerTest, HitConditionBreakPointTest) {
   const char* TEST_LUA_SCRIPT = "loop_test.lua";
 
@@ -501,6 +616,39 @@ TEST_F(DebuggerTest, HitConditionBreakPointTestEqual) {
   ASSERT_EQ(require_line_number, break_line_numbers);
 }
 
+TEST_F(DebuggerTest, HitConditionBreakPointTestEqualTo) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11, "", "== 3");
+
+  std::vector<size_t> hit_counts;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    hit_counts.push_back(debugger.current_breakpoint()->hit_count);
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  std::vector<size_t> require_hit_counts = {3};
+  ASSERT_EQ(require_hit_counts, hit_counts);
+}
+TEST_F(DebuggerTest, HitConditionBreakPointTestInvalid) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // invalid hit condition is always break
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11, "", ">=abc");
+
+  int break_count = 0;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_count++;
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  ASSERT_EQ(10, break_count);
+}
+
 TEST_F(DebuggerTest, RemoveBreakPointTest1) {
   const char* TEST_LUA_SCRIPT = "loop_test.lua";
 
@@ -627,6 +775,580 @@ TEST_F(DebuggerTest, FileMatchTest) {
   break_check("test1.lua", "..\\test\\lua\\test1.lua", 3);
 }
 
+TEST_F(DebuggerTest, FileMatchIndexTest) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // same line on other files, must not break
+  debugger.add_breakpoint("test1.lua", 11);
+  debugger.add_breakpoint("lua/loop_test.lua", 11);
+  debugger.add_breakpoint(".\\loop_test.lua", 4);
+
+  std::vector<int> break_line_numbers;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_line_numbers.push_back(debugger.current_debug_info().currentline());
+    auto* breakpoint = debugger.current_breakpoint();
+    ASSERT_TRUE(breakpoint);
+    ASSERT_EQ(".\\loop_test.lua", breakpoint->file);
+    if (breakpoint->hit_count == 2) {
+      debugger.clear_breakpoints(".\\loop_test.lua");
+    }
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  std::vector<int> require_line_number = {4, 4};
+  ASSERT_EQ(require_line_number, break_line_numbers);
+}
+
+TEST_F(DebuggerTest, FunctionFilterTest) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // breakpoint inside testfn. line hook is not required for main chunk of
+  // other file
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 5);
+
+  std::vector<int> break_line_numbers;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_line_numbers.push_back(debugger.current_debug_info().currentline());
+    debugger.unpause();
+  });
+  int line_hooked_in_other = 0;
+  debugger.set_tick_handler([&](lrdb::debugger& debugger) {
+    lrdb::debug_info& info = debugger.current_debug_info();
+    if (strcmp(info.source(), "@eval_test1.lua") == 0 &&
+        (lua_gethookmask(L) & LUA_MASKLINE)) {
+      line_hooked_in_other++;
+    }
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  luaDofile(L, "eval_test1.lua");
+
+  std::vector<int> require_line_number(10, 5);
+  ASSERT_EQ(require_line_number, break_line_numbers);
+  ASSERT_EQ(0, line_hooked_in_other);
+}
+TEST_F(DebuggerTest, FunctionFilterBreakPointChangeTest) {
+  const char* TEST_LUA_SCRIPT = "loop_test.lua";
+
+  // testfn is decided not line hooked, then breakpoint added inside it
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11);
+
+  std::vector<int> break_line_numbers;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_line_numbers.push_back(debugger.current_debug_info().currentline());
+    if (break_line_numbers.size() == 3) {
+      debugger.add_breakpoint(TEST_LUA_SCRIPT, 5);
+    }
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  std::vector<int> require_line_number = {11, 11, 11, 5};
+  for (int i = 0; i < 7; ++i) {
+    require_line_number.push_back(11);
+    require_line_number.push_back(5);
+  }
+  ASSERT_EQ(require_line_number, break_line_numbers);
+}
+TEST_F(DebuggerTest, FunctionFilterCoroutineTest) {
+  const char* TEST_LUA_SCRIPT = "break_coroutine_test1.lua";
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 10);
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 4);
+
+  std::vector<int> break_line_numbers;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    break_line_numbers.push_back(debugger.current_debug_info().currentline());
+    debugger.unpause();
+  });
+
+  luaDofile(L, TEST_LUA_SCRIPT);
+  std::vector<int> require_line_number = {10, 4};
+  ASSERT_EQ(require_line_number, break_line_numbers);
+}
+
+TEST_F(DebuggerTest, SamplingProfilerTest) {
+  const char* TEST_LUA_SCRIPT = "profile_test1.lua";
+
+  debugger.profiler().start(std::chrono::microseconds(0));
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.profiler().stop();
+
+  ASSERT_LT(0U, debugger.profiler().sample_count());
+  std::string collapsed = debugger.profiler().collapsed_stacks();
+  ASSERT_NE(std::string::npos,
+            collapsed.find("main (profile_test1.lua:0);"
+                           "caller (profile_test1.lua:8);"
+                           "leaf (profile_test1.lua:1) "));
+
+  size_t count = debugger.profiler().sample_count();
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_EQ(count, debugger.profiler().sample_count());
+}
+
+TEST_F(DebuggerTest, FunctionProfilerTest) {
+  const char* TEST_LUA_SCRIPT = "function_profile_test1.lua";
+
+  debugger.start_function_profile();
+  ASSERT_TRUE(debugger.hook_mask() & LUA_MASKCALL);
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.stop_function_profile();
+  ASSERT_FALSE(debugger.hook_mask() & LUA_MASKCALL);
+
+  const auto& functions = debugger.function_profile().functions();
+  const auto& stats = debugger.function_profile().stats();
+  std::map<std::string, lrdb::function_profiler::function_stats> result;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    if (functions[i].source == "@function_profile_test1.lua") {
+      result[functions[i].name] = stats[i];
+    }
+  }
+  ASSERT_EQ(9U, result["leaf"].calls);
+  ASSERT_EQ(3U, result["tail"].calls);
+  ASSERT_EQ(12U, result["recursive"].calls);
+  ASSERT_EQ(1U, result["main"].calls);
+  ASSERT_EQ(0, result["leaf"].active);
+  ASSERT_EQ(0, result["recursive"].active);
+  ASSERT_LT(0, result["leaf"].exclusive.count());
+  ASSERT_LE(result["recursive"].exclusive, result["recursive"].inclusive);
+  ASSERT_LE(result["recursive"].inclusive, result["main"].inclusive);
+  ASSERT_LE(result["leaf"].inclusive, result["main"].inclusive);
+}
+
+TEST_F(DebuggerTest, FunctionProfilerAbandonedCoroutineTest) {
+  const char* TEST_LUA_SCRIPT = "function_profile_test2.lua";
+
+  debugger.start_function_profile();
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.stop_function_profile();
+
+  const auto& functions = debugger.function_profile().functions();
+  const auto& stats = debugger.function_profile().stats();
+  lrdb::function_profiler::function_stats work;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    if (functions[i].source == "@function_profile_test2.lua" &&
+        functions[i].linedefined == 1) {
+      work = stats[i];
+    }
+  }
+  ASSERT_EQ(103U, work.calls);
+  // frames left on suspended coroutines do not hide calls on main thread
+  ASSERT_LT(0, work.inclusive.count());
+  ASSERT_LE(work.exclusive, work.inclusive);
+  // shadow stacks of collected coroutines are dropped
+  ASSERT_GT(100, work.active);
+}
+
+TEST_F(DebuggerTest, CoverageTest) {
+  const char* TEST_LUA_SCRIPT = "coverage_test1.lua";
+
+  int covered_line_events = 0;
+  debugger.set_tick_handler([&](lrdb::debugger& debugger) {
+    lrdb::debug_info& info = debugger.current_debug_info();
+    if (info.is_available_info("l") && info.currentline() == 12) {
+      covered_line_events++;
+    }
+  });
+  debugger.start_coverage();
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.stop_coverage();
+
+  // line hook is removed from covered function
+  ASSERT_EQ(1, covered_line_events);
+
+  const auto& chunks = debugger.coverage().chunks();
+  ASSERT_EQ(1U, chunks.size());
+  const auto& chunk = chunks[0];
+  ASSERT_EQ("@coverage_test1.lua", chunk.source);
+  ASSERT_TRUE(chunk.is_executed(3));
+  ASSERT_FALSE(chunk.is_executed(5));
+  ASSERT_TRUE(chunk.is_valid(5));
+  ASSERT_FALSE(chunk.is_valid(9));
+  ASSERT_TRUE(chunk.is_executed(12));
+  ASSERT_TRUE(chunk.is_executed(15));
+
+  std::string lcov = debugger.coverage().lcov();
+  ASSERT_EQ(0U, lcov.find("TN:\nSF:coverage_test1.lua\n"));
+  ASSERT_NE(std::string::npos, lcov.find("DA:3,1\n"));
+  ASSERT_NE(std::string::npos, lcov.find("DA:5,0\n"));
+  ASSERT_EQ(std::string::npos, lcov.find("DA:9,"));
+}
+
+TEST_F(DebuggerTest, CoverageSameLineFunctionTest) {
+  const char* TEST_LUA_SCRIPT = "coverage_test2.lua";
+
+  debugger.start_coverage();
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.stop_coverage();
+
+  // second function is defined on first line of first function
+  const auto& chunk = debugger.coverage().chunks()[0];
+  ASSERT_TRUE(chunk.is_executed(2));
+  ASSERT_TRUE(chunk.is_valid(3));
+  ASSERT_FALSE(chunk.is_executed(3));
+  ASSERT_TRUE(chunk.is_executed(5));
+}
+
+TEST_F(DebuggerTest, LineCountsTest) {
+  const char* TEST_LUA_SCRIPT = "coverage_test1.lua";
+
+  int other_file_line_events = 0;
+  debugger.set_tick_handler([&](lrdb::debugger& debugger) {
+    lrdb::debug_info& info = debugger.current_debug_info();
+    if (info.is_available_info("l") &&
+        strcmp(info.source(), "@test1.lua") == 0) {
+      other_file_line_events++;
+    }
+  });
+  debugger.start_line_counts(TEST_LUA_SCRIPT);
+  ASSERT_TRUE(debugger.hook_mask() & LUA_MASKLINE);
+  luaDofile(L, TEST_LUA_SCRIPT);
+  luaDofile(L, "test1.lua");
+  ASSERT_EQ(0, other_file_line_events);
+
+  const std::vector<size_t>& counts = debugger.line_counts(TEST_LUA_SCRIPT);
+  ASSERT_LT(16U, counts.size());
+  ASSERT_EQ(3U, counts[3]);
+  ASSERT_EQ(0U, counts[5]);
+  ASSERT_EQ(3U, counts[12]);
+  ASSERT_EQ(3U, counts[15]);
+  ASSERT_EQ(3U, counts[16]);
+  ASSERT_TRUE(debugger.line_counts("test1.lua").empty());
+
+  debugger.stop_line_counts(TEST_LUA_SCRIPT);
+  ASSERT_FALSE(debugger.hook_mask() & LUA_MASKLINE);
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_EQ(3U, debugger.line_counts(TEST_LUA_SCRIPT)[3]);
+
+  debugger.clear_line_counts();
+  ASSERT_TRUE(debugger.line_counts(TEST_LUA_SCRIPT).empty());
+}
+
+TEST_F(DebuggerTest, AllocationProfilerTest) {
+  const char* TEST_LUA_SCRIPT = "alloc_profile_test1.lua";
+
+  void* original_ud = 0;
+  lua_Alloc original_alloc = lua_getallocf(L, &original_ud);
+  debugger.set_idle_hook_count(10);
+  debugger.start_alloc_profile();
+  ASSERT_NE(original_alloc, lua_getallocf(L, 0));
+  luaDofile(L, TEST_LUA_SCRIPT);
+  debugger.stop_alloc_profile();
+  void* ud = 0;
+  ASSERT_EQ(original_alloc, lua_getallocf(L, &ud));
+  ASSERT_EQ(original_ud, ud);
+
+  const lrdb::allocation_profiler& profiler = debugger.alloc_profile();
+  std::vector<lrdb::allocation_profiler::site_stats> sites =
+      profiler.top(100);
+  ASSERT_FALSE(sites.empty());
+  for (size_t i = 1; i < sites.size(); ++i) {
+    ASSERT_GE(sites[i - 1].bytes, sites[i].bytes);
+  }
+  std::map<int, lrdb::allocation_profiler::site_stats> lines;
+  for (const auto& site : sites) {
+    if (site.source == "@alloc_profile_test1.lua") {
+      lines[site.line] = site;
+    }
+  }
+  ASSERT_LE(1000U, lines[4].count);
+  ASSERT_EQ("allocate", lines[4].name);
+  ASSERT_LE(100U, lines[11].count);
+  ASSERT_LE(lines[4].bytes + lines[11].bytes, profiler.total_bytes());
+
+  size_t total = profiler.total_bytes();
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_EQ(total, profiler.total_bytes());
+}
+
+TEST_F(DebuggerTest, AllocationProfilerCollectedSourceTest) {
+  debugger.set_idle_hook_count(10);
+  debugger.start_alloc_profile();
+  // source strings of collected chunks may be reused by following chunks
+  const char* chunk =
+      "local t = {} for i = 1, 10 do t[i] = {} end collectgarbage()";
+  for (int i = 0; i < 100; ++i) {
+    std::string name = "=chunk" + std::to_string(i);
+    ASSERT_EQ(0, luaL_loadbuffer(L, chunk, strlen(chunk), name.c_str()));
+    ASSERT_EQ(0, lua_pcall(L, 0, 0, 0));
+  }
+  debugger.stop_alloc_profile();
+
+  // stats of each chunk are kept
+  const lrdb::allocation_profiler& profiler = debugger.alloc_profile();
+  std::vector<lrdb::allocation_profiler::site_stats> sites =
+      profiler.top(1000);
+  std::set<std::string> sources;
+  size_t count = 0;
+  for (const auto& site : sites) {
+    sources.insert(site.source);
+    count += site.count;
+  }
+  ASSERT_EQ(profiler.total_count(), count);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(1U, sources.count("=chunk" + std::to_string(i)));
+  }
+}
+
+TEST_F(DebuggerTest, HeapSnapshotTest) {
+  const char* TEST_LUA_SCRIPT = "heap_snapshot_test1.lua";
+
+  std::vector<std::string> chunks;
+  lrdb::heap_snapshot snapshot(1024);
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 11);
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    debugger.take_heap_snapshot(
+        snapshot, [&](const std::string& chunk) { chunks.push_back(chunk); });
+    debugger.unpause();
+  });
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  ASSERT_LT(1U, chunks.size());
+  std::string text;
+  for (const std::string& chunk : chunks) {
+    ASSERT_GT(1024U + 256U, chunk.size());
+    ASSERT_EQ('\n', chunk.back());
+    text += chunk;
+  }
+
+  std::map<uint32_t, std::string> types;
+  std::map<uint32_t, uint64_t> retained;
+  std::map<std::string, uint32_t> named_edges;
+  std::istringstream is(text);
+  std::string line;
+  size_t edges = 0;
+  while (std::getline(is, line)) {
+    std::istringstream ls(line);
+    std::string kind;
+    uint32_t id = 0;
+    ls >> kind >> id;
+    if (kind == "N") {
+      ASSERT_EQ(types.size(), id);
+      ls >> types[id];
+    } else if (kind == "E") {
+      uint32_t to = 0;
+      std::string name;
+      ls >> to;
+      std::getline(ls, name);
+      ASSERT_LT(id, types.size());
+      named_edges[name.substr(1)] = to;
+      edges++;
+    } else if (kind == "R") {
+      ls >> retained[id];
+    }
+  }
+  ASSERT_EQ(snapshot.node_count(), types.size());
+  ASSERT_EQ(snapshot.edge_count(), edges);
+  ASSERT_EQ(types.size(), retained.size());
+  ASSERT_EQ("root", types[0]);
+  ASSERT_EQ(snapshot.total_size(), retained[0]);
+
+  ASSERT_TRUE(named_edges.count("big"));
+  uint32_t big = named_edges["big"];
+  ASSERT_EQ("table", types[big]);
+  // elements and strings are retained only by big
+  ASSERT_LE(100U * 1000U, retained[big]);
+  ASSERT_GT(snapshot.total_size(), retained[big]);
+
+  ASSERT_TRUE(named_edges.count("0:holder"));
+  ASSERT_TRUE(named_edges.count("(metatable)"));
+  ASSERT_TRUE(named_edges.count("1:kept"));
+  ASSERT_EQ("table", types[named_edges["1:kept"]]);
+}
+
+TEST_F(DebuggerTest, HeapDiffTest) {
+  const char* TEST_LUA_SCRIPT = "heap_diff_test1.lua";
+
+  luaL_dostring(L, "cache = {}");
+  lrdb::heap_diff diff;
+  debugger.take_heap_baseline(diff);
+  ASSERT_LT(0U, diff.baseline_count());
+  luaDofile(L, TEST_LUA_SCRIPT);
+
+  std::vector<lrdb::heap_diff::growth> groups = debugger.heap_growth(diff);
+  ASSERT_FALSE(groups.empty());
+  for (size_t i = 1; i < groups.size(); ++i) {
+    ASSERT_GE(groups[i - 1].size, groups[i].size);
+  }
+  std::map<std::string, lrdb::heap_diff::growth> cache_groups;
+  for (const auto& growth : groups) {
+    if (growth.path == "globals.cache") {
+      cache_groups[growth.type] = growth;
+    }
+  }
+  ASSERT_EQ(50U, cache_groups["table"].count);
+  ASSERT_LE(50U, cache_groups["string"].count);
+  ASSERT_LE(cache_groups["table"].count + cache_groups["string"].count,
+            diff.added_count());
+  ASSERT_EQ(0U, diff.removed_count());
+
+  luaL_dostring(L, "cache = nil");
+  groups = debugger.heap_growth(diff);
+  ASSERT_LE(1U, diff.removed_count());  // cache table and key
+  for (const auto& growth : groups) {
+    ASSERT_NE("globals.cache", growth.path);
+  }
+}
+
+TEST_F(DebuggerTest, MsgpackWriterTest) {
+  luaL_dostring(L,
+                "return {1, 2.5, 'a\"\\\\/\\n\\1', {x = {y = true}}}, "
+                "{k = 0/0, [1.5] = 'skip', f = print, n = -1e300 * 1e300}, "
+                "nil, false, 'str', {-1, 200, -200, 70000, 2^40, -2^40}");
+  int top = lua_gettop(L);
+  ASSERT_EQ(6, top);
+  lrdb::json_writer writer(lrdb::json_writer::MSGPACK);
+  for (int depth = 0; depth < 4; ++depth) {
+    for (int index = 1; index <= top; ++index) {
+      writer.clear();
+      lrdb::utility::write_json(writer, L, index, depth);
+      picojson::value expected = lrdb::utility::to_json(L, index, depth);
+      picojson::value decoded;
+      ASSERT_EQ("", lrdb::message::msgpack::decode(writer.str(), decoded));
+      ASSERT_EQ(expected, decoded);
+      ASSERT_EQ("",
+                lrdb::message::msgpack::decode(
+                    lrdb::message::msgpack::encode(expected), decoded));
+      ASSERT_EQ(expected, decoded);
+    }
+  }
+  lua_settop(L, 0);
+
+  ASSERT_EQ(std::string("\x01", 1),
+            lrdb::message::msgpack::encode(picojson::value(1.)));
+  ASSERT_EQ(std::string("\xa3str", 4),
+            lrdb::message::msgpack::encode(picojson::value("str")));
+  picojson::value decoded;
+  ASSERT_NE("", lrdb::message::msgpack::decode(std::string("\xa3st", 3),
+                                                decoded));
+}
+
+TEST_F(DebuggerTest, JsonWriterTest) {
+  const char* TEST_LUA_SCRIPT = "get_local_var_test1.lua";
+
+  // same as to_json except key order
+  luaL_dostring(L,
+                "return {1, 2.5, 'a\"\\\\/\\n\\1', {x = {y = true}}}, "
+                "{k = 0/0, [1.5] = 'skip', f = print, n = -1e300 * 1e300}, "
+                "nil, false, 'str'");
+  int top = lua_gettop(L);
+  ASSERT_EQ(5, top);
+  lrdb::json_writer writer;
+  for (int depth = 0; depth < 4; ++depth) {
+    for (int index = 1; index <= top; ++index) {
+      writer.clear();
+      lrdb::utility::write_json(writer, L, index, depth);
+      picojson::value parsed;
+      ASSERT_EQ("", picojson::parse(parsed, writer.str()));
+      ASSERT_EQ(lrdb::utility::to_json(L, index, depth), parsed);
+    }
+  }
+  lua_settop(L, 0);
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 6);
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    writer.clear();
+    debugger.current_debug_info().get_local_vars(writer, 1);
+    picojson::value parsed;
+    ASSERT_EQ("", picojson::parse(parsed, writer.str()));
+    picojson::object expected;
+    for (auto& var : debugger.current_debug_info().get_local_vars(1)) {
+      expected[var.first] = var.second;
+    }
+    ASSERT_EQ(picojson::value(expected), parsed);
+
+    writer.clear();
+    std::string error;
+    ASSERT_TRUE(debugger.current_debug_info().eval(
+        writer, "local_value2, {local_value1}", error));
+    ASSERT_EQ("[\"abc\",[1]]", writer.str());
+    writer.clear();
+    ASSERT_FALSE(debugger.current_debug_info().eval(writer, "+", error));
+    ASSERT_NE("", error);
+    ASSERT_EQ("", writer.str());
+    debugger.unpause();
+  });
+  luaDofile(L, TEST_LUA_SCRIPT);
+}
+
+TEST_F(DebuggerTest, VariableReferenceTest) {
+  const char* TEST_LUA_SCRIPT = "variable_reference_test1.lua";
+
+  debugger.add_breakpoint(TEST_LUA_SCRIPT, 9);
+  bool breaked = false;
+  debugger.set_pause_handler([&](lrdb::debugger& debugger) {
+    breaked = true;
+    lrdb::variable_references& references = debugger.references();
+    lrdb::json_writer writer;
+    debugger.current_debug_info().get_local_vars(writer, references);
+    picojson::value locals;
+    ASSERT_EQ("", picojson::parse(locals, writer.str()));
+    ASSERT_EQ("abc", locals.get("value").get<std::string>());
+    ASSERT_EQ("table", locals.get("list").get("type").get<std::string>());
+    ASSERT_EQ(3, locals.get("list").get("length").get<double>());
+    int big = int(locals.get("big").get("reference").get<double>());
+    int list = int(locals.get("list").get("reference").get<double>());
+    ASSERT_NE(big, list);
+    ASSERT_EQ(2U, references.size());
+
+    // same value is same handle
+    writer.clear();
+    std::string error;
+    ASSERT_TRUE(debugger.current_debug_info().eval(writer, references,
+                                                   "list", error));
+    picojson::value evaluated;
+    ASSERT_EQ("", picojson::parse(evaluated, writer.str()));
+    ASSERT_EQ(list, int(evaluated.get(0).get("reference").get<double>()));
+
+    writer.clear();
+    ASSERT_TRUE(debugger.get_children(writer, list));
+    ASSERT_EQ(
+        "[{\"key\":1,\"value\":10},{\"key\":2,\"value\":20},"
+        "{\"key\":3,\"value\":30}]",
+        writer.str());
+
+    // paging. sequential pages continue traversal
+    std::set<std::string> keys;
+    for (size_t start = 0;; start += 300) {
+      writer.clear();
+      ASSERT_TRUE(debugger.get_children(writer, big, start, 300));
+      picojson::value page;
+      ASSERT_EQ("", picojson::parse(page, writer.str()));
+      const picojson::array& children = page.get<picojson::array>();
+      for (auto& child : children) {
+        keys.insert(child.get("key").get<std::string>());
+        ASSERT_EQ("table", child.get("value").get("type").get<std::string>());
+      }
+      if (children.size() < 300) {
+        break;
+      }
+    }
+    ASSERT_EQ(1000U, keys.size());
+    ASSERT_EQ(1002U, references.size());
+
+    // random access page
+    writer.clear();
+    ASSERT_TRUE(debugger.get_children(writer, big, 500, 2));
+    picojson::value page;
+    ASSERT_EQ("", picojson::parse(page, writer.str()));
+    ASSERT_EQ(2U, page.get<picojson::array>().size());
+
+    writer.clear();
+    ASSERT_FALSE(debugger.get_children(writer, 100000));
+    ASSERT_EQ("", writer.str());
+    debugger.unpause();
+  });
+  luaDofile(L, TEST_LUA_SCRIPT);
+  ASSERT_TRUE(breaked);
+  // released on resume
+  ASSERT_EQ(0U, debugger.references().size());
+  lrdb::json_writer writer;
+  ASSERT_FALSE(debugger.get_children(writer, 1));
+}
+
 int main(int argc, char* argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();